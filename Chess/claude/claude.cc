@@ -19,6 +19,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+
+#include "claude_bitbase.h"
+#include "claude_eval.h"
+#include "claude_syzygy.h"
+#include "claude_tt.h"
 
 namespace {
   
@@ -67,6 +73,60 @@ namespace {
     return 0;
   }
   
+  // Castling rights kept when a piece leaves or arrives at each square.
+  const uint8_t CASTLING_MASK[64] = {
+    static_cast<uint8_t>(~WHITE_OOO), 0xff, 0xff, 0xff,
+    static_cast<uint8_t>(~(WHITE_OO | WHITE_OOO)), 0xff, 0xff,
+    static_cast<uint8_t>(~WHITE_OO),
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    static_cast<uint8_t>(~BLACK_OOO), 0xff, 0xff, 0xff,
+    static_cast<uint8_t>(~(BLACK_OO | BLACK_OOO)), 0xff, 0xff,
+    static_cast<uint8_t>(~BLACK_OO)
+  };
+  
+  // Random numbers of the Zobrist key, from a fixed generator.
+  class ZobristKeys {
+  public:
+    ZobristKeys() {
+      uint64_t state = 0x2545f4914f6cdd1dULL;
+      for (int p = 0; p < 13; ++p) {
+        for (int sq = 0; sq < 64; ++sq) {
+          piece[p][sq] = (p == 6) ? 0 : Next(&state);
+        }
+      }
+      for (int i = 0; i < 16; ++i) {
+        castling[i] = Next(&state);
+      }
+      for (int x = 0; x < 8; ++x) {
+        en_passant[x] = Next(&state);
+      }
+      black = Next(&state);
+    }
+    
+    // Indexed by piece + 6; empty squares have 0.
+    uint64_t piece[13][64];
+    uint64_t castling[16];
+    // by file
+    uint64_t en_passant[8];
+    uint64_t black;
+    
+  private:
+    static uint64_t Next(uint64_t* state) {
+      // splitmix64
+      uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      return z ^ (z >> 31);
+    }
+  };
+  
+  const ZobristKeys zobrist;
+  
   char piece2a(int p) {
     const static char* PIECE_MARK = "kqrbnp.PNBRQK";
     
@@ -79,6 +139,13 @@ namespace {
 }  // namespace
 
 
+double GetTime() {
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec + t.tv_usec*1e-6;
+}
+
+
 // Move
 
 /* This default constructor causes 50% slow down */
@@ -184,35 +251,58 @@ void Position::StartPosition() {
     }
   }
   side_ = 1;
-  can_castling_[0][0] = true;
-  can_castling_[0][1] = true;
-  can_castling_[1][0] = true;
-  can_castling_[1][1] = true;
-  en_passant_target_x_ = -1;
-  //en_passant_target_y_ = -1; // do not need
+  castling_ = WHITE_OO | WHITE_OOO | BLACK_OO | BLACK_OOO;
+  en_passant_square_ = -1;
   halfmove_clock_ = 0;
   fullmove_counter_ = 1;
-  next_moves_.clear();
+  InitPieceLists();
 }
 
-void Position::PartialCopyFrom(const Position& src) {
-  for (int y = 0; y < 8; ++y) {
-    for (int x = 0; x < 8; ++x) {
-      board_[x][y] = src.board_[x][y];
+void Position::InitPieceLists() {
+  piece_count_[0] = 0;
+  piece_count_[1] = 0;
+  key_ = zobrist.castling[castling_];
+  if (en_passant_square_ >= 0) {
+    key_ ^= zobrist.en_passant[SquareX(en_passant_square_)];
+  }
+  if (side_ == BLACK) {
+    key_ ^= zobrist.black;
+  }
+  for (int sq = 0; sq < 64; ++sq) {
+    int p = board_[SquareX(sq)][SquareY(sq)];
+    if (p != 0) {
+      key_ ^= zobrist.piece[p + 6][sq];
+      int s = p > 0;
+      assert(piece_count_[s] < 16);
+      piece_list_[s][piece_count_[s]++] = sq;
+      if (p == 6 || p == -6) {
+        king_square_[s] = sq;
+      }
+    }
+  }
+}
+
+void Position::MovePiece(int s, int from, int to) {
+  for (int i = 0; ; ++i) {
+    assert(i < piece_count_[s]);
+    if (piece_list_[s][i] == from) {
+      piece_list_[s][i] = to;
+      break;
+    }
+  }
+  if (king_square_[s] == from) {
+    king_square_[s] = to;
+  }
+}
+
+void Position::RemovePiece(int s, int sq) {
+  for (int i = 0; ; ++i) {
+    assert(i < piece_count_[s]);
+    if (piece_list_[s][i] == sq) {
+      piece_list_[s][i] = piece_list_[s][--piece_count_[s]];
+      break;
     }
   }
-  // Faster than the above but too optimized?
-  // memcpy(board_, src.board_, sizeof(board_));
-  side_ = src.side_;
-  for (int i = 0; i < 2; ++i) {
-    can_castling_[i][0] = src.can_castling_[i][0];
-    can_castling_[i][1] = src.can_castling_[i][1];
-  }
-  //en_passant_target_x_ = src.en_passant_target_x_; // do not need?
-  //en_passant_target_y_ = src.en_passant_target_y_;
-  halfmove_clock_ = src.halfmove_clock_;
-  fullmove_counter_ = src.fullmove_counter_;
-  next_moves_.clear();
 }
 
 void Position::Print() const {
@@ -222,544 +312,472 @@ void Position::Print() const {
     }
     printf("\n");
   }
-  for (vector<Move>::const_iterator it = next_moves_.begin(); it != next_moves_.end(); ++it) {
+  MoveList moves;
+  CalcMoves(&moves);
+  for (const Move* it = moves.begin(); it != moves.end(); ++it) {
     it->Print();
   }
   printf("\n\n");
 }
 
+bool Position::IsRepetitionOf(const Position& other) const {
+  return side_ == other.side_ &&
+  castling_ == other.castling_ &&
+  en_passant_square_ == other.en_passant_square_ &&
+  memcmp(board_, other.board_, sizeof(board_)) == 0;
+}
+
+namespace {
+
+  // Marks of the pieces, indexed by piece + 6.
+  const char PIECE_MARK[] = "kqrbnp.PNBRQK";
+
+  char* WriteNumber(unsigned n, char* out) {
+    char digits[16];
+    int count = 0;
+    do {
+      digits[count++] = '0' + n % 10;
+      n /= 10;
+    } while (n > 0);
+    while (count > 0) {
+      *out++ = digits[--count];
+    }
+    return out;
+  }
+
+  bool IsFenSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+  }
+
+  const char* SkipFenSpaces(const char* p, const char* end) {
+    while (p < end && IsFenSpace(*p)) {
+      ++p;
+    }
+    return p;
+  }
+
+  // Reads a move counter, saturating at limit. Returns NULL if there is
+  // no number.
+  const char* ReadCounter(const char* p, const char* end, unsigned limit, unsigned* n) {
+    if (p == end || *p < '0' || *p > '9') {
+      return NULL;
+    }
+    *n = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+      *n = min(*n * 10 + (*p - '0'), limit);
+    }
+    return p;
+  }
+
+}  // namespace
+
 string Position::Fen() const {
-  const static char* PIECE_MARK = "kqrbnp.PNBRQK";
-  
-  ostringstream os;
+  char buffer[FEN_BUFFER_SIZE];
+  return string(buffer, WriteFen(buffer));
+}
+
+int Position::WriteFen(char* buffer) const {
+  char* out = buffer;
   // board
   for (int y = 7; y >= 0; --y) {
+    int empty = 0;
     for (int x = 0; x < 8; ++x) {
-      if (board_[x][y] == 0) {
-        int count = 1;
-        for (++x; x < 8; ++x) {
-          if (board_[x][y] == 0) {
-            ++count;
-          } else {
-            --x;
-            break;
-          }
-        }
-        os << count;
-      } else if (board_[x][y] >= -6 && board_[x][y] <= 6) {
-        os << PIECE_MARK[board_[x][y] + 6];
-      } else {
-        os << '?';
+      int p = board_[x][y];
+      if (p == 0) {
+        ++empty;
+        continue;
+      }
+      if (empty > 0) {
+        *out++ = '0' + empty;
+        empty = 0;
       }
+      *out++ = (p >= -6 && p <= 6) ? PIECE_MARK[p + 6] : '?';
+    }
+    if (empty > 0) {
+      *out++ = '0' + empty;
     }
     if (y > 0) {
-      os << '/';
+      *out++ = '/';
     }
   }
-  os << ' ';
-  //  side to move
-  switch (side_) {
-    case -1:
-      os << "b ";
-      break;
-      
-    case 1:
-      os << "w ";
-      break;
-      
-    default:
-      os << "? ";
-  }
+  *out++ = ' ';
+  // side to move
+  *out++ = (side_ == WHITE) ? 'w' : (side_ == BLACK) ? 'b' : '?';
+  *out++ = ' ';
   // castling ability
-  bool has_castling_ability = false;
-  if (can_castling_[0][1]) {
-    os << 'K';
-    has_castling_ability = true;
+  if (castling_ == 0) {
+    *out++ = '-';
   }
-  if (can_castling_[0][0]) {
-    os << 'Q';
-    has_castling_ability = true;
+  if (castling_ & WHITE_OO) {
+    *out++ = 'K';
   }
-  if (can_castling_[1][1]) {
-    os << 'k';
-    has_castling_ability = true;
+  if (castling_ & WHITE_OOO) {
+    *out++ = 'Q';
   }
-  if (can_castling_[1][0]) {
-    os << 'q';
-    has_castling_ability = true;
+  if (castling_ & BLACK_OO) {
+    *out++ = 'k';
   }
-  if (!has_castling_ability) {
-    os << '-';
+  if (castling_ & BLACK_OOO) {
+    *out++ = 'q';
   }
-  os << ' ';
-  
+  *out++ = ' ';
   // en passant target
-  if (en_passant_target_x_ == -1) {
-    os << "- ";
+  if (en_passant_square_ == -1) {
+    *out++ = '-';
   } else {
-    os << static_cast<char>('a' + en_passant_target_x_);
-    os << static_cast<char>('1' + en_passant_target_y_);
-    os << ' ';
-  }
-  // halfmove clock
-  os << halfmove_clock_;
-  os << ' ';
-  // fullmove counter
-  os << fullmove_counter_;
-  
-  return os.str();
+    *out++ = 'a' + SquareX(en_passant_square_);
+    *out++ = '1' + SquareY(en_passant_square_);
+  }
+  *out++ = ' ';
+  out = WriteNumber(halfmove_clock_, out);
+  *out++ = ' ';
+  out = WriteNumber(fullmove_counter_, out);
+  *out = '\0';
+  return static_cast<int>(out - buffer);
 }
 
 /* static */
-void Position::ParseFen(const string& fen, Position* pos) {
-  istringstream is(fen);
+bool Position::ParseFen(const string& fen, Position* pos) {
+  return ParseFen(fen.data(), fen.size(), pos);
+}
+
+/* static */
+bool Position::ParseFen(const char* fen, size_t length, Position* pos) {
+  const char* p = SkipFenSpaces(fen, fen + length);
+  const char* end = fen + length;
+  Position result;
+  memset(result.board_, 0, sizeof(result.board_));
   
-  // Parse the board string.
+  // Parse the board string, from a8 to h1.
   int x = 0;
   int y = 7;
-  int state = 0;
-  char c;
-  while (state == 0) {
-    is.get(c);
-    switch (c) {
-      case 'k':
-        pos->set_board(x, y, -6);
-        ++x;
-        break;
-        
-      case 'q':
-        pos->set_board(x, y, -5);
-        ++x;
-        break;
-        
-      case 'r':
-        pos->set_board(x, y, -4);
-        ++x;
-        break;
-        
-      case 'b':
-        pos->set_board(x, y, -3);
-        ++x;
-        break;
-        
-      case 'n':
-        pos->set_board(x, y, -2);
-        ++x;
-        break;
-        
-      case 'p':
-        pos->set_board(x, y, -1);
-        ++x;
-        break;
-        
-      case 'P':
-        pos->set_board(x, y, 1);
-        ++x;
-        break;
-        
-      case 'N':
-        pos->set_board(x, y, 2);
-        ++x;
-        break;
-        
-      case 'B':
-        pos->set_board(x, y, 3);
-        ++x;
-        break;
-        
-      case 'R':
-        pos->set_board(x, y, 4);
-        ++x;
-        break;
-        
-      case 'Q':
-        pos->set_board(x, y, 5);
-        ++x;
-        break;
-        
-      case 'K':
-        pos->set_board(x, y, 6);
-        ++x;
-        break;
-        
-      case '1':
-      case '2':
-      case '3':
-      case '4':
-      case '5':
-      case '6':
-      case '7':
-      case '8':
-      {
-        int n = static_cast<int>(c - '0');
-        for (int i = 0; i < n; ++i) {
-          pos->set_board(x, y, 0);
-          ++x;
-        }
+  int kings[2] = { 0, 0 };
+  int pieces[2] = { 0, 0 };
+  for (; p < end && !IsFenSpace(*p); ++p) {
+    char c = *p;
+    if (c == '/') {
+      if (x != 8 || y == 0) {
+        return false;
+      }
+      x = 0;
+      --y;
+    } else if (c >= '1' && c <= '8') {
+      x += c - '0';
+      if (x > 8) {
+        return false;
+      }
+    } else {
+      const char* mark = (c != '.') ? strchr(PIECE_MARK, c) : NULL;
+      if (mark == NULL || c == '\0' || x == 8) {
+        return false;
+      }
+      int piece = static_cast<int>(mark - PIECE_MARK) - 6;
+      // no pawns on the back ranks
+      if ((piece == 1 || piece == -1) && (y == 0 || y == 7)) {
+        return false;
+      }
+      result.board_[x++][y] = piece;
+      ++pieces[piece > 0];
+      if (piece == 6 || piece == -6) {
+        ++kings[piece > 0];
       }
-        break;
-        
-      case '/':
-        x = 0;
-        --y;
-        break;
-        
-      case ' ':
-        state = 1;
-        break;
-        
-      default:
-        // error!
-        cerr << "Unknown piece char = " << c << endl;
-        state = -1;
-        break;
     }
-    // TODO: error check!
+  }
+  if (x != 8 || y != 0 || kings[0] != 1 || kings[1] != 1 ||
+      pieces[0] > 16 || pieces[1] > 16) {
+    return false;
   }
   
   // Parse side to move.
-  while (state == 1) {
-    is.get(c);
-    switch (c) {
-      case 'b':
-        pos->side_ = -1;
-        break;
-        
-      case 'w':
-        pos->side_ = 1;
-        break;
-        
-      case ' ':
-        state = 2;
-        break;
-        
-      default:
-        // error!
-        state = -1;
-        break;
-    }
+  p = SkipFenSpaces(p, end);
+  if (end - p < 2 || (*p != 'w' && *p != 'b') || !IsFenSpace(p[1])) {
+    return false;
   }
+  result.side_ = (*p == 'w') ? WHITE : BLACK;
+  p = SkipFenSpaces(p + 1, end);
   
-  // Parse castling ability.
-  pos->can_castling_[0][0] = false;
-  pos->can_castling_[0][1] = false;
-  pos->can_castling_[1][0] = false;
-  pos->can_castling_[1][1] = false;
-  while (state == 2) {
-    is.get(c);
-    switch (c) {
-      case '-':
-        state = 3;
-        break;
-        
-      case 'K':
-        pos->can_castling_[0][1] = true;
-        break;
-        
-      case 'Q':
-        pos->can_castling_[0][0] = true;
-        break;
-        
-      case 'k':
-        pos->can_castling_[1][1] = true;
-        break;
-        
-      case 'q':
-        pos->can_castling_[1][0] = true;
-        break;
-        
-      case ' ':
-        state = 3;
-        break;
-        
-      default:
-        // error!
-        state = -1;
-        break;
+  // Parse castling ability; the king and rook must be on their squares.
+  result.castling_ = 0;
+  if (p < end && *p == '-') {
+    ++p;
+  } else {
+    const char* start = p;
+    for (; p < end && !IsFenSpace(*p); ++p) {
+      int right;
+      switch (*p) {
+        case 'K':
+          right = (result.board_[4][0] == 6 && result.board_[7][0] == 4) ? WHITE_OO : 0;
+          break;
+        case 'Q':
+          right = (result.board_[4][0] == 6 && result.board_[0][0] == 4) ? WHITE_OOO : 0;
+          break;
+        case 'k':
+          right = (result.board_[4][7] == -6 && result.board_[7][7] == -4) ? BLACK_OO : 0;
+          break;
+        case 'q':
+          right = (result.board_[4][7] == -6 && result.board_[0][7] == -4) ? BLACK_OOO : 0;
+          break;
+        default:
+          right = 0;
+          break;
+      }
+      if (right == 0 || (result.castling_ & right)) {
+        return false;
+      }
+      result.castling_ |= right;
     }
+    if (p == start) {
+      return false;
+    }
+  }
+  if (p == end || !IsFenSpace(*p)) {
+    return false;
   }
+  p = SkipFenSpaces(p, end);
   
-  // Parse en passant target.
-  while (state == 3) {
-    is.get(c);
-    switch (c) {
-      case '-':
-        pos->en_passant_target_x_ = -1;
-        state = 4;
-        break;
-        
-      case 'a':
-        pos->en_passant_target_x_ = 0;
-        break;
-        
-      case 'b':
-        pos->en_passant_target_x_ = 1;
-        break;
-        
-      case 'c':
-        pos->en_passant_target_x_ = 2;
-        break;
-        
-      case 'd':
-        pos->en_passant_target_x_ = 3;
-        break;
-        
-      case 'e':
-        pos->en_passant_target_x_ = 4;
-        break;
-        
-      case 'f':
-        pos->en_passant_target_x_ = 5;
-        break;
-        
-      case 'g':
-        pos->en_passant_target_x_ = 6;
-        break;
-        
-      case 'h':
-        pos->en_passant_target_x_ = 7;
-        break;
-        
-      case '1':
-        pos->en_passant_target_y_ = 0;
-        break;
-        
-      case '2':
-        pos->en_passant_target_y_ = 1;
-        break;
-        
-      case '3':
-        pos->en_passant_target_y_ = 2;
-        break;
-        
-      case '4':
-        pos->en_passant_target_y_ = 3;
-        break;
-        
-      case '5':
-        pos->en_passant_target_y_ = 4;
-        break;
-        
-      case '6':
-        pos->en_passant_target_y_ = 5;
-        break;
-        
-      case '7':
-        pos->en_passant_target_y_ = 6;
-        break;
-        
-      case '8':
-        pos->en_passant_target_y_ = 7;
-        break;
-        
-      case ' ':
-        state = 4;
-        break;
-        
-      default:
-        // error!
-        cerr << "Error at en passant target: " << c << endl;
-        state = -1;
-        break;
+  // Parse en passant target. The pawn must have just moved two squares.
+  result.en_passant_square_ = -1;
+  if (p < end && *p == '-') {
+    ++p;
+  } else {
+    if (end - p < 2 || p[0] < 'a' || p[0] > 'h') {
+      return false;
+    }
+    int ep_x = p[0] - 'a';
+    int ep_y = (result.side_ == WHITE) ? 5 : 2;
+    int pawn_y = ep_y - result.side_;
+    int from_y = ep_y + result.side_;
+    if (p[1] != '1' + ep_y || result.board_[ep_x][pawn_y] != -result.side_ ||
+        result.board_[ep_x][ep_y] != 0 || result.board_[ep_x][from_y] != 0) {
+      return false;
     }
+    result.en_passant_square_ = MakeSquare(ep_x, ep_y);
+    p += 2;
+  }
+  if (p < end && !IsFenSpace(*p)) {
+    return false;
   }
   
-  // Parse halfmove clock.
-  is >> pos->halfmove_clock_;
+  // Parse the move counters, which may be missing.
+  unsigned halfmove_clock = 0;
+  unsigned fullmove_counter = 1;
+  p = SkipFenSpaces(p, end);
+  if (p < end) {
+    p = ReadCounter(p, end, 255, &halfmove_clock);
+    if (p == NULL) {
+      return false;
+    }
+    p = SkipFenSpaces(p, end);
+    if (p < end) {
+      p = ReadCounter(p, end, 65535, &fullmove_counter);
+      if (p == NULL) {
+        return false;
+      }
+      p = SkipFenSpaces(p, end);
+    }
+  }
+  if (p != end) {
+    return false;
+  }
+  result.halfmove_clock_ = halfmove_clock;
+  result.fullmove_counter_ = max(fullmove_counter, 1u);
   
-  // Parse fullmove counter.
-  is >> pos->fullmove_counter_;
+  result.InitPieceLists();
+  // The side that just moved cannot be in check.
+  int king = result.king_square(-result.side_);
+  if (result.IsAttacked(SquareX(king), SquareY(king), result.side_)) {
+    return false;
+  }
+  *pos = result;
+  return true;
 }
 
-void Position::DoMove(const Move& m, Position* dst) {
+void Position::DoMove(const Move& m, Position* dst) const {
+  if (side_ == WHITE) {
+    DoMove<WHITE>(m, dst);
+  } else {
+    DoMove<BLACK>(m, dst);
+  }
+}
+
+template <int Side>
+void Position::DoMove(const Move& m, Position* dst) const {
   assert(m.from_x() >= 0 && m.from_x() < 8);
   assert(m.from_y() >= 0 && m.from_y() < 8);
+  assert(side_ == Side);
+  
+  const int s = (Side == WHITE);
+  const int back_rank = (Side == WHITE) ? 0 : 7;
   
-  dst->PartialCopyFrom(*this);
-  //*dst = *this;
-  int p = dst->board_[m.from_x()][m.from_y()];
+  *dst = *this;
+  int p = board_[m.from_x()][m.from_y()] * Side;
+  int captured = board_[m.to_x()][m.to_y()];
+  uint64_t key = key_ ^ zobrist.black;
   // half move clock
-  if (p == 1 || p == -1 || dst->board_[m.to_x()][m.to_y()] != 0) {
+  if (p == 1 || captured != 0) {
     dst->halfmove_clock_ = 0;
-  } else {
+  } else if (dst->halfmove_clock_ < 255) {
+    // Saturates like ParseFen.
     ++dst->halfmove_clock_;
   }
+  // Update piece lists.
+  int from = MakeSquare(m.from_x(), m.from_y());
+  int to = MakeSquare(m.to_x(), m.to_y());
+  if (captured != 0) {
+    dst->RemovePiece(!s, to);
+    key ^= zobrist.piece[captured + 6][to];
+  }
+  dst->MovePiece(s, from, to);
+  key ^= zobrist.piece[p * Side + 6][from];
   // Clear from position.
   dst->board_[m.from_x()][m.from_y()] = 0;
-  if (p == 1 && m.from_y() == 6) {
-    // promote
-    dst->board_[m.to_x()][m.to_y()] = m.piece();
-  } else if (p == -1 && m.from_y() == 1) {
+  if (p == 1 && m.to_y() == 7 - back_rank) {
     // promote
     dst->board_[m.to_x()][m.to_y()] = m.piece();
+    key ^= zobrist.piece[m.piece() + 6][to];
   } else if (p == 6 && (m.to_x() - m.from_x()) == 2) {
-    // white king-side_ castling
-    //dst->board_[4][0] = 0;
-    dst->board_[7][0] = 0;
-    dst->board_[5][0] = 4;
-    dst->board_[6][0] = 6;
+    // king-side castling
+    dst->board_[7][back_rank] = 0;
+    dst->board_[5][back_rank] = 4 * Side;
+    dst->board_[6][back_rank] = 6 * Side;
+    dst->MovePiece(s, MakeSquare(7, back_rank), MakeSquare(5, back_rank));
+    key ^= zobrist.piece[6 * Side + 6][to] ^
+    zobrist.piece[4 * Side + 6][MakeSquare(7, back_rank)] ^
+    zobrist.piece[4 * Side + 6][MakeSquare(5, back_rank)];
   } else if (p == 6 && (m.from_x() - m.to_x()) == 2) {
-    // white queen-side_ castling
-    dst->board_[0][0] = 0;
-    dst->board_[2][0] = 6;
-    dst->board_[3][0] = 4;
-  } else if (p == -6 && (m.to_x() - m.from_x()) == 2) {
-    // black king-side_ castling
-    //dst->board_[4][7] = 0;
-    dst->board_[7][7] = 0;
-    dst->board_[5][7] = -4;
-    dst->board_[6][7] = -6;
-  } else if (p == -6 && (m.from_x() - m.to_x()) == 2) {
-    // black queen-side_ castling
-    dst->board_[0][7] = 0;
-    dst->board_[2][7] = -6;
-    dst->board_[3][7] = -4;
+    // queen-side castling
+    dst->board_[0][back_rank] = 0;
+    dst->board_[2][back_rank] = 6 * Side;
+    dst->board_[3][back_rank] = 4 * Side;
+    dst->MovePiece(s, MakeSquare(0, back_rank), MakeSquare(3, back_rank));
+    key ^= zobrist.piece[6 * Side + 6][to] ^
+    zobrist.piece[4 * Side + 6][MakeSquare(0, back_rank)] ^
+    zobrist.piece[4 * Side + 6][MakeSquare(3, back_rank)];
   } else if (p == 1 &&
              m.from_x() != m.to_x() &&
-             dst->board_[m.to_x()][m.to_y()] == 0) {
-    // white enpassant
-    dst->board_[m.to_x()][m.to_y() - 1] = 0;
-    dst->board_[m.to_x()][m.to_y()] = p;
-  } else if (p == -1 &&
-             m.from_x() != m.to_x() &&
-             dst->board_[m.to_x()][m.to_y()] == 0) {
-    // black enpassant
-    dst->board_[m.to_x()][m.to_y() + 1] = 0;
-    dst->board_[m.to_x()][m.to_y()] = p;
+             captured == 0) {
+    // en passant
+    dst->board_[m.to_x()][m.to_y() - Side] = 0;
+    dst->board_[m.to_x()][m.to_y()] = Side;
+    dst->RemovePiece(!s, MakeSquare(m.to_x(), m.to_y() - Side));
+    key ^= zobrist.piece[Side + 6][to] ^
+    zobrist.piece[-Side + 6][MakeSquare(m.to_x(), m.to_y() - Side)];
   } else {
-    dst->board_[m.to_x()][m.to_y()] = p;
+    dst->board_[m.to_x()][m.to_y()] = p * Side;
+    key ^= zobrist.piece[p * Side + 6][to];
   }
-  dst->side_ = -(dst->side_);
-  if (dst->side_ > 0) {
+  dst->side_ = -Side;
+  if (Side == BLACK) {
     ++(dst->fullmove_counter_);
   }
   
   // Set en passant target.
-  if (p == 1 && (m.to_y() - m.from_y()) == 2) {
-    // a double push of a white pawn
-    dst->en_passant_target_x_ = m.from_x();
-    dst->en_passant_target_y_ = m.from_y() + 1;
-  } else if (p == -1 && (m.to_y() - m.from_y()) == -2) {
-    // a double push of a black pawn
-    dst->en_passant_target_x_ = m.from_x();
-    dst->en_passant_target_y_ = m.from_y() - 1;
+  if (en_passant_square_ >= 0) {
+    key ^= zobrist.en_passant[SquareX(en_passant_square_)];
+  }
+  if (p == 1 && (m.to_y() - m.from_y()) == 2 * Side) {
+    // a double push
+    dst->en_passant_square_ = MakeSquare(m.from_x(), m.from_y() + Side);
+    key ^= zobrist.en_passant[m.from_x()];
   } else {
-    dst->en_passant_target_x_ = -1;
-    //dst->en_passant_target_y = -1;
+    dst->en_passant_square_ = -1;
   }
   
-  //dst->next_moves_.clear();
-  // for castling
-  if (p == -6) {
-    dst->can_castling_[0][0] = false;
-    dst->can_castling_[0][1] = false;
-  } else if (p == 6) {
-    dst->can_castling_[1][0] = false;
-    dst->can_castling_[1][1] = false;
-  }
-  if (p == -4) {
-    if (m.from_y() == 7) {
-      if (m.from_x() == 0) {
-        dst->can_castling_[0][0] = false;
-      } else if (m.from_x() == 7) {
-        dst->can_castling_[0][1] = false;
-      }
-    }
-  } else if (p == 4) {
-    if (m.from_y() == 0) {
-      if (m.from_x() == 0) {
-        dst->can_castling_[1][0] = false;
-      } else if (m.from_x() == 7) {
-        dst->can_castling_[1][1] = false;
-      }
-    }
+  // Castling rights are lost when the king or a rook leaves its square
+  // or a rook is captured.
+  dst->castling_ &= CASTLING_MASK[from] & CASTLING_MASK[to];
+  dst->key_ = key ^ zobrist.castling[castling_] ^ zobrist.castling[dst->castling_];
+}
+
+void Position::CalcMoves(MoveList* moves) const {
+  if (side_ == WHITE) {
+    CalcMoves<WHITE>(moves);
+  } else {
+    CalcMoves<BLACK>(moves);
   }
 }
 
-void Position::CalcMoves() {
-  CalcIsUnderAttack();
-  for (int y = 0; y < 8; ++y) {
-    for (int x = 0; x < 8; ++x) {
-      switch (board_[x][y] * side_) {
-        case 1:
-          CalcPawnMoves(x, y);
-          break;
-          
-        case 2:
-          CalcKnightMoves(x, y);
-          break;
-          
-        case 3:
-          CalcBishopMoves(x, y);
-          break;
-          
-        case 4:
-          CalcRookMoves(x, y);
-          break;
-          
-        case 5:
-          CalcQueenMoves(x, y);
-          break;
-          
-        case 6:
-          CalcKingMoves(x, y);
-          break;
-          
-        default:
-          // error
-          break;
-      }
+template <int Side>
+void Position::CalcMoves(MoveList* moves) const {
+  assert(side_ == Side);
+  moves->clear();
+  const int s = (Side == WHITE);
+  for (int i = 0; i < piece_count_[s]; ++i) {
+    int x = SquareX(piece_list_[s][i]);
+    int y = SquareY(piece_list_[s][i]);
+    switch (board_[x][y] * Side) {
+      case 1:
+        CalcPawnMoves<Side>(x, y, moves);
+        break;
+        
+      case 2:
+        CalcKnightMoves<Side>(x, y, moves);
+        break;
+        
+      case 3:
+        CalcBishopMoves<Side>(x, y, moves);
+        break;
+        
+      case 4:
+        CalcRookMoves<Side>(x, y, moves);
+        break;
+        
+      case 5:
+        CalcQueenMoves<Side>(x, y, moves);
+        break;
+        
+      case 6:
+        CalcKingMoves<Side>(x, y, moves);
+        break;
+        
+      default:
+        // error
+        assert(false);
+        break;
     }
   }
 }
 
 // Calculates pawn moves.
 // Assumes the piece of the given (x, y) is a pawn.
-void Position::CalcPawnMoves(int x, int y) {
+template <int Side>
+void Position::CalcPawnMoves(int x, int y, MoveList* moves) const {
   // basic move
-  int to_y = y + side_;
+  int to_y = y + Side;
   if (to_y >= 0 && to_y < 8) {
     if (board_[x][to_y] == 0) {
-      AddPawnMoves(x, y, x, to_y);
+      AddPawnMoves<Side>(x, y, x, to_y, moves);
       // initial 2 move
-      if ((y == 1 && side_ == 1) ||
-          (y == 6 && side_ == -1)) {
-        to_y += side_;
-        if (board_[x][to_y] == 0) {
-          AddMove(x, y, x, to_y, 0);
-        }
-        to_y -= side_;
+      if (y == ((Side == WHITE) ? 1 : 6) &&
+          board_[x][to_y + Side] == 0) {
+        AddMove<Side>(x, y, x, to_y + Side, 0, moves);
       }
     }
     // capture
     int to_x = x - 1;
     if (to_x >= 0 &&
-        (side_ * board_[to_x][to_y] < 0 || // foe's piece
-         (to_x == en_passant_target_x_ && to_y == en_passant_target_y_))) {
-          AddPawnMoves(x, y, to_x, to_y);
+        (Side * board_[to_x][to_y] < 0 || // foe's piece
+         MakeSquare(to_x, to_y) == en_passant_square_)) {
+          AddPawnMoves<Side>(x, y, to_x, to_y, moves);
         }
     to_x = x + 1;
     if (to_x < 8 &&
-        (side_ * board_[to_x][to_y] < 0 || // foe's piece
-         (to_x == en_passant_target_x_ && to_y == en_passant_target_y_))) {
-          AddPawnMoves(x, y, to_x, to_y);
+        (Side * board_[to_x][to_y] < 0 || // foe's piece
+         MakeSquare(to_x, to_y) == en_passant_square_)) {
+          AddPawnMoves<Side>(x, y, to_x, to_y, moves);
         }
   }
 }
 
-void Position::AddPawnMoves(int from_x, int from_y, int to_x, int to_y) {
-  if (to_y == 0 && side_ == -1) {
+template <int Side>
+void Position::AddPawnMoves(int from_x, int from_y, int to_x, int to_y, MoveList* moves) const {
+  if (to_y == ((Side == WHITE) ? 7 : 0)) {
     // promote
     for (int p = 2; p < 6; ++p) {
-      AddMove(from_x, from_y, to_x, to_y, -p);
-    }
-  } else if (to_y == 7 && side_ == 1) {
-    // promote
-    for (int p = 2; p < 6; ++p) {
-      AddMove(from_x, from_y, to_x, to_y, p);
+      AddMove<Side>(from_x, from_y, to_x, to_y, p * Side, moves);
     }
   } else {
-    AddMove(from_x, from_y, to_x, to_y, 0);
+    AddMove<Side>(from_x, from_y, to_x, to_y, 0, moves);
   }
 }
 
@@ -767,18 +785,19 @@ void Position::AddPawnMoves(int from_x, int from_y, int to_x, int to_y) {
  * Adds a move if it is valid.
  * Returns 1 if it is valid and the to-position is blank. Otherwise 0.
  */
-int Position::AddMove(int from_x, int from_y, int to_x, int to_y, int piece) {
+template <int Side>
+int Position::AddMove(int from_x, int from_y, int to_x, int to_y, int piece, MoveList* moves) const {
   if (to_x >= 0 && to_x < 8 &&
       to_y >= 0 && to_y < 8) {
-    int t = board_[to_x][to_y] * side_;
+    int t = board_[to_x][to_y] * Side;
     if (t <= 0) {
       Move m(from_x, from_y, to_x, to_y, piece);
       // check if the move m makes our king under attack.
       Position next_pos;
-      DoMove(m, &next_pos);
-      next_pos.side_ = -(next_pos.side_);
-      if (!next_pos.IsCheck()) {
-        next_moves_.push_back(m);
+      DoMove<Side>(m, &next_pos);
+      int king = next_pos.king_square_[Side == WHITE];
+      if (!next_pos.IsAttackedBy<-Side>(SquareX(king), SquareY(king))) {
+        moves->push_back(m);
       }
       if (t == 0) {
         return 1;
@@ -788,360 +807,603 @@ int Position::AddMove(int from_x, int from_y, int to_x, int to_y, int piece) {
   return 0;
 }
 
-void Position::CalcKnightMoves(int x, int y) {
-  AddMove(x, y, x + 1, y + 2, 0);
-  AddMove(x, y, x + 2, y + 1, 0);
-  AddMove(x, y, x + 2, y - 1, 0);
-  AddMove(x, y, x + 1, y - 2, 0);
-  AddMove(x, y, x - 1, y - 2, 0);
-  AddMove(x, y, x - 2, y - 1, 0);
-  AddMove(x, y, x - 2, y + 1, 0);
-  AddMove(x, y, x - 1, y + 2, 0);
+template <int Side>
+void Position::CalcKnightMoves(int x, int y, MoveList* moves) const {
+  AddMove<Side>(x, y, x + 1, y + 2, 0, moves);
+  AddMove<Side>(x, y, x + 2, y + 1, 0, moves);
+  AddMove<Side>(x, y, x + 2, y - 1, 0, moves);
+  AddMove<Side>(x, y, x + 1, y - 2, 0, moves);
+  AddMove<Side>(x, y, x - 1, y - 2, 0, moves);
+  AddMove<Side>(x, y, x - 2, y - 1, 0, moves);
+  AddMove<Side>(x, y, x - 2, y + 1, 0, moves);
+  AddMove<Side>(x, y, x - 1, y + 2, 0, moves);
 }
 
-void Position::CalcBishopMoves(int x, int y) {
+template <int Side>
+void Position::CalcBishopMoves(int x, int y, MoveList* moves) const {
   for (int i = 1; i < 8; ++i) {
-    if (!AddMove(x, y, x - i, y - i, 0)) {
+    if (!AddMove<Side>(x, y, x - i, y - i, 0, moves)) {
       break;
     }
   }
   for (int i = 1; i < 8; ++i) {
-    if (!AddMove(x, y, x + i, y - i, 0)) {
+    if (!AddMove<Side>(x, y, x + i, y - i, 0, moves)) {
       break;
     }
   }
   for (int i = 1; i < 8; ++i) {
-    if (!AddMove(x, y, x + i, y + i, 0)) {
+    if (!AddMove<Side>(x, y, x + i, y + i, 0, moves)) {
       break;
     }
   }
   for (int i = 1; i < 8; ++i) {
-    if (!AddMove(x, y, x - i, y + i, 0)) {
+    if (!AddMove<Side>(x, y, x - i, y + i, 0, moves)) {
       break;
     }
   }
 }
 
-void Position::CalcRookMoves(int x, int y) {
+template <int Side>
+void Position::CalcRookMoves(int x, int y, MoveList* moves) const {
   for (int i = 1; i < 8; ++i) {
-    if (!AddMove(x, y, x - i, y, 0)) {
+    if (!AddMove<Side>(x, y, x - i, y, 0, moves)) {
       break;
     }
   }
   for (int i = 1; i < 8; ++i) {
-    if (!AddMove(x, y, x + i, y, 0)) {
+    if (!AddMove<Side>(x, y, x + i, y, 0, moves)) {
       break;
     }
   }
   for (int i = 1; i < 8; ++i) {
-    if (!AddMove(x, y, x, y - i, 0)) {
+    if (!AddMove<Side>(x, y, x, y - i, 0, moves)) {
       break;
     }
   }
   for (int i = 1; i < 8; ++i) {
-    if (!AddMove(x, y, x, y + i, 0)) {
+    if (!AddMove<Side>(x, y, x, y + i, 0, moves)) {
       break;
     }
   }
 }
 
-void Position::CalcQueenMoves(int x, int y) {
-  CalcBishopMoves(x, y);
-  CalcRookMoves(x, y);
+template <int Side>
+void Position::CalcQueenMoves(int x, int y, MoveList* moves) const {
+  CalcBishopMoves<Side>(x, y, moves);
+  CalcRookMoves<Side>(x, y, moves);
 }
 
-void Position::CalcKingMoves(int x, int y) {
-  AddMove(x, y, x    , y + 1, 0);
-  AddMove(x, y, x + 1, y + 1, 0);
-  AddMove(x, y, x + 1, y    , 0);
-  AddMove(x, y, x + 1, y - 1, 0);
-  AddMove(x, y, x    , y - 1, 0);
-  AddMove(x, y, x - 1, y - 1, 0);
-  AddMove(x, y, x - 1, y    , 0);
-  AddMove(x, y, x - 1, y + 1, 0);
+template <int Side>
+void Position::CalcKingMoves(int x, int y, MoveList* moves) const {
+  AddMove<Side>(x, y, x    , y + 1, 0, moves);
+  AddMove<Side>(x, y, x + 1, y + 1, 0, moves);
+  AddMove<Side>(x, y, x + 1, y    , 0, moves);
+  AddMove<Side>(x, y, x + 1, y - 1, 0, moves);
+  AddMove<Side>(x, y, x    , y - 1, 0, moves);
+  AddMove<Side>(x, y, x - 1, y - 1, 0, moves);
+  AddMove<Side>(x, y, x - 1, y    , 0, moves);
+  AddMove<Side>(x, y, x - 1, y + 1, 0, moves);
   // castling
-  int s = side_ > 0;
-  int cy = s ? 0 : 7;
-  if (can_castling_[s][0] &&
+  const int cy = (Side == WHITE) ? 0 : 7;
+  if ((castling_ & ((Side == WHITE) ? WHITE_OOO : BLACK_OOO)) &&
       board_[1][cy] == 0 &&
       board_[2][cy] == 0 &&
       board_[3][cy] == 0 &&
-      !is_under_attack_[2][cy] &&
-      !is_under_attack_[3][cy] &&
-      !is_under_attack_[4][cy]) {
-    // Queen's side_
-    AddMove(x, cy, x - 2, cy, 0);
-  } else if (can_castling_[s][1] &&
-             board_[5][cy] == 0 &&
-             board_[6][cy] == 0 &&
-             !is_under_attack_[4][cy] &&
-             !is_under_attack_[5][cy] &&
-             !is_under_attack_[6][cy]) {
-    // King's side_
-    AddMove(x, cy, x + 2, cy, 0);
+      !IsAttackedBy<-Side>(2, cy) &&
+      !IsAttackedBy<-Side>(3, cy) &&
+      !IsAttackedBy<-Side>(4, cy)) {
+    // Queen's side
+    AddMove<Side>(x, cy, x - 2, cy, 0, moves);
   }
-}
-
-bool Position::IsCheck() {
-  CalcIsUnderAttack();
-  for (int y = 0; y < 8; ++y) {
-    for (int x = 0; x < 8; ++x) {
-      if (board_[x][y] == 6 * side_) {
-        return is_under_attack_[x][y];
-      }
-    }
+  if ((castling_ & ((Side == WHITE) ? WHITE_OO : BLACK_OO)) &&
+      board_[5][cy] == 0 &&
+      board_[6][cy] == 0 &&
+      !IsAttackedBy<-Side>(4, cy) &&
+      !IsAttackedBy<-Side>(5, cy) &&
+      !IsAttackedBy<-Side>(6, cy)) {
+    // King's side
+    AddMove<Side>(x, cy, x + 2, cy, 0, moves);
   }
-  return false;  // make a compiler happy.
 }
 
-void Position::CalcIsUnderAttack() {
-  for (int y = 0; y < 8; ++y) {
-    for (int x = 0; x < 8; ++x) {
-      is_under_attack_[x][y] = false;
-    }
-  }
-  for (int y = 0; y < 8; ++y) {
-    for (int x = 0; x < 8; ++x) {
-      switch (board_[x][y] * side_) {
-        case -1:
-          CalcIsUnderAttackByPawn(x, y);
-          break;
-          
-        case -2:
-          CalcIsUnderAttackByKnight(x, y);
-          break;
-          
-        case -3:
-          CalcIsUnderAttackByBishop(x, y);
-          break;
-          
-        case -4:
-          CalcIsUnderAttackByRook(x, y);
-          break;
-          
-        case -5:
-          CalcIsUnderAttackByQueen(x, y);
-          break;
-          
-        case -6:
-          CalcIsUnderAttackByKing(x, y);
-          break;
-          
-        default:
-          // error
-          break;
-      }
-    }
+bool Position::IsCheck() const {
+  if (side_ == WHITE) {
+    return IsCheck<WHITE>();
+  } else {
+    return IsCheck<BLACK>();
   }
 }
 
-void Position::CalcIsUnderAttackByPawn(int x, int y) {
-  int to_y = y - side_;
-  if (to_y >= 0 && to_y < 8) {
-    // capture
-    int to_x = x - 1;
-    if (to_x >= 0) {
-      is_under_attack_[to_x][to_y] = true;
-    }
-    to_x = x + 1;
-    if (to_x < 8) {
-      is_under_attack_[to_x][to_y] = true;
-    }
-  }
+template <int Side>
+bool Position::IsCheck() const {
+  int sq = king_square_[Side == WHITE];
+  return IsAttackedBy<-Side>(SquareX(sq), SquareY(sq));
 }
 
-void Position::CalcIsUnderAttackByKnight(int x, int y) {
-  SetIsUnderAttack(x + 1, y + 2);
-  SetIsUnderAttack(x + 2, y + 1);
-  SetIsUnderAttack(x + 2, y - 1);
-  SetIsUnderAttack(x + 1, y - 2);
-  SetIsUnderAttack(x - 1, y - 2);
-  SetIsUnderAttack(x - 2, y - 1);
-  SetIsUnderAttack(x - 2, y + 1);
-  SetIsUnderAttack(x - 1, y + 2);
+bool Position::IsAttacked(int x, int y, int by_side) const {
+  if (by_side == WHITE) {
+    return IsAttackedBy<WHITE>(x, y);
+  } else {
+    return IsAttackedBy<BLACK>(x, y);
+  }
 }
 
-void Position::CalcIsUnderAttackByBishop(int x, int y) {
-  for (int i = 1; i < 8; ++i) {
-    if (!SetIsUnderAttack(x - i, y - i)) {
-      break;
+template <int BySide>
+bool Position::IsAttackedBy(int x, int y) const {
+  // pawns
+  int from_y = y - BySide;
+  if (from_y >= 0 && from_y < 8) {
+    if (x > 0 && board_[x - 1][from_y] == BySide) {
+      return true;
     }
-  }
-  for (int i = 1; i < 8; ++i) {
-    if (!SetIsUnderAttack(x + i, y - i)) {
-      break;
+    if (x < 7 && board_[x + 1][from_y] == BySide) {
+      return true;
     }
   }
-  for (int i = 1; i < 8; ++i) {
-    if (!SetIsUnderAttack(x + i, y + i)) {
-      break;
+  // knights and king
+  int sq = MakeSquare(x, y);
+  for (Bitboard b = KnightAttacks(sq); b; ) {
+    int from = PopLsb(&b);
+    if (board_[SquareX(from)][SquareY(from)] == 2 * BySide) {
+      return true;
     }
   }
-  for (int i = 1; i < 8; ++i) {
-    if (!SetIsUnderAttack(x - i, y + i)) {
-      break;
+  for (Bitboard b = KingAttacks(sq); b; ) {
+    int from = PopLsb(&b);
+    if (board_[SquareX(from)][SquareY(from)] == 6 * BySide) {
+      return true;
     }
   }
+  // bishops, rooks and queens
+  const int bishop = 3 * BySide;
+  const int rook = 4 * BySide;
+  const int queen = 5 * BySide;
+  return (IsAttackedBySlider(x, y, -1, -1, bishop, queen) ||
+          IsAttackedBySlider(x, y,  1, -1, bishop, queen) ||
+          IsAttackedBySlider(x, y,  1,  1, bishop, queen) ||
+          IsAttackedBySlider(x, y, -1,  1, bishop, queen) ||
+          IsAttackedBySlider(x, y, -1,  0, rook, queen) ||
+          IsAttackedBySlider(x, y,  1,  0, rook, queen) ||
+          IsAttackedBySlider(x, y,  0, -1, rook, queen) ||
+          IsAttackedBySlider(x, y,  0,  1, rook, queen));
 }
 
-void Position::CalcIsUnderAttackByRook(int x, int y) {
-  for (int i = 1; i < 8; ++i) {
-    if (!SetIsUnderAttack(x - i, y)) {
-      break;
-    }
-  }
-  for (int i = 1; i < 8; ++i) {
-    if (!SetIsUnderAttack(x + i, y)) {
-      break;
+/**
+ * Walks from (x, y) in the direction (dx, dy).
+ * Returns true if the first piece found is p1 or p2.
+ */
+bool Position::IsAttackedBySlider(int x, int y, int dx, int dy, int p1, int p2) const {
+  for (x += dx, y += dy; x >= 0 && x < 8 && y >= 0 && y < 8; x += dx, y += dy) {
+    int p = board_[x][y];
+    if (p != 0) {
+      return p == p1 || p == p2;
     }
   }
-  for (int i = 1; i < 8; ++i) {
-    if (!SetIsUnderAttack(x, y - i)) {
-      break;
+  return false;
+}
+
+Bitboard Position::AttackMap(int by_side) const {
+  Bitboard occupied = 0;
+  for (int sq = 0; sq < 64; ++sq) {
+    if (board_[SquareX(sq)][SquareY(sq)] != 0) {
+      occupied |= SquareBit(sq);
     }
   }
-  for (int i = 1; i < 8; ++i) {
-    if (!SetIsUnderAttack(x, y + i)) {
-      break;
+  Bitboard attacks = 0;
+  for (Bitboard b = occupied; b; ) {
+    int sq = PopLsb(&b);
+    switch (board_[SquareX(sq)][SquareY(sq)] * by_side) {
+      case 1:
+        attacks |= PawnAttacks(by_side, sq);
+        break;
+        
+      case 2:
+        attacks |= KnightAttacks(sq);
+        break;
+        
+      case 3:
+        attacks |= BishopAttacks(sq, occupied);
+        break;
+        
+      case 4:
+        attacks |= RookAttacks(sq, occupied);
+        break;
+        
+      case 5:
+        attacks |= QueenAttacks(sq, occupied);
+        break;
+        
+      case 6:
+        attacks |= KingAttacks(sq);
+        break;
+        
+      default:
+        // foe's piece
+        break;
     }
   }
+  return attacks;
 }
 
-void Position::CalcIsUnderAttackByQueen(int x, int y) {
-  CalcIsUnderAttackByBishop(x, y);
-  CalcIsUnderAttackByRook(x, y);
+bool Position::IsValidMove(const Move& m) const {
+  MoveList moves;
+  CalcMoves(&moves);
+  return (find(moves.begin(), moves.end(), m) != moves.end());
 }
 
-void Position::CalcIsUnderAttackByKing(int x, int y) {
-  SetIsUnderAttack(x    , y + 1);
-  SetIsUnderAttack(x + 1, y + 1);
-  SetIsUnderAttack(x + 1, y    );
-  SetIsUnderAttack(x + 1, y - 1);
-  SetIsUnderAttack(x    , y - 1);
-  SetIsUnderAttack(x - 1, y - 1);
-  SetIsUnderAttack(x - 1, y    );
-  SetIsUnderAttack(x - 1, y + 1);
-}
-
-/**
- * Set if the specified tile is under attack.
- * Returns 1 if it is open. Otherwise 0.
- */
-int Position::SetIsUnderAttack(int x, int y) {
-  if (x >= 0 && x < 8 && y >= 0 && y < 8) {
-    is_under_attack_[x][y] = true;
-    if (board_[x][y] == 0) {
-      return true;
-    }
-  }
-  return false;
-}
-
-bool Position::IsValidMove(const Move& m) {
-  return (find(next_moves_.begin(), next_moves_.end(), m) != next_moves_.end());
-}
+template void Position::DoMove<WHITE>(const Move&, Position*) const;
+template void Position::DoMove<BLACK>(const Move&, Position*) const;
+template bool Position::IsCheck<WHITE>() const;
+template bool Position::IsCheck<BLACK>() const;
+template void Position::CalcMoves<WHITE>(MoveList*) const;
+template void Position::CalcMoves<BLACK>(MoveList*) const;
+template bool Position::IsAttackedBy<WHITE>(int, int) const;
+template bool Position::IsAttackedBy<BLACK>(int, int) const;
 
 
 // RandomPlayer
 bool RandomPlayer::NextMove(Position& pos, Move* next_move) {
-  pos.CalcMoves();
-  if (pos.next_moves().empty()) {
+  MoveList moves;
+  pos.CalcMoves(&moves);
+  if (moves.empty()) {
     return false;
   }
-  int i = rand() % pos.next_moves().size();
-  *next_move = pos.next_moves()[i];
+  int i = rand_r(&seed_) % moves.size();
+  *next_move = moves[i];
   return true;
 }
 
 // MinMaxPlayer
 
+namespace {
+  
+  // Larger than any score returned by the search, and still fits the
+  // 16 bits of the transposition table.
+  const int INFINITE_SCORE = 32500;
+  
+  // Initial half width of the aspiration window (one pawn).
+  const int ASPIRATION_WINDOW = 100;
+  
+  // Windows wider than this are opened fully.
+  const int MAX_ASPIRATION_WINDOW = 1600;
+  
+  // Mate and tablebase scores count the plies from the root; the
+  // transposition table keeps them from the node.
+  const int PLY_SCORE = TB_WIN_SCORE - 100;
+  
+  int ScoreToTable(int score, int ply) {
+    return (score >= PLY_SCORE) ? score + ply : (score <= -PLY_SCORE) ? score - ply : score;
+  }
+  
+  int ScoreFromTable(int score, int ply) {
+    return (score >= PLY_SCORE) ? score - ply : (score <= -PLY_SCORE) ? score + ply : score;
+  }
+  
+}  // namespace
+
 MinMaxPlayer::MinMaxPlayer(int max_depth)
-: max_depth_(max_depth) {}
+: nodes_(0),
+score_(0),
+tb_hits_(0),
+fail_high_count_(0),
+fail_low_count_(0),
+research_count_(0),
+max_depth_(max_depth),
+multi_pv_(1),
+root_depth_(0),
+time_limit_(0),
+node_limit_(0),
+deadline_(0),
+stopped_(false),
+listener_(NULL),
+tt_(NULL),
+stop_flag_(NULL) {}
 
 bool MinMaxPlayer::NextMove(Position& pos, Move* next_move) {
-  count = 0;
-  bool ret = CalcNextMove(pos, max_depth_, next_move, &last_score);
-  //printf("count = %d\n", count);
-  return ret;
+  nodes_ = 0;
+  fail_high_count_ = 0;
+  fail_low_count_ = 0;
+  research_count_ = 0;
+  score_ = 0;
+  tb_hits_ = 0;
+  stopped_ = false;
+  deadline_ = GetTime() + time_limit_;
+  if (tt_) {
+    tt_->NewSearch();
+  }
+  SEARCH_STATS(stats_.Clear());
+  SEARCH_STATS(uint64_t start_ticks = GetTicks());
+  
+  pos.CalcMoves(&root_moves_);
+  if (root_moves_.empty()) {
+    score_ = pos.IsCheck() ? -MATE_SCORE : 0;
+    return false;
+  }
+  // Keep the moves preserving the outcome, if the tablebases know it.
+  if (FilterRootMoves(pos, &root_moves_)) {
+    ++tb_hits_;
+  }
+  *next_move = root_moves_[0];
+  lines_.clear();
+  
+  int line_count = max(1, min(multi_pv_, root_moves_.size()));
+  // Scores of the lines of the previous iteration, and the current one.
+  vector<int> guesses(line_count, 0);
+  vector<int> scores(line_count);
+  for (root_depth_ = 1; root_depth_ <= max_depth_; ++root_depth_) {
+    SEARCH_STATS(int iteration_count = nodes_);
+    for (int line = 0; line < line_count; ++line) {
+      Move best_move;
+      scores[line] = SearchLine(pos, line, guesses[line], &best_move);
+      if (stopped_) {
+        break;
+      }
+      // Excluded from the next lines.
+      iter_swap(root_moves_.begin() + line,
+                find(root_moves_.begin() + line, root_moves_.end(), best_move));
+    }
+    if (stopped_) {
+      // Keep the moves and scores of the last completed iteration.
+      break;
+    }
+    // A later line may score higher than an earlier one; sort them, so the
+    // next iteration searches the best move first.
+    for (int i = 1; i < line_count; ++i) {
+      for (int j = i; j > 0 && scores[j] > scores[j - 1]; --j) {
+        swap(scores[j], scores[j - 1]);
+        iter_swap(root_moves_.begin() + j, root_moves_.begin() + j - 1);
+      }
+    }
+    guesses = scores;
+    *next_move = root_moves_[0];
+    score_ = scores[0];
+    lines_.resize(line_count);
+    for (int i = 0; i < line_count; ++i) {
+      lines_[i].score = scores[i];
+      ExtractPv(pos, root_moves_[i], &lines_[i].moves);
+      if (listener_) {
+        listener_->OnLine(root_depth_, i, lines_[i], nodes_);
+      }
+    }
+    if (listener_) {
+      listener_->OnIteration(root_depth_, score_, *next_move, nodes_);
+    }
+    SEARCH_STATS(stats_.iterations = root_depth_);
+    SEARCH_STATS(stats_.iteration_nodes[min<int>(root_depth_, SearchStats::MAX_PLY - 1)]
+                 += nodes_ - iteration_count);
+  }
+#ifdef CLAUDE_STATS
+  stats_.total_ticks = GetTicks() - start_ticks;
+  stats_.Print(cerr);
+#endif
+  return true;
 }
 
-bool MinMaxPlayer::CalcNextMove(Position& pos, int depth, Move* next_move, int* score) {
-  ++count;
-  if (depth < max_depth_) {
-    pos.CalcMoves();
+int MinMaxPlayer::SearchLine(const Position& pos, int first, int guess, Move* best_move) {
+  int delta = ASPIRATION_WINDOW;
+  int alpha = -INFINITE_SCORE;
+  int beta = INFINITE_SCORE;
+  if (root_depth_ > 1) {
+    alpha = guess - delta;
+    beta = guess + delta;
   }
-  if (pos.next_moves().empty()) {
-    if (pos.IsCheck()) {
-      // loose
-      *score = -2000;
+  while (1) {
+    int start_count = nodes_;
+    int score;
+    if (pos.side() == WHITE) {
+      score = SearchRoot<WHITE>(pos, first, root_depth_, alpha, beta, best_move);
     } else {
-      // stale mate
-      *score = -1000;
+      score = SearchRoot<BLACK>(pos, first, root_depth_, alpha, beta, best_move);
+    }
+    if (stopped_) {
+      return score;
+    }
+    if (score <= alpha && alpha > -INFINITE_SCORE) {
+      // fail low: widen the window downward and search again.
+      ++fail_low_count_;
+      research_count_ += nodes_ - start_count;
+      delta *= 2;
+      alpha = (delta > MAX_ASPIRATION_WINDOW) ? -INFINITE_SCORE : score - delta;
+    } else if (score >= beta && beta < INFINITE_SCORE) {
+      // fail high: widen the window upward and search again.
+      ++fail_high_count_;
+      research_count_ += nodes_ - start_count;
+      delta *= 2;
+      beta = (delta > MAX_ASPIRATION_WINDOW) ? INFINITE_SCORE : score + delta;
+      // Try the refuting move first in the re-search.
+      iter_swap(root_moves_.begin() + first,
+                find(root_moves_.begin() + first, root_moves_.end(), *best_move));
+    } else {
+      return score;
     }
-    return false;
-  }
-  if (depth == 0) {
-    *score = CalcScore(pos);
-    return true;
   }
-  *score = -10000;
-  for (vector<Move>::const_iterator it = pos.next_moves().begin(); it != pos.next_moves().end(); ++it) {
+}
+
+template <int Side>
+int MinMaxPlayer::SearchRoot(const Position& pos, int first, int depth, int alpha, int beta,
+                             Move* best_move) {
+  ++nodes_;
+  SEARCH_STATS(++stats_.main_nodes);
+  SEARCH_STATS(++stats_.nodes[0]);
+  int best_score = -INFINITE_SCORE;
+  for (const Move* it = root_moves_.begin() + first; it != root_moves_.end(); ++it) {
     Position next_pos;
-    pos.DoMove(*it, &next_pos);
-    Move next_next_move;
-    int next_score;
-    CalcOpponentNextMove(next_pos, depth - 1, &next_next_move, &next_score);
-    /*
-     if (depth == max_depth_) {
-     it->Print();
-     printf(" ");
-     next_next_move.Print();
-     printf(" %d\n", next_score);
-     }
-     */
-    if (next_score > *score) {
-      *next_move = *it;
-      *score = next_score;
+    pos.DoMove<Side>(*it, &next_pos);
+    if (tt_ && depth > 1) {
+      tt_->Prefetch(next_pos.key());
+    }
+    // check extension
+    int extension = next_pos.IsCheck<-Side>() ? 1 : 0;
+    int score = -Search<-Side>(next_pos, depth - 1 + extension, 1,
+                               -beta, -max(alpha, best_score));
+    if (stopped_) {
+      break;
+    }
+    if (score > best_score) {
+      *best_move = *it;
+      best_score = score;
+      if (score >= beta) {
+        break;
+      }
     }
   }
-  return true;
+  return best_score;
 }
 
-bool MinMaxPlayer::CalcOpponentNextMove(Position& pos, int depth, Move* next_move, int* score) {
-  ++count;
-  pos.CalcMoves();
-  if (pos.next_moves().empty()) {
-    if (pos.IsCheck()) {
-      // win
-      *score = 2000;
-    } else {
-      // stale mate
-      *score = -1000;
+template <int Side>
+int MinMaxPlayer::Search(const Position& pos, int depth, int ply, int alpha, int beta) {
+  ++nodes_;
+  if (CheckLimits()) {
+    return 0;
+  }
+  SEARCH_STATS(++stats_.main_nodes);
+  SEARCH_STATS(++stats_.nodes[min<int>(ply, SearchStats::MAX_PLY - 1)]);
+  MoveList moves;
+  {
+    SEARCH_STATS(++stats_.movegen_calls);
+    SEARCH_STATS(StatsTimer timer(&stats_.movegen_ticks));
+    pos.CalcMoves<Side>(&moves);
+  }
+  if (moves.empty()) {
+    if (pos.IsCheck<Side>()) {
+      // lose
+      return -(MATE_SCORE - ply);
     }
-    return false;
+    // stale mate
+    return 0;
+  }
+  int known;
+  if (pos.piece_count(WHITE) + pos.piece_count(BLACK) <= 4 && ProbeBitbase(pos, &known)) {
+    if (known == 0) {
+      return 0;
+    }
+    if (depth <= 0) {
+      return known * BitbaseWinScore(pos);
+    }
+  } else if (pos.piece_count(WHITE) + pos.piece_count(BLACK) <= SyzygyLargest() &&
+             ProbeWdl(pos, &known)) {
+    ++tb_hits_;
+    // Cursed wins and blessed losses are draws by the 50 moves rule.
+    if (known == WDL_WIN) {
+      return TB_WIN_SCORE - ply;
+    } else if (known == WDL_LOSS) {
+      return -(TB_WIN_SCORE - ply);
+    }
+    return 0;
+  }
+  if (depth <= 0) {
+    SEARCH_STATS(++stats_.eval_calls);
+    SEARCH_STATS(StatsTimer timer(&stats_.eval_ticks));
+    return CalcScore<Side>(pos);
   }
-  if (depth == 0) {
-    *score = CalcScore(pos);
-    return true;
+  const int original_alpha = alpha;
+  if (tt_) {
+    SEARCH_STATS(++stats_.tt_probes);
+    TtEntry entry;
+    if (tt_->Probe(pos.key(), &entry)) {
+      SEARCH_STATS(++stats_.tt_hits);
+      int score = ScoreFromTable(entry.score, ply);
+      if (entry.depth >= depth &&
+          (entry.bound() == BOUND_EXACT ||
+           (entry.bound() == BOUND_LOWER && score >= beta) ||
+           (entry.bound() == BOUND_UPPER && score <= alpha))) {
+        SEARCH_STATS(++stats_.tt_cutoffs);
+        return score;
+      }
+      // Search the stored move first.
+      Move* first = find(moves.begin(), moves.end(), entry.move);
+      if (first != moves.end()) {
+        rotate(moves.begin(), first, first + 1);
+      }
+    }
   }
-  *score = 10000;
-  for (vector<Move>::const_iterator it = pos.next_moves().begin(); it != pos.next_moves().end(); ++it) {
+  int best_score = -INFINITE_SCORE;
+  const Move* best_move = moves.begin();
+  for (const Move* it = moves.begin(); it != moves.end(); ++it) {
     Position next_pos;
-    pos.DoMove(*it, &next_pos);
-    Move next_next_move;
-    int next_score;
-    CalcNextMove(next_pos, depth - 1, &next_next_move, &next_score);
-    if (next_score < *score) {
-      *next_move = *it;
-      *score = next_score;
+    pos.DoMove<Side>(*it, &next_pos);
+    if (tt_ && depth > 1) {
+      // The child probes after generating its moves; the bucket arrives
+      // meanwhile.
+      tt_->Prefetch(next_pos.key());
+    }
+    // Extend checks, but not beyond twice the iteration depth.
+    int extension = (ply < 2 * root_depth_ && next_pos.IsCheck<-Side>()) ? 1 : 0;
+    int score = -Search<-Side>(next_pos, depth - 1 + extension, ply + 1, -beta, -alpha);
+    if (stopped_) {
+      return 0;
+    }
+    if (score > best_score) {
+      best_score = score;
+      best_move = it;
+      if (score > alpha) {
+        alpha = score;
+        if (alpha >= beta) {
+          break;
+        }
+      }
     }
   }
-  return true;
+  if (tt_) {
+    int bound = (best_score >= beta) ? BOUND_LOWER :
+    (best_score > original_alpha) ? BOUND_EXACT : BOUND_UPPER;
+    tt_->Store(pos.key(), depth, ScoreToTable(best_score, ply), bound, *best_move);
+  }
+  return best_score;
 }
 
-int MinMaxPlayer::CalcScore(Position& pos) {
+void MinMaxPlayer::ExtractPv(const Position& root, const Move& move, vector<Move>* pv) {
+  pv->assign(1, move);
+  if (!tt_) {
+    return;
+  }
+  Position pos;
+  root.DoMove(move, &pos);
+  // Check extensions make lines at most twice the iteration depth.
+  while (static_cast<int>(pv->size()) < 2 * root_depth_) {
+    TtEntry entry;
+    // Upper bounds have no best move.
+    if (!tt_->Probe(pos.key(), &entry) || entry.bound() == BOUND_UPPER ||
+        !pos.IsValidMove(entry.move)) {
+      break;
+    }
+    pv->push_back(entry.move);
+    Position next_pos;
+    pos.DoMove(entry.move, &next_pos);
+    pos = next_pos;
+  }
+}
+
+// Polls the clock every 1024 nodes and sets stopped_ when the time is up,
+// the node limit is reached or the stop flag is set.
+bool MinMaxPlayer::CheckLimits() {
+  if (stop_flag_ && *stop_flag_) {
+    stopped_ = true;
+  }
+  if (time_limit_ > 0 && (nodes_ & 1023) == 0 && GetTime() >= deadline_) {
+    stopped_ = true;
+  }
+  if (node_limit_ > 0 && nodes_ >= node_limit_) {
+    stopped_ = true;
+  }
+  return stopped_;
+}
+
+int MinMaxPlayer::CalcScore(const Position& pos) {
+  if (pos.side() == WHITE) {
+    return CalcScore<WHITE>(pos);
+  } else {
+    return CalcScore<BLACK>(pos);
+  }
+}
+
+// Material balance from the side to move.
+template <int Side>
+int MinMaxPlayer::CalcScore(const Position& pos) {
+  // The kings cancel out.
   const static int PIECE_SCORE[] = {
-    200, 9, 5, 3, 3, 1, 0, -1, -3, -3, -5, -9, -200
+    0, -PIECE_VALUE[5], -PIECE_VALUE[4], -PIECE_VALUE[3], -PIECE_VALUE[2], -PIECE_VALUE[1],
+    0, PIECE_VALUE[1], PIECE_VALUE[2], PIECE_VALUE[3], PIECE_VALUE[4], PIECE_VALUE[5], 0
   };
   int score = 0;
   for (int y = 0; y < 8; ++y) {
@@ -1149,5 +1411,5 @@ int MinMaxPlayer::CalcScore(Position& pos) {
       score += PIECE_SCORE[pos.get_board(x, y) + 6];
     }
   }
-  return score;
-}
\ No newline at end of file
+  return score * Side;
+}
@@ -15,12 +15,26 @@
 #include <vector>
 using namespace std;
 
+#include <assert.h>
+#include <stdint.h>
+
+#include "claude_bitboard.h"
+#include "claude_stats.h"
+
 // A macro to disallow the copy constructor and operator= functions
 // This should be used in the private: declarations for a class
 #define DISALLOW_COPY_AND_ASSIGN(TypeName) \
 TypeName(const TypeName&);               \
 void operator=(const TypeName&)
 
+// Returns the wall-clock time in seconds.
+double GetTime();
+
+// A compile-time assertion; msg must be a valid identifier.
+template <bool> struct CompileAssert {};
+#define COMPILE_ASSERT(expr, msg) \
+typedef CompileAssert<(bool(expr))> msg[bool(expr) ? 1 : -1]
+
 
 class Move {
 public:
@@ -43,11 +57,11 @@ public:
   int piece() const { return piece_; }
   
 private:
-  int from_x_;
-  int from_y_;
-  int to_x_;
-  int to_y_;
-  int piece_;
+  int8_t from_x_;
+  int8_t from_y_;
+  int8_t to_x_;
+  int8_t to_y_;
+  int8_t piece_;
   
   friend bool operator==(const Move& lhs, const Move& rhs);
   friend bool operator!=(const Move& lhs, const Move& rhs);
@@ -66,6 +80,52 @@ inline bool operator!=(const Move& lhs, const Move& rhs){
 }
 
 
+// Fixed-capacity list of moves, to be allocated on the stack.
+class MoveList {
+public:
+  MoveList() : size_(0) {}
+  
+  void clear() { size_ = 0; }
+  void push_back(const Move& m) {
+    assert(size_ < MAX_MOVES);
+    moves_[size_++] = m;
+  }
+  
+  int size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  
+  const Move& operator[](int i) const { return moves_[i]; }
+  Move& operator[](int i) { return moves_[i]; }
+  
+  const Move* begin() const { return moves_; }
+  const Move* end() const { return moves_ + size_; }
+  Move* begin() { return moves_; }
+  Move* end() { return moves_ + size_; }
+  
+private:
+  // No position has more than 218 legal moves.
+  enum { MAX_MOVES = 256 };
+  
+  Move moves_[MAX_MOVES];
+  int size_;
+};
+
+
+// Sides, the values of Position::side().
+enum {
+  WHITE = 1,
+  BLACK = -1
+};
+
+// Castling rights.
+enum {
+  WHITE_OO = 1,
+  WHITE_OOO = 2,
+  BLACK_OO = 4,
+  BLACK_OOO = 8
+};
+
+// A position is a plain value of two cache lines, copied by DoMove.
 class Position {
 public:
   Position() {}
@@ -73,89 +133,247 @@ public:
 	void StartPosition();
 	
   void Print() const;
-  void DoMove(const Move&, Position* dst);
-  bool IsCheck();
-  void CalcMoves();
-  bool IsValidMove(const Move&);
+  void DoMove(const Move&, Position* dst) const;
+  bool IsCheck() const;
+  void CalcMoves(MoveList* moves) const;
+  bool IsValidMove(const Move&) const;
   
 	int get_board(int x, int y) const { return board_[x][y]; }
+  // Does not update the piece lists and the key; call InitPieceLists()
+  // after editing.
 	void set_board(int x, int y, int p) { board_[x][y] = p; }
+  void InitPieceLists();
+  int side() const { return side_; }
+  int castling() const { return castling_; }
+  int en_passant_square() const { return en_passant_square_; }
+  int halfmove_clock() const { return halfmove_clock_; }
+  int fullmove_counter() const { return fullmove_counter_; }
+  int king_square(int side) const { return king_square_[side == WHITE]; }
+  // Number of pieces of the side, including its king.
+  int piece_count(int side) const { return piece_count_[side == WHITE]; }
+  // Zobrist key of the pieces, side to move, castling rights and en
+  // passant square.
+  uint64_t key() const { return key_; }
   
-  const vector<Move>& next_moves() const { return next_moves_; }
+  // Returns true if the positions are the same for the repetition rule:
+  // same pieces, side to move, castling rights and en passant square.
+  bool IsRepetitionOf(const Position& other) const;
   
   string Fen() const;
-  static void ParseFen(const string& fen, Position* pos);
+  // Writes the FEN and a terminating NUL to buffer, which must hold
+  // FEN_BUFFER_SIZE chars. Returns the length of the FEN.
+  int WriteFen(char* buffer) const;
+  enum { FEN_BUFFER_SIZE = 96 };
+  
+  // Parses a FEN; the move counters may be missing. Returns false and
+  // leaves pos unchanged if the FEN is malformed or the position is not
+  // legal: a king a side, no pawns on the back ranks, castling rights and
+  // en passant target matching the pieces and the side that just moved
+  // not in check. Allocates nothing.
+  static bool ParseFen(const char* fen, size_t length, Position* pos);
+  static bool ParseFen(const string& fen, Position* pos);
+  
+  // Returns true if the square (x, y) is attacked by a piece of by_side.
+  // Looks outward from the square, so no attack map is built.
+  bool IsAttacked(int x, int y, int by_side) const;
+  
+  // Squares attacked by the pieces of by_side.
+  Bitboard AttackMap(int by_side) const;
+  
+  // Versions of the above specialized for the side to move (WHITE or
+  // BLACK), which must equal side().
+  template <int Side> void DoMove(const Move&, Position* dst) const;
+  template <int Side> bool IsCheck() const;
+  template <int Side> void CalcMoves(MoveList* moves) const;
+  template <int BySide> bool IsAttackedBy(int x, int y) const;
   
 private:
-	void PartialCopyFrom(const Position& src);
-  
-  void CalcIsUnderAttack();
-  void CalcIsUnderAttackByPawn(int, int);
-  void CalcIsUnderAttackByKnight(int, int);
-  void CalcIsUnderAttackByBishop(int, int);
-  void CalcIsUnderAttackByRook(int, int);
-  void CalcIsUnderAttackByQueen(int, int);
-  void CalcIsUnderAttackByKing(int, int);
-  int SetIsUnderAttack(int, int);
-  
-  void CalcPawnMoves(int, int);
-  void CalcBishopMoves(int, int);
-  void CalcKnightMoves(int, int);
-  void CalcRookMoves(int, int);
-  void CalcQueenMoves(int, int);
-  void CalcKingMoves(int, int);
-  void AddPawnMoves(int from_x, int from_y, int to_x, int to_y);
-  int AddMove(int from_x, int from_y, int to_x, int to_y, int piece);
-  
-  int board_[8][8];
-  int side_;
-  
-  // castling is available?
-  bool can_castling_[2][2];
-  
-  // En passant target
-  int en_passant_target_x_;
-  int en_passant_target_y_;
+  bool IsAttackedBySlider(int x, int y, int dx, int dy, int p1, int p2) const;
   
-  // Halfmove clock for 50 moves rule.
-  int halfmove_clock_;
+  template <int Side> void CalcPawnMoves(int, int, MoveList*) const;
+  template <int Side> void CalcBishopMoves(int, int, MoveList*) const;
+  template <int Side> void CalcKnightMoves(int, int, MoveList*) const;
+  template <int Side> void CalcRookMoves(int, int, MoveList*) const;
+  template <int Side> void CalcQueenMoves(int, int, MoveList*) const;
+  template <int Side> void CalcKingMoves(int, int, MoveList*) const;
+  template <int Side>
+  void AddPawnMoves(int from_x, int from_y, int to_x, int to_y, MoveList* moves) const;
+  template <int Side>
+  int AddMove(int from_x, int from_y, int to_x, int to_y, int piece, MoveList* moves) const;
   
-  // Fullmove counter.
-  int fullmove_counter_;
+  void MovePiece(int s, int from, int to);
+  void RemovePiece(int s, int sq);
+  
+  int8_t board_[8][8];
+  
+  // Squares of the pieces of each side (index 1 is white).
+  int8_t piece_list_[2][16];
+  int8_t piece_count_[2];
+  int8_t king_square_[2];
   
-  // The following part is not a part of Position?
+  int8_t side_;
   
-  // next moves
-  vector<Move> next_moves_;
+  // Castling rights (WHITE_OO | ...).
+  uint8_t castling_;
+  
+  // En passant target square, or -1.
+  int8_t en_passant_square_;
+  
+  // Halfmove clock for 50 moves rule.
+  uint8_t halfmove_clock_;
   
-  // is under attack?
-  bool is_under_attack_[8][8];
+  // Fullmove counter.
+  uint16_t fullmove_counter_;
+  
+  uint64_t key_;
 };
 
+COMPILE_ASSERT(sizeof(Position) <= 128, position_fits_in_two_cache_lines);
 
+
+// Plays a legal move at random, from its own generator.
 class RandomPlayer {
 public:
-  RandomPlayer() {}
+  RandomPlayer() : seed_(1) {}
   bool NextMove(Position& pos, Move* next_move);
   
+  void set_seed(unsigned int seed) { seed_ = seed; }
+  
 private:
+  unsigned int seed_;
+  
   DISALLOW_COPY_AND_ASSIGN(RandomPlayer);
 };
 
+// Scores are in centipawns. Score of a checkmated side. Mates found nearer
+// to the root score higher: being mated in n plies scores -(MATE_SCORE - n).
+const int MATE_SCORE = 32000;
+
+// A line of the search: a root move followed by the expected replies, and
+// its score from the side to move.
+struct PvLine {
+  int score;
+  vector<Move> moves;
+};
+
+// Receives the progress of a search.
+class SearchListener {
+public:
+  virtual ~SearchListener() {}
+  
+  // Called after each completed iteration of the iterative deepening, with
+  // its best move, its score from the side to move and the nodes searched
+  // so far.
+  virtual void OnIteration(int depth, int score, const Move& best_move, int nodes) = 0;
+  
+  // Called before OnIteration for each line of the iteration, best first;
+  // index counts from 0.
+  virtual void OnLine(int depth, int index, const PvLine& line, int nodes) {}
+};
+
+class TranspositionTable;
+
+// Alpha-beta (negamax) player with iterative deepening.
+// Each iteration starts with an aspiration window around the score of the
+// previous one, and moves giving check are searched one ply deeper.
+// The search is specialized for the side to move.
 class MinMaxPlayer {
 public:
   MinMaxPlayer(int max_depth);
   bool NextMove(Position& pos, Move* next_move);
   
-  int count;
-  int last_score;
+  // Stops the search after the given time in seconds; 0 means no limit.
+  // The best move of the last completed iteration is played.
+  void set_time_limit(double seconds) { time_limit_ = seconds; }
+  
+  // Stops the search after about the given number of nodes; 0 means no
+  // limit.
+  void set_node_limit(int nodes) { node_limit_ = nodes; }
+  
+  // Not owned; NULL for none.
+  void set_listener(SearchListener* listener) { listener_ = listener; }
+  
+  // Not owned; NULL for none. The search stops as soon as *stop is set,
+  // which another thread may do.
+  void set_stop_flag(const volatile bool* stop) { stop_flag_ = stop; }
+  
+  // Searches the given number of best lines instead of only the best move
+  // (MultiPV); 1 by default. Each line excludes the root moves of the lines
+  // before it.
+  void set_multi_pv(int lines) { multi_pv_ = lines; }
+  
+  // Not owned; NULL for none. The table is kept between searches, so a
+  // player searching related positions finds it warm.
+  void set_hash_table(TranspositionTable* tt) { tt_ = tt; }
+  
+  // Static evaluation from the side to move.
+  int CalcScore(const Position& pos);
+  
+  // Searched nodes and the score (from the side to move) of the last search.
+  int nodes() const { return nodes_; }
+  int score() const { return score_; }
+  // Lines of the last completed iteration, best first. The moves after the
+  // root move come from the transposition table, if any.
+  const vector<PvLine>& lines() const { return lines_; }
+  // Positions found in the tablebases during the last search.
+  int tb_hits() const { return tb_hits_; }
+  
+  // Aspiration window statistics of the last search.
+  // research_count() is the number of nodes wasted by failed windows.
+  int fail_high_count() const { return fail_high_count_; }
+  int fail_low_count() const { return fail_low_count_; }
+  int research_count() const { return research_count_; }
+  
+#ifdef CLAUDE_STATS
+  // Profiling counters of the last search.
+  const SearchStats& stats() const { return stats_; }
+#endif
   
 private:
-  bool CalcNextMove(Position& pos, int depth, Move* next_move, int* score);
-  bool CalcOpponentNextMove(Position& pos, int depth, Move* next_move, int* score);
-  int CalcScore(Position& pos);
+  // Searches the root moves from first on with an aspiration window around
+  // guess.
+  int SearchLine(const Position& pos, int first, int guess, Move* best_move);
+  template <int Side>
+  int SearchRoot(const Position& pos, int first, int depth, int alpha, int beta,
+                 Move* best_move);
+  template <int Side>
+  int Search(const Position& pos, int depth, int ply, int alpha, int beta);
+  bool CheckLimits();
+  template <int Side>
+  int CalcScore(const Position& pos);
+  // Follows the moves of the transposition table after the root move.
+  void ExtractPv(const Position& pos, const Move& move, vector<Move>* pv);
+  
+  int nodes_;
+  int score_;
+  int tb_hits_;
+  int fail_high_count_;
+  int fail_low_count_;
+  int research_count_;
   
   int max_depth_;
+  int multi_pv_;
+  
+  // Depth of the current iteration. Limits check extensions.
+  int root_depth_;
+  
+  // Root moves, the moves of the lines of the previous iteration first.
+  MoveList root_moves_;
+  vector<PvLine> lines_;
+  
+  double time_limit_;
+  int node_limit_;
+  double deadline_;
+  // Set when the time is up; the search unwinds without a result.
+  bool stopped_;
+  
+  SearchListener* listener_;
+  TranspositionTable* tt_;
+  const volatile bool* stop_flag_;
+  
+#ifdef CLAUDE_STATS
+  SearchStats stats_;
+#endif
   
   DISALLOW_COPY_AND_ASSIGN(MinMaxPlayer);
 };
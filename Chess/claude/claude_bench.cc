@@ -0,0 +1,400 @@
+//
+//  claude_bench.cc
+//  Deterministic benchmarks of the engine.
+//
+
+#include "claude_bench.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <stdio.h>
+
+#include "claude.h"
+#include "claude_tt.h"
+
+const char* const BENCH_FENS[] = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+  "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+  "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+  "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+  "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+  "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+  "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+  "r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+  "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+  "2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+  "r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+  "3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+  "r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+  "4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+  "3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+  "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/8 b - - 3 54",
+  "3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+  "2K5/p7/7P/5pR1/8/5k2/r7/8 w - - 0 1",
+  "8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+  "7k/3p2pp/4q3/8/4Q3/5Kp1/P6b/8 w - - 0 1",
+  "8/2p5/8/2kPKp1p/2p4P/2P5/3P4/8 w - - 0 1",
+  "8/1p3pp1/7p/5P1P/2k3P1/8/2K2P2/8 w - - 0 1",
+  "8/pp2r1k1/2p1p3/3pP2p/1P1P1P1P/P5KR/8/8 w - - 0 1",
+  "8/3p4/p1bk3p/Pp6/1Kp1PpPp/2P2P1P/2P5/5B2 b - - 0 1",
+  "5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+  "6k1/6p1/P6p/r1N5/5p2/7P/1b3PP1/4R1K1 w - - 0 1",
+  "1r3k2/4q3/2Pp3b/3Bp3/2Q2p2/1p1P2P1/1P2KP2/3N4 w - - 0 1",
+  "6k1/4pp1p/3p2p1/P1pPb3/R7/1r2P1PP/3B1P2/6K1 w - - 0 1",
+  "8/3p3B/5p2/5P2/p7/PP5b/k7/6K1 w - - 0 1",
+  "5rk1/q6p/2p3bR/1pPp1rP1/1P1Pp3/P3B1Q1/1K3P2/R7 w - - 93 90",
+  "4rrk1/1p1nq3/p7/2p1P1pp/3P2bp/3Q1Bn1/PPPB4/1K2R1NR w - - 40 21",
+  "r3k2r/3nnpbp/q2pp1p1/p7/Pp1PPPP1/4BNN1/1P5P/R2Q1RK1 w kq - 0 16",
+  "3Qb1k1/1r2ppb1/pN1n2q1/Pp1Pp1Pr/4P2p/4BP2/4B1R1/1R5K b - - 11 40",
+  "4k3/3q1r2/1N2r1b1/3ppN2/2nPP3/1B1R2n1/2R1Q3/3K4 w - - 5 1",
+  "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+  "8/8/8/5N2/8/p7/8/2NK3k w - - 0 1",
+  "8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+  "8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+  "8/2p4P/8/kr6/6R1/8/8/1K6 w - - 0 1",
+  "8/8/3P3k/8/1p6/8/1P6/1K3n2 b - - 0 1",
+  "8/R7/2q5/8/6k1/8/1P5p/K6R w - - 0 124",
+  "6k1/3b3r/1p1p4/p1n2p2/1PPNpP1q/P3Q1p1/1R1RB1P1/5K2 b - - 0 1",
+  "r2r1n2/pp2bk2/2p1p2p/3q4/3PN1QP/2P3R1/P4PP1/5RK1 w - - 0 1",
+  "8/8/8/8/8/6k1/6p1/6K1 w - - 0 1",
+  "7k/7P/6K1/8/3B4/8/8/8 b - - 0 1",
+  "5k2/5P2/5K2/8/8/8/8/8 b - - 0 1",
+  "r1bqkbnr/pppp1ppp/2n5/4p3/2B1P3/5Q2/PPPP1PPP/RNB1K1NR w KQkq - 4 4",
+  "8/k7/3p4/p2P1p2/P2P1P2/8/8/K7 w - - 0 1",
+  "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1"
+};
+
+const int BENCH_FEN_COUNT = sizeof(BENCH_FENS) / sizeof(BENCH_FENS[0]);
+
+void Bench(int depth, bool json) {
+  ostringstream results;
+  long long total_nodes = 0;
+  double start = GetTime();
+  
+  for (int i = 0; i < BENCH_FEN_COUNT; ++i) {
+    Position pos;
+    Position::ParseFen(BENCH_FENS[i], &pos);
+    MinMaxPlayer player(depth);
+    Move move;
+    bool has_move = player.NextMove(pos, &move);
+    total_nodes += player.nodes();
+    
+    if (json) {
+      results << (i ? ", " : "")
+      << "{\"fen\": \"" << BENCH_FENS[i] << "\", "
+      << "\"bestmove\": ";
+      if (has_move) {
+        results << '"' << move.ToString() << '"';
+      } else {
+        results << "null";
+      }
+      results << ", \"score\": " << player.score()
+      << ", \"nodes\": " << player.nodes() << "}";
+    } else {
+      cout << "Position " << i + 1 << "/" << BENCH_FEN_COUNT
+      << ": " << BENCH_FENS[i] << endl;
+      cout << "bestmove " << (has_move ? move.ToString() : "(none)")
+      << " score " << player.score()
+      << " nodes " << player.nodes() << endl;
+    }
+  }
+  
+  double elapsed = GetTime() - start;
+  long long nps = static_cast<long long>(total_nodes / elapsed);
+  if (json) {
+    cout << "{\"depth\": " << depth
+    << ", \"positions\": " << BENCH_FEN_COUNT
+    << ", \"nodes\": " << total_nodes
+    << ", \"time_ms\": " << static_cast<long long>(elapsed * 1000)
+    << ", \"nps\": " << nps
+    << ", \"results\": [" << results.str() << "]}" << endl;
+  } else {
+    cout << endl;
+    cout << "Total time (ms) : " << static_cast<long long>(elapsed * 1000) << endl;
+    cout << "Nodes searched  : " << total_nodes << endl;
+    cout << "Nodes/second    : " << nps << endl;
+  }
+}
+
+void HashBench(int depth, int megabytes, bool json) {
+  ostringstream results;
+  double nps[2];
+  for (int large_pages = 0; large_pages < 2; ++large_pages) {
+    // One table for all the positions, as in a game.
+    TranspositionTable tt;
+    if (!tt.Resize(megabytes, large_pages)) {
+      cerr << "Cannot allocate " << megabytes << " MB" << endl;
+      return;
+    }
+    long long total_nodes = 0;
+    double start = GetTime();
+    for (int i = 0; i < BENCH_FEN_COUNT; ++i) {
+      Position pos;
+      Position::ParseFen(BENCH_FENS[i], &pos);
+      MinMaxPlayer player(depth);
+      player.set_hash_table(&tt);
+      Move move;
+      player.NextMove(pos, &move);
+      total_nodes += player.nodes();
+    }
+    double elapsed = GetTime() - start;
+    nps[large_pages] = total_nodes / elapsed;
+    if (json) {
+      results << (large_pages ? ", " : "")
+      << "{\"huge_pages\": " << (tt.huge_pages() ? "true" : "false")
+      << ", \"nodes\": " << total_nodes
+      << ", \"time_ms\": " << static_cast<long long>(elapsed * 1000)
+      << ", \"nps\": " << static_cast<long long>(nps[large_pages]) << "}";
+    } else {
+      cout << (large_pages ? "Large pages" : "Small pages")
+      << (tt.huge_pages() ? " (huge)" : " (none)")
+      << " : nodes " << total_nodes
+      << " time (ms) " << static_cast<long long>(elapsed * 1000)
+      << " nodes/second " << static_cast<long long>(nps[large_pages]) << endl;
+    }
+  }
+  double gain = (nps[1] / nps[0] - 1) * 100;
+  if (json) {
+    cout << "{\"depth\": " << depth
+    << ", \"hash_mb\": " << megabytes
+    << ", \"gain_percent\": " << gain
+    << ", \"runs\": [" << results.str() << "]}" << endl;
+  } else {
+    cout << "Gain (%)    : " << gain << endl;
+  }
+}
+
+
+// Micro benchmarks
+namespace {
+  
+  // Positions the primitives run on.
+  struct Corpus {
+    vector<Position> positions;
+    vector<string> fens;
+    vector<MoveList> moves;
+  };
+  
+  // Results go here so that the compiler cannot drop the measured code.
+  volatile long long sink;
+  
+  // A primitive runs over the whole corpus once and returns the number of
+  // operations done.
+  typedef long long (*Primitive)(const Corpus& corpus);
+  
+  long long RunCalcMoves(const Corpus& corpus) {
+    long long n = 0;
+    for (size_t i = 0; i < corpus.positions.size(); ++i) {
+      MoveList moves;
+      corpus.positions[i].CalcMoves(&moves);
+      n += moves.size();
+    }
+    sink += n;
+    return corpus.positions.size();
+  }
+  
+  long long RunDoMove(const Corpus& corpus) {
+    long long n = 0;
+    for (size_t i = 0; i < corpus.positions.size(); ++i) {
+      const MoveList& moves = corpus.moves[i];
+      for (const Move* it = moves.begin(); it != moves.end(); ++it) {
+        Position next_pos;
+        corpus.positions[i].DoMove(*it, &next_pos);
+        sink += next_pos.side();
+        ++n;
+      }
+    }
+    return n;
+  }
+  
+  long long RunIsCheck(const Corpus& corpus) {
+    long long checks = 0;
+    for (size_t i = 0; i < corpus.positions.size(); ++i) {
+      checks += corpus.positions[i].IsCheck();
+    }
+    sink += checks;
+    return corpus.positions.size();
+  }
+  
+  // Whether each square is attacked by the side not to move.
+  long long RunIsAttacked(const Corpus& corpus) {
+    long long attacked = 0;
+    for (size_t i = 0; i < corpus.positions.size(); ++i) {
+      const Position& pos = corpus.positions[i];
+      for (int sq = 0; sq < 64; ++sq) {
+        attacked += pos.IsAttacked(SquareX(sq), SquareY(sq), -pos.side());
+      }
+    }
+    sink += attacked;
+    return corpus.positions.size() * 64;
+  }
+  
+  long long RunAttackMap(const Corpus& corpus) {
+    Bitboard attacks = 0;
+    for (size_t i = 0; i < corpus.positions.size(); ++i) {
+      const Position& pos = corpus.positions[i];
+      attacks ^= pos.AttackMap(-pos.side());
+    }
+    sink += attacks;
+    return corpus.positions.size();
+  }
+  
+  long long RunFen(const Corpus& corpus) {
+    long long n = 0;
+    for (size_t i = 0; i < corpus.positions.size(); ++i) {
+      n += corpus.positions[i].Fen().size();
+    }
+    sink += n;
+    return corpus.positions.size();
+  }
+  
+  long long RunParseFen(const Corpus& corpus) {
+    for (size_t i = 0; i < corpus.fens.size(); ++i) {
+      Position pos;
+      Position::ParseFen(corpus.fens[i], &pos);
+      sink += pos.side();
+    }
+    return corpus.fens.size();
+  }
+  
+  long long RunCalcScore(const Corpus& corpus) {
+    MinMaxPlayer player(1);
+    long long score = 0;
+    for (size_t i = 0; i < corpus.positions.size(); ++i) {
+      score += player.CalcScore(corpus.positions[i]);
+    }
+    sink += score;
+    return corpus.positions.size();
+  }
+  
+  // The bench positions and every position one move away from them.
+  void InitCorpus(Corpus* corpus) {
+    for (int i = 0; i < BENCH_FEN_COUNT; ++i) {
+      Position pos;
+      Position::ParseFen(BENCH_FENS[i], &pos);
+      corpus->positions.push_back(pos);
+      MoveList moves;
+      pos.CalcMoves(&moves);
+      for (const Move* it = moves.begin(); it != moves.end(); ++it) {
+        Position next_pos;
+        pos.DoMove(*it, &next_pos);
+        corpus->positions.push_back(next_pos);
+      }
+    }
+    for (size_t i = 0; i < corpus->positions.size(); ++i) {
+      corpus->fens.push_back(corpus->positions[i].Fen());
+      MoveList moves;
+      corpus->positions[i].CalcMoves(&moves);
+      corpus->moves.push_back(moves);
+    }
+  }
+  
+  // Minimum length of one timed sample.
+  const double MIN_SAMPLE_TIME = 0.002;
+  
+  // Times `repetitions` samples of the primitive and returns their ns/op.
+  // Each sample repeats the primitive often enough to last MIN_SAMPLE_TIME.
+  void Measure(Primitive run, const Corpus& corpus, int repetitions,
+               vector<double>* samples, long long* ops_per_sample) {
+    // Warm up the caches and the branch predictors while calibrating.
+    int loops = 1;
+    while (1) {
+      double start = GetTime();
+      for (int i = 0; i < loops; ++i) {
+        run(corpus);
+      }
+      if (GetTime() - start >= MIN_SAMPLE_TIME) {
+        break;
+      }
+      loops *= 2;
+    }
+    samples->clear();
+    for (int r = 0; r < repetitions; ++r) {
+      long long ops = 0;
+      double start = GetTime();
+      for (int i = 0; i < loops; ++i) {
+        ops += run(corpus);
+      }
+      double end = GetTime();
+      samples->push_back((end - start) * 1e9 / ops);
+      *ops_per_sample = ops;
+    }
+    sort(samples->begin(), samples->end());
+  }
+  
+  double Percentile(const vector<double>& sorted, double q) {
+    return sorted[static_cast<size_t>(q * (sorted.size() - 1) + 0.5)];
+  }
+  
+}  // namespace
+
+void MicroBench(int repetitions, int cpu, bool json) {
+  const static char* NAMES[] = {
+    "CalcMoves", "DoMove", "IsCheck", "IsAttacked", "AttackMap",
+    "Fen", "ParseFen", "CalcScore"
+  };
+  const static Primitive PRIMITIVES[] = {
+    RunCalcMoves, RunDoMove, RunIsCheck, RunIsAttacked, RunAttackMap,
+    RunFen, RunParseFen, RunCalcScore
+  };
+  const int n = sizeof(PRIMITIVES) / sizeof(PRIMITIVES[0]);
+  
+  if (repetitions < 1) {
+    repetitions = 1;
+  }
+  if (cpu >= 0) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+      cerr << "Cannot pin to cpu " << cpu << endl;
+    }
+#else
+    cerr << "Pinning to a cpu is not supported on this platform" << endl;
+#endif
+  }
+  
+  Corpus corpus;
+  InitCorpus(&corpus);
+  
+  if (json) {
+    cout << "{\"positions\": " << corpus.positions.size()
+    << ", \"repetitions\": " << repetitions << ", \"results\": [";
+  } else {
+    printf("%d positions, %d repetitions, ns/op\n",
+           static_cast<int>(corpus.positions.size()), repetitions);
+    printf("%-12s %10s %9s %9s %9s %9s %9s\n",
+           "primitive", "ops", "min", "p50", "p90", "p99", "max");
+  }
+  for (int i = 0; i < n; ++i) {
+    vector<double> samples;
+    long long ops = 0;
+    Measure(PRIMITIVES[i], corpus, repetitions, &samples, &ops);
+    if (json) {
+      cout << (i ? ", " : "") << "{\"name\": \"" << NAMES[i] << "\""
+      << ", \"ops\": " << ops
+      << ", \"min\": " << samples.front()
+      << ", \"p50\": " << Percentile(samples, 0.5)
+      << ", \"p90\": " << Percentile(samples, 0.9)
+      << ", \"p99\": " << Percentile(samples, 0.99)
+      << ", \"max\": " << samples.back() << "}";
+    } else {
+      printf("%-12s %10lld %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+             NAMES[i], ops, samples.front(),
+             Percentile(samples, 0.5), Percentile(samples, 0.9),
+             Percentile(samples, 0.99), samples.back());
+    }
+  }
+  if (json) {
+    cout << "]}" << endl;
+  }
+}
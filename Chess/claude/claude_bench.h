@@ -0,0 +1,33 @@
+//
+//  claude_bench.h
+//  Deterministic benchmarks of the engine.
+//
+
+#ifndef game_claude_bench_h
+#define game_claude_bench_h
+
+// Positions searched by the benchmarks, as FEN strings.
+extern const char* const BENCH_FENS[];
+extern const int BENCH_FEN_COUNT;
+
+// Default search depth of Bench().
+const int BENCH_DEPTH = 4;
+
+// Searches every bench position to a fixed depth and prints the nodes,
+// time and nodes/sec, as text or as one JSON object.
+// The total node count is a signature of the search: it changes only when
+// the search itself changes, not with the machine or the build.
+void Bench(int depth, bool json);
+
+// Searches the bench positions with a transposition table of megabytes,
+// kept from one position to the next, first in small pages and then in
+// huge pages, and prints the nodes/sec of both.
+void HashBench(int depth, int megabytes, bool json);
+
+// Measures ns/op of the Position primitives and the evaluation over the
+// bench positions and their children. Each primitive is warmed up, then
+// timed repetitions times; percentiles of the samples are printed.
+// If cpu >= 0 the thread is pinned to that core first (Linux only).
+void MicroBench(int repetitions, int cpu, bool json);
+
+#endif  // game_claude_bench_h
@@ -0,0 +1,507 @@
+//
+//  claude_bitbase.cc
+//  Win/draw bitbases of small endgames: KQK, KRK, KPK and KBNK.
+//
+
+#include "claude_bitbase.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+  // States of a position during the generation.
+  enum {
+    UNKNOWN,
+    WIN,
+    DRAW,
+    INVALID,
+    // Flags a win whose predecessors are yet to be visited.
+    FRESH = 4
+  };
+
+  // Sides to move in the index.
+  enum {
+    STRONG = 0,
+    WEAK = 1
+  };
+
+  struct EndgameSpec {
+    const char* name;
+    // Extra pieces of the strong side, by decreasing value.
+    int count;
+    int pieces[2];
+  };
+
+  // KQK and KRK come first: KPK looks them up for promotions.
+  enum { KQK, KRK, KPK, KBNK, ENDGAME_COUNT };
+  const EndgameSpec ENDGAMES[ENDGAME_COUNT] = {
+    { "KQK", 1, { 5, 0 } },
+    { "KRK", 1, { 4, 0 } },
+    { "KPK", 1, { 1, 0 } },
+    { "KBNK", 2, { 3, 2 } }
+  };
+
+  const char MAGIC[8] = { 'C', 'L', 'B', 'B', '0', '0', '0', '1' };
+  const int HEADER_SIZE = 16;
+
+  // Squares are the strong king, the weak king, then the extra pieces.
+  size_t Encode(int pieces, int stm, const int* squares) {
+    size_t index = stm;
+    for (int i = 0; i < pieces; ++i) {
+      index = index * 64 + squares[i];
+    }
+    return index;
+  }
+
+  void Decode(int pieces, size_t index, int* stm, int* squares) {
+    for (int i = pieces - 1; i >= 0; --i) {
+      squares[i] = index & 63;
+      index >>= 6;
+    }
+    *stm = index;
+  }
+
+  Bitboard PieceAttacks(int piece, int sq, Bitboard occupied) {
+    switch (piece) {
+      case 1:
+        return PawnAttacks(WHITE, sq);
+      case 2:
+        return KnightAttacks(sq);
+      case 3:
+        return BishopAttacks(sq, occupied);
+      case 4:
+        return RookAttacks(sq, occupied);
+      case 5:
+        return QueenAttacks(sq, occupied);
+      default:
+        return KingAttacks(sq);
+    }
+  }
+
+  class Bitbase {
+  public:
+    Bitbase() : spec_(NULL), bits_(NULL), size_(0), mapped_(NULL), mapped_size_(0) {}
+    ~Bitbase() { Unmap(); }
+
+    void set_spec(const EndgameSpec* spec) {
+      spec_ = spec;
+      size_ = static_cast<size_t>(2) << (6 * (2 + spec->count));
+    }
+    const EndgameSpec* spec() const { return spec_; }
+    bool loaded() const { return bits_ != NULL; }
+    size_t size() const { return size_; }
+
+    bool IsWin(size_t index) const {
+      return (bits_[index >> 3] >> (index & 7)) & 1;
+    }
+
+    void Generate(const Bitbase* bitbases);
+    bool Load(const string& path);
+    bool Save(const string& path) const;
+
+  private:
+    int Classify(size_t index, const vector<uint8_t>& state,
+                 const Bitbase* bitbases) const;
+    void VisitPredecessors(size_t index, vector<uint8_t>* state,
+                           const Bitbase* bitbases) const;
+    void Unmap();
+
+    const EndgameSpec* spec_;
+    const uint8_t* bits_;
+    size_t size_;
+    vector<uint8_t> storage_;
+    void* mapped_;
+    size_t mapped_size_;
+  };
+
+  Bitbase bitbases[ENDGAME_COUNT];
+
+  // Returns the state of a position from the states of its successors.
+  int Bitbase::Classify(size_t index, const vector<uint8_t>& state,
+                        const Bitbase* bitbases) const {
+    const int pieces = 2 + spec_->count;
+    int stm;
+    int sq[4] = { 0, 0, 0, 0 };
+    Decode(pieces, index, &stm, sq);
+    const int sk = sq[0];
+    const int wk = sq[1];
+
+    Bitboard strong = 0;
+    for (int i = 0; i < pieces; ++i) {
+      if (i != 1) {
+        strong |= SquareBit(sq[i]);
+      }
+    }
+    if (PopCount(strong | SquareBit(wk)) != pieces || (KingAttacks(sk) & SquareBit(wk))) {
+      return INVALID;
+    }
+    for (int i = 2; i < pieces; ++i) {
+      if (spec_->pieces[i - 2] == 1 && (SquareY(sq[i]) == 0 || SquareY(sq[i]) == 7)) {
+        return INVALID;
+      }
+    }
+    const Bitboard occupied = strong | SquareBit(wk);
+
+    // Squares attacked by the strong side, seen through the weak king.
+    Bitboard attacks = KingAttacks(sk);
+    for (int i = 2; i < pieces; ++i) {
+      attacks |= PieceAttacks(spec_->pieces[i - 2], sq[i], occupied ^ SquareBit(wk));
+    }
+
+    int child[4];
+    memcpy(child, sq, sizeof(child));
+    if (stm == STRONG) {
+      if (attacks & SquareBit(wk)) {
+        // The weak king cannot be in check with the strong side to move.
+        return INVALID;
+      }
+      // The weak side has only its king, so a win needs one winning move.
+      Bitboard targets = KingAttacks(sk) & ~occupied & ~KingAttacks(wk);
+      while (targets) {
+        child[0] = PopLsb(&targets);
+        if ((state[Encode(pieces, WEAK, child)] & ~FRESH) == WIN) {
+          return WIN;
+        }
+      }
+      child[0] = sk;
+      for (int i = 2; i < pieces; ++i) {
+        int piece = spec_->pieces[i - 2];
+        if (piece == 1) {
+          int one = sq[i] + 8;
+          if (occupied & SquareBit(one)) {
+            continue;
+          }
+          if (SquareY(one) == 7) {
+            // Promote to a queen or a rook.
+            int promoted[3] = { sk, wk, one };
+            size_t promoted_index = Encode(3, WEAK, promoted);
+            if (bitbases[KQK].IsWin(promoted_index) || bitbases[KRK].IsWin(promoted_index)) {
+              return WIN;
+            }
+            continue;
+          }
+          child[i] = one;
+          if ((state[Encode(pieces, WEAK, child)] & ~FRESH) == WIN) {
+            return WIN;
+          }
+          int two = one + 8;
+          if (SquareY(sq[i]) == 1 && !(occupied & SquareBit(two))) {
+            child[i] = two;
+            if ((state[Encode(pieces, WEAK, child)] & ~FRESH) == WIN) {
+              return WIN;
+            }
+          }
+        } else {
+          targets = PieceAttacks(piece, sq[i], occupied) & ~occupied;
+          while (targets) {
+            child[i] = PopLsb(&targets);
+            if ((state[Encode(pieces, WEAK, child)] & ~FRESH) == WIN) {
+              return WIN;
+            }
+          }
+        }
+        child[i] = sq[i];
+      }
+      return UNKNOWN;
+    }
+
+    // The weak side to move: a win if every move loses.
+    Bitboard targets = KingAttacks(wk) & ~attacks;
+    if (!targets) {
+      // checkmate or stalemate
+      return (attacks & SquareBit(wk)) ? WIN : DRAW;
+    }
+    if (targets & strong) {
+      // Capturing an undefended piece leaves too little to win.
+      return DRAW;
+    }
+    while (targets) {
+      child[1] = PopLsb(&targets);
+      if ((state[Encode(pieces, STRONG, child)] & ~FRESH) != WIN) {
+        return UNKNOWN;
+      }
+    }
+    return WIN;
+  }
+
+  // Marks the predecessors of a won position that it proves won: any
+  // position of the strong side moving into it, and positions of the weak
+  // side all of whose moves are now known to lose.
+  void Bitbase::VisitPredecessors(size_t index, vector<uint8_t>* state,
+                                  const Bitbase* bitbases) const {
+    const int pieces = 2 + spec_->count;
+    int stm;
+    int sq[4] = { 0, 0, 0, 0 };
+    Decode(pieces, index, &stm, sq);
+    Bitboard occupied = 0;
+    for (int i = 0; i < pieces; ++i) {
+      occupied |= SquareBit(sq[i]);
+    }
+
+    int parent[4];
+    memcpy(parent, sq, sizeof(parent));
+    if (stm == WEAK) {
+      // Take back a move of the strong side. There are no captures to
+      // undo, as the weak side has nothing to lose but its king.
+      for (int i = 0; i < pieces; ++i) {
+        if (i == 1) {
+          continue;
+        }
+        int piece = (i == 0) ? 6 : spec_->pieces[i - 2];
+        Bitboard origins;
+        if (piece == 1) {
+          origins = 0;
+          int one = sq[i] - 8;
+          if (SquareY(sq[i]) >= 2 && !(occupied & SquareBit(one))) {
+            origins |= SquareBit(one);
+            if (SquareY(sq[i]) == 3 && !(occupied & SquareBit(one - 8))) {
+              origins |= SquareBit(one - 8);
+            }
+          }
+        } else {
+          origins = PieceAttacks(piece, sq[i], occupied) & ~occupied;
+        }
+        while (origins) {
+          parent[i] = PopLsb(&origins);
+          uint8_t& s = (*state)[Encode(pieces, STRONG, parent)];
+          if (s == UNKNOWN) {
+            s = WIN | FRESH;
+          }
+        }
+        parent[i] = sq[i];
+      }
+    } else {
+      // Take back a move of the weak king.
+      Bitboard origins = KingAttacks(sq[1]) & ~occupied;
+      while (origins) {
+        parent[1] = PopLsb(&origins);
+        size_t parent_index = Encode(pieces, WEAK, parent);
+        uint8_t& s = (*state)[parent_index];
+        if (s == UNKNOWN && Classify(parent_index, *state, bitbases) == WIN) {
+          s = WIN | FRESH;
+        }
+      }
+    }
+  }
+
+  // Retrograde analysis. Every position is classified once from its own
+  // moves (mates, stalemates, captures, promotions), then wins are
+  // propagated back to their predecessors until none is left. Positions
+  // that are not won then are drawn.
+  void Bitbase::Generate(const Bitbase* bitbases) {
+    Unmap();
+    vector<uint8_t> state(size_, UNKNOWN);
+    for (size_t i = 0; i < size_; ++i) {
+      int s = Classify(i, state, bitbases);
+      state[i] = (s == WIN) ? (WIN | FRESH) : s;
+    }
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t i = 0; i < size_; ++i) {
+        if (state[i] & FRESH) {
+          state[i] &= ~FRESH;
+          VisitPredecessors(i, &state, bitbases);
+          changed = true;
+        }
+      }
+    }
+    storage_.assign(size_ / 8, 0);
+    for (size_t i = 0; i < size_; ++i) {
+      if (state[i] == WIN) {
+        storage_[i >> 3] |= 1 << (i & 7);
+      }
+    }
+    bits_ = &storage_[0];
+  }
+
+  bool Bitbase::Load(const string& path) {
+    Unmap();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    size_t expected = HEADER_SIZE + size_ / 8;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != expected) {
+      close(fd);
+      return false;
+    }
+    void* data = mmap(NULL, expected, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      return false;
+    }
+    if (memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+      munmap(data, expected);
+      return false;
+    }
+    mapped_ = data;
+    mapped_size_ = expected;
+    bits_ = static_cast<const uint8_t*>(data) + HEADER_SIZE;
+    return true;
+  }
+
+  bool Bitbase::Save(const string& path) const {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+      return false;
+    }
+    char header[HEADER_SIZE] = { 0 };
+    memcpy(header, MAGIC, sizeof(MAGIC));
+    bool ok = fwrite(header, 1, HEADER_SIZE, file) == HEADER_SIZE &&
+    fwrite(bits_, 1, size_ / 8, file) == size_ / 8;
+    return fclose(file) == 0 && ok;
+  }
+
+  void Bitbase::Unmap() {
+    if (mapped_) {
+      munmap(mapped_, mapped_size_);
+      mapped_ = NULL;
+      mapped_size_ = 0;
+    }
+    storage_.clear();
+    bits_ = NULL;
+  }
+
+  const Bitbase* FindBitbase(const string& name) {
+    for (int i = 0; i < ENDGAME_COUNT; ++i) {
+      if (name == ENDGAMES[i].name) {
+        return &bitbases[i];
+      }
+    }
+    return NULL;
+  }
+
+}  // namespace
+
+void InitBitbases(const string& dir) {
+  for (int i = 0; i < ENDGAME_COUNT; ++i) {
+    Bitbase& bitbase = bitbases[i];
+    bitbase.set_spec(&ENDGAMES[i]);
+    string path = dir.empty() ? "" : dir + "/" + ENDGAMES[i].name + ".bb";
+    if (!path.empty() && bitbase.Load(path)) {
+      continue;
+    }
+    if (path.empty() && ENDGAMES[i].count > 1) {
+      // Too slow to build on every start without a place to keep it.
+      continue;
+    }
+    bitbase.Generate(bitbases);
+    if (!path.empty() && !bitbase.Save(path)) {
+      cerr << "Cannot save " << path << endl;
+    }
+  }
+}
+
+bool ProbeBitbase(const Position& pos, int* result) {
+  int white = pos.piece_count(WHITE);
+  int black = pos.piece_count(BLACK);
+  if (white + black > 4 || (white > 1 && black > 1)) {
+    return false;
+  }
+  if (white + black == 2) {
+    *result = 0;
+    return true;
+  }
+  // The strong side plays white in the index.
+  int strong = (white > 1) ? WHITE : BLACK;
+  int flip = (strong == WHITE) ? 0 : 56;
+  int sq[4];
+  int types[2] = { 0, 0 };
+  int count = 0;
+  for (int s = 0; s < 64; ++s) {
+    int p = pos.get_board(SquareX(s), SquareY(s)) * strong;
+    if (p == 6) {
+      sq[0] = s ^ flip;
+    } else if (p == -6) {
+      sq[1] = s ^ flip;
+    } else if (p > 0) {
+      // by decreasing value
+      if (count == 1 && p > types[0]) {
+        types[1] = types[0];
+        sq[3] = sq[2];
+        types[0] = p;
+        sq[2] = s ^ flip;
+      } else {
+        types[count] = p;
+        sq[2 + count] = s ^ flip;
+      }
+      ++count;
+    } else if (p < 0) {
+      return false;
+    }
+  }
+  for (int i = 0; i < ENDGAME_COUNT; ++i) {
+    const EndgameSpec& spec = ENDGAMES[i];
+    if (spec.count == count && spec.pieces[0] == types[0] &&
+        (count == 1 || spec.pieces[1] == types[1])) {
+      if (!bitbases[i].loaded()) {
+        return false;
+      }
+      int stm = (pos.side() == strong) ? STRONG : WEAK;
+      bool win = bitbases[i].IsWin(Encode(2 + count, stm, sq));
+      *result = !win ? 0 : (stm == STRONG ? 1 : -1);
+      return true;
+    }
+  }
+  return false;
+}
+
+int BitbaseWinScore(const Position& pos) {
+  int strong = (pos.piece_count(WHITE) > 1) ? WHITE : BLACK;
+  int sk = pos.king_square(strong);
+  int wk = pos.king_square(-strong);
+  int wx = SquareX(wk);
+  int wy = SquareY(wk);
+  // Bring the kings together and drive the weak king to the edge.
+  int distance = max(abs(SquareX(sk) - wx), abs(SquareY(sk) - wy));
+  int edge = min(min(wx, 7 - wx), min(wy, 7 - wy));
+  int bonus = 2 * (7 - distance) + 8 * (3 - edge);
+  for (int s = 0; s < 64; ++s) {
+    int p = pos.get_board(SquareX(s), SquareY(s)) * strong;
+    if (p == 1) {
+      // Push the pawn.
+      int rank = (strong == WHITE) ? SquareY(s) : 7 - SquareY(s);
+      bonus += 8 * rank;
+    } else if (p == 3) {
+      // Mate with bishop and knight needs a corner of the bishop's color.
+      int corner;
+      if (((SquareX(s) + SquareY(s)) & 1) == 0) {
+        // a1 and h8
+        corner = min(max(wx, wy), max(7 - wx, 7 - wy));
+      } else {
+        // a8 and h1
+        corner = min(max(wx, 7 - wy), max(7 - wx, wy));
+      }
+      bonus += 4 * (7 - corner);
+    }
+  }
+  return KNOWN_WIN_SCORE + min(bonus, 99);
+}
+
+size_t BitbaseSize(const string& name) {
+  const Bitbase* bitbase = FindBitbase(name);
+  return (bitbase && bitbase->loaded()) ? bitbase->size() : 0;
+}
+
+size_t BitbaseWins(const string& name) {
+  const Bitbase* bitbase = FindBitbase(name);
+  if (!bitbase || !bitbase->loaded()) {
+    return 0;
+  }
+  size_t wins = 0;
+  for (size_t i = 0; i < bitbase->size(); ++i) {
+    wins += bitbase->IsWin(i);
+  }
+  return wins;
+}
@@ -0,0 +1,46 @@
+//
+//  claude_bitbase.h
+//  Win/draw bitbases of small endgames: KQK, KRK, KPK and KBNK.
+//
+//  A bitbase has one bit per position, set if the side with the extra
+//  pieces wins. Positions are indexed by the side to move and the squares
+//  of the strong king, the weak king and the extra pieces, with the strong
+//  side playing white. The bitbases are built by retrograde analysis; they
+//  can be written to a directory and mapped from there on the next run.
+//
+
+#ifndef game_claude_bitbase_h
+#define game_claude_bitbase_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "claude.h"
+
+// Builds the bitbases, or maps them from files in dir if they were saved
+// there before. If dir is not empty, built bitbases are saved to it;
+// otherwise KBNK, which takes seconds to build, is left out.
+// Must be called before searching from several threads.
+void InitBitbases(const string& dir);
+
+// Probes the bitbases. Returns true if pos is covered and sets *result to
+// 1 if the side to move wins, -1 if it loses and 0 for a draw.
+bool ProbeBitbase(const Position& pos, int* result);
+
+// Scores of won positions lie between KNOWN_WIN_SCORE and
+// KNOWN_WIN_SCORE + 99, below mates and above any material balance.
+const int KNOWN_WIN_SCORE = 20000;
+
+// Score of a position that ProbeBitbase found won, for the winning side:
+// KNOWN_WIN_SCORE plus a bonus for progress toward the mate or the
+// promotion, so that the search makes some.
+int BitbaseWinScore(const Position& pos);
+
+// Number of positions (bits) and wins of the bitbase of the given name
+// ("KPK", ...), for testing; 0 if it is not loaded.
+size_t BitbaseSize(const string& name);
+size_t BitbaseWins(const string& name);
+
+#endif  // game_claude_bitbase_h
@@ -0,0 +1,153 @@
+//
+//  claude_bitboard.cc
+//  Attack tables on 64-bit bitboards.
+//
+
+#include "claude_bitboard.h"
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+namespace {
+  
+  // Rook directions (N, E, S, W) followed by bishop directions (NE, SE, SW, NW).
+  const int DX[8] = { 0, 1,  0, -1, 1,  1, -1, -1 };
+  const int DY[8] = { 1, 0, -1,  0, 1, -1, -1,  1 };
+  
+  Bitboard knight_attacks[64];
+  Bitboard king_attacks[64];
+  Bitboard pawn_attacks[2][64];
+  
+  // Squares from sq to the edge of the board in each direction.
+  Bitboard rays[8][64];
+  
+  Bitboard Offset(int x, int y, int dx, int dy) {
+    x += dx;
+    y += dy;
+    if (x >= 0 && x < 8 && y >= 0 && y < 8) {
+      return SquareBit(MakeSquare(x, y));
+    }
+    return 0;
+  }
+  
+  // Attacks of a slider along the rays [first_dir, first_dir + 4).
+  Bitboard RayAttacks(int sq, Bitboard occupied, int first_dir) {
+    Bitboard attacks = 0;
+    for (int dir = first_dir; dir < first_dir + 4; ++dir) {
+      Bitboard blockers = rays[dir][sq] & occupied;
+      if (blockers == 0) {
+        attacks |= rays[dir][sq];
+        continue;
+      }
+      // N, E, NE and NW go toward higher squares.
+      bool up = (DY[dir] > 0) || (DY[dir] == 0 && DX[dir] > 0);
+      int blocker = up ? __builtin_ctzll(blockers) : 63 - __builtin_clzll(blockers);
+      attacks |= rays[dir][sq] ^ rays[dir][blocker];
+    }
+    return attacks;
+  }
+  
+#ifdef __BMI2__
+  
+  // Attacks indexed by PEXT of the occupancy over the relevant squares.
+  Bitboard rook_masks[64];
+  Bitboard bishop_masks[64];
+  Bitboard* rook_table[64];
+  Bitboard* bishop_table[64];
+  Bitboard rook_storage[0x19000];
+  Bitboard bishop_storage[0x1480];
+  
+  // Ray squares excluding the board edge; pieces there do not block anything.
+  Bitboard RelevantMask(int sq, int first_dir) {
+    Bitboard mask = 0;
+    for (int dir = first_dir; dir < first_dir + 4; ++dir) {
+      int x = SquareX(sq) + DX[dir];
+      int y = SquareY(sq) + DY[dir];
+      while (x + DX[dir] >= 0 && x + DX[dir] < 8 &&
+             y + DY[dir] >= 0 && y + DY[dir] < 8) {
+        mask |= SquareBit(MakeSquare(x, y));
+        x += DX[dir];
+        y += DY[dir];
+      }
+    }
+    return mask;
+  }
+  
+  void InitSliderTable(int first_dir, Bitboard* masks, Bitboard** table, Bitboard* storage) {
+    for (int sq = 0; sq < 64; ++sq) {
+      masks[sq] = RelevantMask(sq, first_dir);
+      table[sq] = storage;
+      // Enumerate all subsets of the mask (Carry-Rippler).
+      Bitboard occupied = 0;
+      do {
+        table[sq][_pext_u64(occupied, masks[sq])] = RayAttacks(sq, occupied, first_dir);
+        occupied = (occupied - masks[sq]) & masks[sq];
+      } while (occupied);
+      storage += 1ULL << PopCount(masks[sq]);
+    }
+  }
+  
+#endif
+  
+  class AttackTables {
+  public:
+    AttackTables() {
+      const int KNIGHT_DX[8] = { 1, 2, 2, 1, -1, -2, -2, -1 };
+      const int KNIGHT_DY[8] = { 2, 1, -1, -2, -2, -1, 1, 2 };
+      for (int sq = 0; sq < 64; ++sq) {
+        int x = SquareX(sq);
+        int y = SquareY(sq);
+        knight_attacks[sq] = 0;
+        king_attacks[sq] = 0;
+        for (int i = 0; i < 8; ++i) {
+          knight_attacks[sq] |= Offset(x, y, KNIGHT_DX[i], KNIGHT_DY[i]);
+          king_attacks[sq] |= Offset(x, y, DX[i], DY[i]);
+        }
+        pawn_attacks[0][sq] = Offset(x, y, -1, -1) | Offset(x, y, 1, -1);
+        pawn_attacks[1][sq] = Offset(x, y, -1, 1) | Offset(x, y, 1, 1);
+        for (int dir = 0; dir < 8; ++dir) {
+          rays[dir][sq] = 0;
+          for (int i = 1; i < 8; ++i) {
+            rays[dir][sq] |= Offset(x, y, DX[dir] * i, DY[dir] * i);
+          }
+        }
+      }
+#ifdef __BMI2__
+      InitSliderTable(0, rook_masks, rook_table, rook_storage);
+      InitSliderTable(4, bishop_masks, bishop_table, bishop_storage);
+#endif
+    }
+  };
+  
+  AttackTables attack_tables;
+  
+}  // namespace
+
+Bitboard KnightAttacks(int sq) {
+  return knight_attacks[sq];
+}
+
+Bitboard KingAttacks(int sq) {
+  return king_attacks[sq];
+}
+
+Bitboard PawnAttacks(int side, int sq) {
+  return pawn_attacks[side > 0][sq];
+}
+
+Bitboard BishopAttacks(int sq, Bitboard occupied) {
+#ifdef __BMI2__
+  return bishop_table[sq][_pext_u64(occupied, bishop_masks[sq])];
+#else
+  return RayAttacks(sq, occupied, 4);
+#endif
+}
+
+Bitboard RookAttacks(int sq, Bitboard occupied) {
+#ifdef __BMI2__
+  return rook_table[sq][_pext_u64(occupied, rook_masks[sq])];
+#else
+  return RayAttacks(sq, occupied, 0);
+#endif
+}
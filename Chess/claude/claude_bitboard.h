@@ -0,0 +1,44 @@
+//
+//  claude_bitboard.h
+//  Attack tables on 64-bit bitboards.
+//
+//  Squares are numbered 0 (a1) to 63 (h8), i.e. y * 8 + x.
+//  Sliding piece attacks are looked up with BMI2 PEXT when it is available
+//  (compile with -mbmi2), otherwise they are computed from ray masks.
+//
+
+#ifndef game_claude_bitboard_h
+#define game_claude_bitboard_h
+
+#include <stdint.h>
+
+typedef uint64_t Bitboard;
+
+inline int MakeSquare(int x, int y) { return y * 8 + x; }
+inline int SquareX(int sq) { return sq & 7; }
+inline int SquareY(int sq) { return sq >> 3; }
+inline Bitboard SquareBit(int sq) { return 1ULL << sq; }
+
+// Returns the index of the least significant bit and clears it.
+inline int PopLsb(Bitboard* b) {
+  int sq = __builtin_ctzll(*b);
+  *b &= *b - 1;
+  return sq;
+}
+
+inline int PopCount(Bitboard b) { return __builtin_popcountll(b); }
+
+Bitboard KnightAttacks(int sq);
+Bitboard KingAttacks(int sq);
+
+// Squares attacked by a pawn of the given side (1: white, -1: black).
+Bitboard PawnAttacks(int side, int sq);
+
+Bitboard BishopAttacks(int sq, Bitboard occupied);
+Bitboard RookAttacks(int sq, Bitboard occupied);
+
+inline Bitboard QueenAttacks(int sq, Bitboard occupied) {
+  return BishopAttacks(sq, occupied) | RookAttacks(sq, occupied);
+}
+
+#endif  // game_claude_bitboard_h
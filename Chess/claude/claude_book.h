@@ -0,0 +1,69 @@
+//
+//  claude_book.h
+//  Polyglot opening books.
+//
+//  A Polyglot book is a file of 16-byte big-endian entries sorted by the
+//  key of their position: key (64 bits), move (16), weight (16) and learn
+//  (32). The file is mapped into memory and searched in place.
+//
+
+#ifndef game_claude_book_h
+#define game_claude_book_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "claude.h"
+
+// Zobrist key of a position with the Polyglot layout: pieces, castling
+// rights, the en passant file if a capture is possible, and white to move.
+uint64_t PolyglotKey(const Position& pos);
+
+// Polyglot move encoding; castling is written as the king taking its rook.
+uint16_t EncodePolyglotMove(const Position& pos, const Move& move);
+// Returns false if the move is not legal in pos.
+bool DecodePolyglotMove(const Position& pos, uint16_t code, Move* move);
+
+struct BookEntry {
+  uint64_t key;
+  uint16_t move;
+  uint16_t weight;
+  uint32_t learn;
+};
+
+class PolyglotBook {
+public:
+  PolyglotBook();
+  ~PolyglotBook();
+
+  // Maps the book file; closes the book opened before. Returns false if the
+  // file cannot be mapped or its size is not a multiple of 16 bytes.
+  bool Open(const string& path);
+  void Close();
+  bool is_open() const { return data_ != NULL; }
+  size_t size() const { return size_; }
+
+  // Entries of the position, in file order.
+  void Find(uint64_t key, vector<BookEntry>* entries) const;
+
+  // Picks a legal book move of pos at random, weighted by the entry
+  // weights. Returns false if pos is not in the book.
+  bool Probe(const Position& pos, Move* move);
+
+  void set_seed(unsigned int seed) { seed_ = seed; }
+
+private:
+  BookEntry Entry(size_t i) const;
+
+  const unsigned char* data_;
+  size_t size_;
+  size_t mapped_size_;
+  unsigned int seed_;
+
+  DISALLOW_COPY_AND_ASSIGN(PolyglotBook);
+};
+
+#endif  // game_claude_book_h
@@ -0,0 +1,266 @@
+//
+//  claude_book_builder.cc
+//  Builds Polyglot opening books from PGN files.
+//
+
+#include "claude_book_builder.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <stdio.h>
+
+#include "claude_book.h"
+#include "claude_pgn.h"
+#include "claude_san.h"
+
+namespace {
+
+  // Statistics of a move in a position; also the record of the run files.
+  struct MoveStats {
+    uint64_t key;
+    uint32_t games;
+    // Two points per win and one per draw of the side making the move.
+    uint32_t score;
+    uint16_t move;
+  };
+
+  bool operator<(const MoveStats& lhs, const MoveStats& rhs) {
+    return lhs.key < rhs.key || (lhs.key == rhs.key && lhs.move < rhs.move);
+  }
+
+  bool IsSameMove(const MoveStats& lhs, const MoveStats& rhs) {
+    return lhs.key == rhs.key && lhs.move == rhs.move;
+  }
+
+  bool HigherScore(const MoveStats& lhs, const MoveStats& rhs) {
+    return lhs.score > rhs.score;
+  }
+
+  // Open addressing hash table of MoveStats. Spills its contents as a
+  // sorted run to a temporary file when three quarters full.
+  class StatsTable {
+  public:
+    explicit StatsTable(int capacity) : size_(0) {
+      int n = 1;
+      while (n < capacity) {
+        n *= 2;
+      }
+      slots_.resize(n);
+      mask_ = n - 1;
+      Reset();
+    }
+
+    ~StatsTable() {
+      for (size_t i = 0; i < runs_.size(); ++i) {
+        fclose(runs_[i]);
+      }
+    }
+
+    bool Add(uint64_t key, uint16_t move, int score) {
+      size_t i = (key ^ (move * 0x9e3779b97f4a7c15ULL)) & mask_;
+      while (slots_[i].games != 0 &&
+             (slots_[i].key != key || slots_[i].move != move)) {
+        i = (i + 1) & mask_;
+      }
+      MoveStats& slot = slots_[i];
+      if (slot.games == 0) {
+        slot.key = key;
+        slot.move = move;
+        ++size_;
+      }
+      ++slot.games;
+      slot.score += score;
+      if (size_ * 4 > slots_.size() * 3) {
+        return Spill();
+      }
+      return true;
+    }
+
+    // Writes the table as a sorted run and clears it.
+    bool Spill() {
+      if (size_ == 0) {
+        return true;
+      }
+      vector<MoveStats> run;
+      run.reserve(size_);
+      for (size_t i = 0; i < slots_.size(); ++i) {
+        if (slots_[i].games != 0) {
+          run.push_back(slots_[i]);
+        }
+      }
+      sort(run.begin(), run.end());
+      FILE* file = tmpfile();
+      if (!file ||
+          fwrite(&run[0], sizeof(MoveStats), run.size(), file) != run.size()) {
+        cerr << "Cannot write a temporary run" << endl;
+        if (file) {
+          fclose(file);
+        }
+        return false;
+      }
+      rewind(file);
+      runs_.push_back(file);
+      Reset();
+      return true;
+    }
+
+    const vector<FILE*>& runs() const { return runs_; }
+
+  private:
+    void Reset() {
+      MoveStats empty = { 0, 0, 0, 0 };
+      fill(slots_.begin(), slots_.end(), empty);
+      size_ = 0;
+    }
+
+    vector<MoveStats> slots_;
+    size_t mask_;
+    size_t size_;
+    vector<FILE*> runs_;
+  };
+
+  void WriteBigEndian(uint64_t n, int bytes, FILE* file) {
+    for (int i = bytes - 1; i >= 0; --i) {
+      fputc(static_cast<int>((n >> (8 * i)) & 0xff), file);
+    }
+  }
+
+  // Writes the moves of one position, best first, with their scores scaled
+  // into 16-bit weights. Returns the number of entries written.
+  int WritePosition(vector<MoveStats>* moves, const BookBuildOptions& options,
+                    FILE* book) {
+    stable_sort(moves->begin(), moves->end(), HigherScore);
+    uint32_t max_score = moves->empty() ? 0 : (*moves)[0].score;
+    int written = 0;
+    for (size_t i = 0; i < moves->size(); ++i) {
+      const MoveStats& m = (*moves)[i];
+      if (static_cast<int>(m.games) < options.min_games || m.score == 0) {
+        continue;
+      }
+      uint64_t weight = m.score;
+      if (max_score > 0xffff) {
+        weight = max<uint64_t>(1, weight * 0xffff / max_score);
+      }
+      WriteBigEndian(m.key, 8, book);
+      WriteBigEndian(m.move, 2, book);
+      WriteBigEndian(weight, 2, book);
+      WriteBigEndian(0, 4, book);
+      ++written;
+    }
+    moves->clear();
+    return written;
+  }
+
+  // Merges the sorted runs into the book, adding up equal moves.
+  long long MergeRuns(const vector<FILE*>& runs, const BookBuildOptions& options,
+                      FILE* book) {
+    vector<MoveStats> heads(runs.size());
+    vector<bool> live(runs.size());
+    for (size_t i = 0; i < runs.size(); ++i) {
+      live[i] = fread(&heads[i], sizeof(MoveStats), 1, runs[i]) == 1;
+    }
+
+    long long written = 0;
+    vector<MoveStats> position;
+    while (1) {
+      // The smallest head; there are few runs, so a linear scan will do.
+      int min_run = -1;
+      for (size_t i = 0; i < runs.size(); ++i) {
+        if (live[i] && (min_run < 0 || heads[i] < heads[min_run])) {
+          min_run = i;
+        }
+      }
+      if (min_run < 0) {
+        break;
+      }
+      const MoveStats& m = heads[min_run];
+      if (!position.empty() && position.back().key != m.key) {
+        written += WritePosition(&position, options, book);
+      }
+      if (!position.empty() && IsSameMove(position.back(), m)) {
+        position.back().games += m.games;
+        position.back().score += m.score;
+      } else {
+        position.push_back(m);
+      }
+      live[min_run] = fread(&heads[min_run], sizeof(MoveStats), 1, runs[min_run]) == 1;
+    }
+    written += WritePosition(&position, options, book);
+    return written;
+  }
+
+}  // namespace
+
+long long BuildBook(const vector<string>& pgn_paths, const string& book_path,
+                    const BookBuildOptions& options) {
+  StatsTable table(options.memory_entries);
+  PgnGame game;
+  long long games = 0;
+  long long skipped = 0;
+  for (size_t i = 0; i < pgn_paths.size(); ++i) {
+    FILE* file = fopen(pgn_paths[i].c_str(), "rb");
+    if (!file) {
+      cerr << "Cannot open " << pgn_paths[i] << endl;
+      return -1;
+    }
+    PgnReader reader(file);
+    while (reader.Next(&game)) {
+      // Points of white; games without a result are not counted.
+      int white_score;
+      if (game.result == "1-0") {
+        white_score = 2;
+      } else if (game.result == "0-1") {
+        white_score = 0;
+      } else if (game.result == "1/2-1/2") {
+        white_score = 1;
+      } else {
+        ++skipped;
+        continue;
+      }
+      Position pos;
+      string fen = game.Tag("FEN");
+      if (fen.empty()) {
+        pos.StartPosition();
+      } else if (!Position::ParseFen(fen, &pos)) {
+        ++skipped;
+        continue;
+      }
+      int plies = min<int>(game.moves.size(), options.max_ply);
+      for (int ply = 0; ply < plies; ++ply) {
+        Move move;
+        if (!ParseSan(pos, game.moves[ply], &move)) {
+          // Keep the moves up to the error.
+          break;
+        }
+        int score = (pos.side() == WHITE) ? white_score : 2 - white_score;
+        if (!table.Add(PolyglotKey(pos), EncodePolyglotMove(pos, move), score)) {
+          fclose(file);
+          return -1;
+        }
+        Position next_pos;
+        pos.DoMove(move, &next_pos);
+        pos = next_pos;
+      }
+      ++games;
+    }
+    fclose(file);
+  }
+  if (!table.Spill()) {
+    return -1;
+  }
+
+  FILE* book = fopen(book_path.c_str(), "wb");
+  if (!book) {
+    cerr << "Cannot create " << book_path << endl;
+    return -1;
+  }
+  long long entries = MergeRuns(table.runs(), options, book);
+  if (fclose(book) != 0) {
+    cerr << "Cannot write " << book_path << endl;
+    return -1;
+  }
+  cout << games << " games (" << skipped << " without result or position), "
+  << table.runs().size() << " runs, " << entries << " book entries" << endl;
+  return entries;
+}
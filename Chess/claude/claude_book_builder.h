@@ -0,0 +1,39 @@
+//
+//  claude_book_builder.h
+//  Builds Polyglot opening books from PGN files.
+//
+//  The games are streamed and replayed; the results of every (position,
+//  move) pair are counted in a hash table of bounded size. When it fills
+//  up it is written to a temporary file as a sorted run, and all runs are
+//  merged into the book at the end.
+//
+//  Positions are keyed with PolyglotKey, so the books can be read by any
+//  Polyglot tool.
+//
+
+#ifndef game_claude_book_builder_h
+#define game_claude_book_builder_h
+
+#include <string>
+#include <vector>
+
+#include "claude.h"
+
+struct BookBuildOptions {
+  BookBuildOptions() : max_ply(32), min_games(2), memory_entries(1 << 22) {}
+
+  // Plies of each game entered into the book.
+  int max_ply;
+  // Moves played in fewer games are left out.
+  int min_games;
+  // Capacity of the in-memory table (24 bytes per entry).
+  int memory_entries;
+};
+
+// Builds the book at book_path from the games of the PGN files. The weight
+// of a move is twice its wins plus its draws. Returns the number of book
+// entries, or -1 on error.
+long long BuildBook(const vector<string>& pgn_paths, const string& book_path,
+                    const BookBuildOptions& options);
+
+#endif  // game_claude_book_builder_h
@@ -0,0 +1,309 @@
+//
+//  claude_datagen.cc
+//  Training data from self-play.
+//
+
+#include "claude_datagen.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "claude_bitboard.h"
+#include "claude_tournament.h"
+#include "claude_tt.h"
+
+namespace {
+
+  const int MATE_RECORD_SCORE = 32000;
+  const int MAX_RECORD_SCORE = 30000;
+  const int RESULT_SHIFT = 5;
+  // Nibble of a pawn that can be taken en passant.
+  const int EN_PASSANT_PAWN = 7;
+
+  // Records read at a time by LoadTrainingData.
+  const size_t READ_BLOCK = 4096;
+
+  int RecordScore(int score) {
+    if (score > MATE_SCORE - 1000) {
+      return MATE_RECORD_SCORE - (MATE_SCORE - score);
+    }
+    if (score < -(MATE_SCORE - 1000)) {
+      return -MATE_RECORD_SCORE + (MATE_SCORE + score);
+    }
+    return max(-MAX_RECORD_SCORE, min(score, MAX_RECORD_SCORE));
+  }
+
+  struct Generator {
+    const DatagenOptions* options;
+    FILE* file;
+    // Guards the file.
+    pthread_mutex_t mutex;
+    bool failed;
+    volatile int next_game;
+    volatile int finished_games;
+    volatile long long records;
+    double start;
+  };
+
+  void Flush(Generator* generator, vector<TrainingRecord>* buffer) {
+    if (buffer->empty()) {
+      return;
+    }
+    pthread_mutex_lock(&generator->mutex);
+    if (fwrite(&(*buffer)[0], sizeof(TrainingRecord), buffer->size(), generator->file) !=
+        buffer->size()) {
+      generator->failed = true;
+    }
+    pthread_mutex_unlock(&generator->mutex);
+    buffer->clear();
+  }
+
+  // Plays the game of the given index and sets *records to its searched
+  // positions. Returns the result for white.
+  int PlayGame(const DatagenOptions& options, int game, TranspositionTable* tt,
+               vector<TrainingRecord>* records) {
+    records->clear();
+    // Each game has its opening, whatever the thread playing it.
+    RandomPlayer random_player;
+    random_player.set_seed(game + 1);
+    MinMaxPlayer player(options.depth);
+    player.set_hash_table(tt);
+    Position start;
+    start.StartPosition();
+    vector<Position> history(1, start);
+    while (1) {
+      int result = GameResult(history, options.max_plies, NULL);
+      if (result != GAME_ONGOING) {
+        return result;
+      }
+
+      const Position& pos = history.back();
+      Move move;
+      if (static_cast<int>(history.size()) <= options.random_plies) {
+        random_player.NextMove(history.back(), &move);
+      } else {
+        player.NextMove(history.back(), &move);
+        TrainingRecord record;
+        PackTrainingRecord(pos, player.score(), move, 0, &record);
+        records->push_back(record);
+      }
+      Position next_pos;
+      pos.DoMove(move, &next_pos);
+      history.push_back(next_pos);
+    }
+  }
+
+  void* Worker(void* arg) {
+    Generator* generator = static_cast<Generator*>(arg);
+    const DatagenOptions& options = *generator->options;
+    TranspositionTable tt;
+    tt.Resize(options.hash_megabytes);
+    // Whole games are buffered, so a game always fits.
+    size_t capacity = max(options.buffer_records, options.max_plies);
+    vector<TrainingRecord> buffer;
+    buffer.reserve(capacity);
+    vector<TrainingRecord> game;
+    int index;
+    while ((index = __sync_fetch_and_add(&generator->next_game, 1)) < options.games) {
+      int result = PlayGame(options, index, &tt, &game);
+      for (size_t i = 0; i < game.size(); ++i) {
+        game[i].flags |= result << RESULT_SHIFT;
+      }
+      if (buffer.size() + game.size() > capacity) {
+        Flush(generator, &buffer);
+      }
+      buffer.insert(buffer.end(), game.begin(), game.end());
+      __sync_fetch_and_add(&generator->records, static_cast<long long>(game.size()));
+      int finished = __sync_add_and_fetch(&generator->finished_games, 1);
+      if (finished % 100 == 0) {
+        double elapsed = GetTime() - generator->start;
+        long long records = generator->records;
+        printf("games=%d records=%lld records/hour=%lld\n", finished, records,
+               static_cast<long long>(records / elapsed * 3600));
+        fflush(stdout);
+      }
+    }
+    Flush(generator, &buffer);
+    return NULL;
+  }
+
+}  // namespace
+
+void PackTrainingRecord(const Position& pos, int score, const Move& move, int result,
+                        TrainingRecord* record) {
+  memset(record, 0, sizeof(*record));
+  // The pawn that moved two squares.
+  int en_passant_pawn = -1;
+  if (pos.en_passant_square() >= 0) {
+    en_passant_pawn = pos.en_passant_square() + ((pos.side() == WHITE) ? -8 : 8);
+  }
+  int count = 0;
+  for (int sq = 0; sq < 64; ++sq) {
+    int p = pos.get_board(SquareX(sq), SquareY(sq));
+    if (p == 0) {
+      continue;
+    }
+    record->occupancy |= 1ULL << sq;
+    int code = (sq == en_passant_pawn) ? EN_PASSANT_PAWN : (p > 0) ? p : -p;
+    if (p < 0) {
+      code += 8;
+    }
+    record->pieces[count / 2] |= code << (4 * (count & 1));
+    ++count;
+  }
+  record->flags = (pos.side() == BLACK) | (pos.castling() << 1) | (result << RESULT_SHIFT);
+  record->halfmove_clock = pos.halfmove_clock();
+  record->score = RecordScore(score);
+  int promotion = (move.piece() > 0) ? move.piece() : -move.piece();
+  record->move = MakeSquare(move.from_x(), move.from_y()) |
+  (MakeSquare(move.to_x(), move.to_y()) << 6) | (promotion << 12);
+  record->fullmove_counter = pos.fullmove_counter();
+}
+
+bool UnpackTrainingRecord(const TrainingRecord& record, Position* pos, Move* move) {
+  // Through a FEN, which checks the position.
+  const char* PIECE_MARK = ".PNBRQKP.pnbrqkp";
+  // Pieces are in square order, FENs start at a8.
+  int codes[64];
+  int en_passant = -1;
+  int count = 0;
+  for (int sq = 0; sq < 64; ++sq) {
+    codes[sq] = 0;
+    if (!(record.occupancy & (1ULL << sq))) {
+      continue;
+    }
+    if (count == 32) {
+      return false;
+    }
+    codes[sq] = (record.pieces[count / 2] >> (4 * (count & 1))) & 15;
+    if ((codes[sq] & 7) == EN_PASSANT_PAWN) {
+      if (en_passant >= 0) {
+        return false;
+      }
+      // The square the pawn passed.
+      en_passant = sq + ((codes[sq] < 8) ? -8 : 8);
+    }
+    ++count;
+  }
+  char fen[Position::FEN_BUFFER_SIZE];
+  char* out = fen;
+  for (int y = 7; y >= 0; --y) {
+    int empty = 0;
+    for (int x = 0; x < 8; ++x) {
+      int code = codes[MakeSquare(x, y)];
+      if (code == 0) {
+        ++empty;
+        continue;
+      }
+      if (empty > 0) {
+        *out++ = '0' + empty;
+        empty = 0;
+      }
+      *out++ = PIECE_MARK[code];
+    }
+    if (empty > 0) {
+      *out++ = '0' + empty;
+    }
+    *out++ = (y > 0) ? '/' : ' ';
+  }
+  int side = (record.flags & 1) ? BLACK : WHITE;
+  *out++ = (side == WHITE) ? 'w' : 'b';
+  *out++ = ' ';
+  int castling = (record.flags >> 1) & 15;
+  const char* CASTLING_MARK = "KQkq";
+  for (int i = 0; i < 4; ++i) {
+    if (castling & (1 << i)) {
+      *out++ = CASTLING_MARK[i];
+    }
+  }
+  if (castling == 0) {
+    *out++ = '-';
+  }
+  *out++ = ' ';
+  if (en_passant >= 0) {
+    *out++ = 'a' + SquareX(en_passant);
+    *out++ = '1' + SquareY(en_passant);
+  } else {
+    *out++ = '-';
+  }
+  int length = out - fen;
+  length += snprintf(out, sizeof(fen) - length, " %d %d", record.halfmove_clock,
+                     record.fullmove_counter);
+  if (!Position::ParseFen(fen, length, pos)) {
+    return false;
+  }
+  int from = record.move & 63;
+  int to = (record.move >> 6) & 63;
+  int promotion = (record.move >> 12) & 7;
+  *move = Move(SquareX(from), SquareY(from), SquareX(to), SquareY(to), promotion * side);
+  return true;
+}
+
+bool LoadTrainingData(const string& path, vector<LabeledPosition>* positions,
+                      FenFileStats* stats) {
+  double start = GetTime();
+  *stats = FenFileStats();
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+  vector<TrainingRecord> block(READ_BLOCK);
+  size_t n;
+  while ((n = fread(&block[0], sizeof(TrainingRecord), READ_BLOCK, file)) > 0) {
+    for (size_t i = 0; i < n; ++i) {
+      LabeledPosition labeled;
+      Move move;
+      ++stats->lines;
+      int result = block[i].flags >> RESULT_SHIFT;
+      if (UnpackTrainingRecord(block[i], &labeled.pos, &move) && result <= GAME_WIN) {
+        labeled.result = result / 2.0f;
+        positions->push_back(labeled);
+      } else if (stats->errors++ == 0) {
+        stats->first_error_line = stats->lines;
+      }
+    }
+  }
+  bool ok = !ferror(file);
+  fclose(file);
+  stats->seconds = GetTime() - start;
+  return ok;
+}
+
+long long GenerateTrainingData(const string& path, const DatagenOptions& options) {
+  Generator generator;
+  generator.options = &options;
+  generator.file = fopen(path.c_str(), "ab");
+  if (!generator.file) {
+    cerr << "Cannot open " << path << endl;
+    return -1;
+  }
+  pthread_mutex_init(&generator.mutex, NULL);
+  generator.failed = false;
+  generator.next_game = 0;
+  generator.finished_games = 0;
+  generator.records = 0;
+  generator.start = GetTime();
+
+  int threads = max(1, options.threads);
+  vector<pthread_t> workers(threads);
+  for (int i = 0; i < threads; ++i) {
+    pthread_create(&workers[i], NULL, Worker, &generator);
+  }
+  for (int i = 0; i < threads; ++i) {
+    pthread_join(workers[i], NULL);
+  }
+  pthread_mutex_destroy(&generator.mutex);
+  if (fclose(generator.file) != 0 || generator.failed) {
+    cerr << "Cannot write " << path << endl;
+    return -1;
+  }
+  double elapsed = GetTime() - generator.start;
+  printf("games=%d records=%lld time=%.1f records/hour=%lld\n", generator.finished_games,
+         generator.records, elapsed,
+         static_cast<long long>(generator.records / elapsed * 3600));
+  return generator.records;
+}
@@ -0,0 +1,83 @@
+//
+//  claude_datagen.h
+//  Training data from self-play.
+//
+//  Worker threads play games from random openings (RandomPlayer moves),
+//  then with a fixed-depth search for both sides, and record every
+//  searched position with its score, best move and the result of the
+//  game. Each worker collects whole games in a buffer of bounded size and
+//  appends it to the output when full, so the threads rarely meet.
+//
+//  The output is a stream of 32-byte TrainingRecords with no header;
+//  files can be concatenated.
+//
+
+#ifndef game_claude_datagen_h
+#define game_claude_datagen_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "claude.h"
+#include "claude_fen_file.h"
+
+// A position packed into 32 bytes, little-endian.
+struct TrainingRecord {
+  // Squares of the pieces, a1 = bit 0.
+  uint64_t occupancy;
+  // Piece of each occupied square in order, 4 bits each, low nibble
+  // first: 1 to 6 for white pawn to king, 9 to 14 for black. A pawn that
+  // can be taken en passant is 7 (white) or 15 (black).
+  uint8_t pieces[16];
+  // Search score of the side to move in centipawns; mates are
+  // +-(32000 - plies).
+  int16_t score;
+  // Best move: from (bits 0-5), to (6-11), promotion piece (12-14).
+  uint16_t move;
+  uint16_t fullmove_counter;
+  // Bit 0: black to move; bits 1-4: castling rights; bits 5-6: result of
+  // the game for white, 0 loss, 1 draw, 2 win.
+  uint8_t flags;
+  uint8_t halfmove_clock;
+};
+
+COMPILE_ASSERT(sizeof(TrainingRecord) == 32, training_record_is_32_bytes);
+
+// Packs a position with its score, as the search returns it.
+void PackTrainingRecord(const Position& pos, int score, const Move& move, int result,
+                        TrainingRecord* record);
+// Returns false if the record does not hold a legal position.
+bool UnpackTrainingRecord(const TrainingRecord& record, Position* pos, Move* move);
+
+// Reads a file of TrainingRecords as positions labeled with their game
+// results. Returns false if it cannot be read.
+bool LoadTrainingData(const string& path, vector<LabeledPosition>* positions,
+                      FenFileStats* stats);
+
+struct DatagenOptions {
+  DatagenOptions()
+  : threads(1), games(1000), depth(4), random_plies(8), max_plies(400),
+  buffer_records(1 << 16), hash_megabytes(16) {}
+
+  int threads;
+  int games;
+  // Depth of the search of every move after the opening.
+  int depth;
+  // Random moves of the opening; their positions are not recorded.
+  int random_plies;
+  // Longer games are adjudicated as draws.
+  int max_plies;
+  // Records buffered per thread before writing.
+  int buffer_records;
+  // Transposition table of each thread.
+  int hash_megabytes;
+};
+
+// Plays the games and appends their records to the file at path, printing
+// the progress. Returns the number of records written, or -1 on error.
+long long GenerateTrainingData(const string& path, const DatagenOptions& options);
+
+#endif  // game_claude_datagen_h
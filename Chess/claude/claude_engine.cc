@@ -0,0 +1,127 @@
+//
+//  claude_engine.cc
+//  Embeddable engine.
+//
+
+#include "claude_engine.h"
+
+#include <algorithm>
+
+#include "claude_san.h"
+
+Engine::Engine(int hash_megabytes)
+: listener_(NULL),
+stop_(false) {
+  SetStartPosition();
+  ResizeHash(hash_megabytes);
+}
+
+void Engine::NewGame() {
+  tt_.Clear();
+  SetStartPosition();
+}
+
+bool Engine::SetPosition(const string& fen) {
+  Position pos;
+  if (!Position::ParseFen(fen, &pos)) {
+    return false;
+  }
+  history_.assign(1, pos);
+  return true;
+}
+
+void Engine::SetStartPosition() {
+  Position pos;
+  pos.StartPosition();
+  history_.assign(1, pos);
+}
+
+bool Engine::PlayMove(const string& move) {
+  Move m;
+  return ParseSan(position(), move, &m) && PlayMove(m);
+}
+
+bool Engine::PlayMove(const Move& move) {
+  if (!position().IsValidMove(move)) {
+    return false;
+  }
+  Position next_pos;
+  position().DoMove(move, &next_pos);
+  history_.push_back(next_pos);
+  return true;
+}
+
+bool Engine::Search(const SearchLimits& limits, SearchResult* result) {
+  double start = GetTime();
+  stop_ = false;
+  *result = SearchResult();
+  Position pos = position();
+  if (book_.is_open() && book_.Probe(pos, &result->best_move)) {
+    result->found = true;
+    result->from_book = true;
+  } else {
+    int depth = limits.depth;
+    if (depth <= 0) {
+      depth = (limits.seconds > 0 || limits.nodes > 0) ? MAX_DEPTH : DEFAULT_DEPTH;
+    }
+    MinMaxPlayer player(depth);
+    player.set_time_limit(limits.seconds);
+    player.set_node_limit(limits.nodes);
+    player.set_multi_pv(limits.multi_pv);
+    player.set_stop_flag(&stop_);
+    if (tt_.size() > 0) {
+      player.set_hash_table(&tt_);
+    }
+    Relay relay(listener_, &player, start);
+    if (listener_) {
+      player.set_listener(&relay);
+    }
+    result->found = player.NextMove(pos, &result->best_move);
+    result->score = player.score();
+    result->nodes = player.nodes();
+    result->tb_hits = player.tb_hits();
+    result->lines = player.lines();
+  }
+  result->seconds = GetTime() - start;
+  if (listener_) {
+    listener_->OnBestMove(*result);
+  }
+  return result->found;
+}
+
+bool Engine::SolveMate(int moves, long long node_limit, MateResult* result) {
+  stop_ = false;
+  MateSolver solver(max<size_t>(1, tt_.size() * sizeof(TtEntry) >> 20));
+  solver.set_node_limit(node_limit);
+  solver.set_stop_flag(&stop_);
+  return solver.Solve(position(), moves, result);
+}
+
+bool Engine::RandomMove(Move* move) {
+  Position pos = position();
+  return random_player_.NextMove(pos, move);
+}
+
+bool Engine::ResizeHash(int megabytes) {
+  return tt_.Resize(max(megabytes, 0));
+}
+
+bool Engine::OpenBook(const string& path) {
+  return book_.Open(path);
+}
+
+void Engine::set_seed(unsigned int seed) {
+  book_.set_seed(seed);
+  random_player_.set_seed(seed);
+}
+
+void Engine::Relay::OnLine(int depth, int index, const PvLine& line, int nodes) {
+  SearchInfo info;
+  info.depth = depth;
+  info.index = index;
+  info.line = line;
+  info.nodes = nodes;
+  info.tb_hits = player_->tb_hits();
+  info.seconds = GetTime() - start_;
+  listener_->OnInfo(info);
+}
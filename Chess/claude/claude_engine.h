@@ -0,0 +1,165 @@
+//
+//  claude_engine.h
+//  Embeddable engine.
+//
+//  An Engine holds everything a game needs: the positions played, a
+//  transposition table, an opening book and a random generator. Engines
+//  share no mutable state, so any number of them can search at once in
+//  one process, each on its own thread, without locks. One Engine must
+//  not be used by two threads at once, except for Stop().
+//
+//  The bitbases and tablebases are process-wide and read-only once
+//  loaded: call InitBitbases(), then InitSyzygy(), before creating engines.
+//
+
+#ifndef game_claude_engine_h
+#define game_claude_engine_h
+
+#include <string>
+#include <vector>
+
+#include "claude.h"
+#include "claude_book.h"
+#include "claude_mate.h"
+#include "claude_tt.h"
+
+// Limits of a search; 0 means no limit.
+struct SearchLimits {
+  SearchLimits() : depth(0), seconds(0), nodes(0), multi_pv(1) {}
+
+  // Without any limit, the search stops at Engine::DEFAULT_DEPTH.
+  int depth;
+  double seconds;
+  int nodes;
+  // Best lines searched (MultiPV).
+  int multi_pv;
+};
+
+struct SearchResult {
+  SearchResult() : found(false), from_book(false), score(0), nodes(0), tb_hits(0), seconds(0) {}
+
+  // False if the side to move has no legal move.
+  bool found;
+  bool from_book;
+  Move best_move;
+  // From the side to move, in centipawns; see MATE_SCORE.
+  int score;
+  int nodes;
+  int tb_hits;
+  double seconds;
+  // Lines of the last completed iteration, best first.
+  vector<PvLine> lines;
+};
+
+// A line of a completed iteration of the search.
+struct SearchInfo {
+  int depth;
+  // Of the line, best first, counting from 0.
+  int index;
+  PvLine line;
+  // Of the search so far.
+  int nodes;
+  int tb_hits;
+  double seconds;
+};
+
+// Receives the progress of the searches of an engine, on the searching
+// thread.
+class EngineListener {
+public:
+  virtual ~EngineListener() {}
+
+  // Called for each line of each completed iteration, best first.
+  virtual void OnInfo(const SearchInfo& info) {}
+
+  // Called at the end of each search, book moves included.
+  virtual void OnBestMove(const SearchResult& result) {}
+};
+
+class Engine {
+public:
+  // hash_megabytes of 0 searches without a transposition table.
+  explicit Engine(int hash_megabytes = DEFAULT_HASH_MEGABYTES);
+
+  // Clears the table and sets the start position.
+  void NewGame();
+
+  // Sets the position and forgets the moves before it. Returns false,
+  // leaving the engine unchanged, if fen is not a legal position.
+  bool SetPosition(const string& fen);
+  void SetStartPosition();
+  // Plays a move in SAN or coordinate notation. Returns false, leaving the
+  // engine unchanged, if it is not legal.
+  bool PlayMove(const string& move);
+  bool PlayMove(const Move& move);
+
+  const Position& position() const { return history_.back(); }
+  // Positions since SetPosition, the current one last.
+  const vector<Position>& history() const { return history_; }
+
+  // Searches the current position, calling the listener. Returns false if
+  // there is no legal move.
+  bool Search(const SearchLimits& limits, SearchResult* result);
+  // Stops the search in progress as soon as possible; its result is the
+  // last completed iteration. May be called from any thread.
+  void Stop() { stop_ = true; }
+
+  // Searches a mate of the side to move in at most moves moves with df-pn
+  // (see claude_mate.h), in a table the size of the hash, within
+  // node_limit nodes if not 0. Stop() applies. Returns false if no mate
+  // was found.
+  bool SolveMate(int moves, long long node_limit, MateResult* result);
+
+  // A legal move of the current position at random. Returns false if there
+  // is none.
+  bool RandomMove(Move* move);
+
+  // Megabytes of the table; 0 for none. Returns false if the memory is not
+  // available; the table is then empty.
+  bool ResizeHash(int megabytes);
+  const TranspositionTable& hash_table() const { return tt_; }
+  TranspositionTable* mutable_hash_table() { return &tt_; }
+
+  // Book moves are played by Search while the book knows the position.
+  // Returns false if the book cannot be opened.
+  bool OpenBook(const string& path);
+  void CloseBook() { book_.Close(); }
+
+  // Seeds the choice of book and random moves.
+  void set_seed(unsigned int seed);
+  // Not owned; NULL for none.
+  void set_listener(EngineListener* listener) { listener_ = listener; }
+
+  enum {
+    DEFAULT_HASH_MEGABYTES = 16,
+    DEFAULT_DEPTH = 4,
+    MAX_DEPTH = 64
+  };
+
+private:
+  // Forwards the iterations of the player to the listener.
+  class Relay : public SearchListener {
+  public:
+    Relay(EngineListener* listener, const MinMaxPlayer* player, double start)
+    : listener_(listener), player_(player), start_(start) {}
+    virtual void OnIteration(int depth, int score, const Move& best_move, int nodes) {}
+    virtual void OnLine(int depth, int index, const PvLine& line, int nodes);
+
+  private:
+    EngineListener* listener_;
+    const MinMaxPlayer* player_;
+    double start_;
+  };
+
+  vector<Position> history_;
+  TranspositionTable tt_;
+  PolyglotBook book_;
+  RandomPlayer random_player_;
+  EngineListener* listener_;
+  // Set by Stop(), polled by the search.
+  volatile bool stop_;
+
+  DISALLOW_COPY_AND_ASSIGN(Engine);
+};
+
+#endif  // game_claude_engine_h
@@ -0,0 +1,326 @@
+//
+//  claude_epd.cc
+//  EPD test suites.
+//
+
+#include "claude_epd.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "claude_san.h"
+
+namespace {
+
+  // Splits the operations after the position into opcode and operands.
+  // Operands are separated by spaces; quoted strings may contain spaces
+  // and semicolons.
+  bool SplitOperations(const string& ops, vector<vector<string> >* result) {
+    vector<string> operation;
+    string token;
+    bool in_token = false;
+    for (size_t i = 0; i < ops.size(); ++i) {
+      char c = ops[i];
+      if (c == '"') {
+        size_t end = ops.find('"', i + 1);
+        if (end == string::npos) {
+          return false;
+        }
+        token += ops.substr(i + 1, end - i - 1);
+        in_token = true;
+        i = end;
+      } else if (c == ' ' || c == '\t' || c == ';' || c == '\r' || c == '\n') {
+        if (in_token) {
+          operation.push_back(token);
+          token.clear();
+          in_token = false;
+        }
+        if (c == ';') {
+          if (operation.empty()) {
+            return false;
+          }
+          result->push_back(operation);
+          operation.clear();
+        }
+      } else {
+        token += c;
+        in_token = true;
+      }
+    }
+    if (in_token) {
+      operation.push_back(token);
+    }
+    // The last operation may lack its semicolon.
+    if (!operation.empty()) {
+      result->push_back(operation);
+    }
+    return true;
+  }
+
+  struct EpdResult {
+    bool solved;
+    // Time of the iteration from which every iteration found a solution,
+    // or -1.
+    double solve_time;
+    double time;
+    int nodes;
+    int depth;
+    int score;
+    Move move;
+  };
+
+  // Records when the search settles on a solution.
+  class SolutionListener : public SearchListener {
+  public:
+    SolutionListener(const EpdRecord& record, double start)
+    : record_(record), start_(start), solve_time_(-1), depth_(0) {}
+    
+    virtual void OnIteration(int depth, int score, const Move& best_move, int nodes) {
+      if (!IsSolution(record_, best_move)) {
+        solve_time_ = -1;
+      } else if (solve_time_ < 0) {
+        solve_time_ = GetTime() - start_;
+      }
+      depth_ = depth;
+    }
+    
+    double solve_time() const { return solve_time_; }
+    int depth() const { return depth_; }
+    
+  private:
+    const EpdRecord& record_;
+    double start_;
+    double solve_time_;
+    int depth_;
+  };
+
+  struct Suite {
+    const vector<EpdRecord>* records;
+    vector<EpdResult>* results;
+    const EpdOptions* options;
+    // Index of the next record to search, shared by the workers.
+    volatile int next;
+  };
+
+  void SearchRecord(const EpdRecord& record, const EpdOptions& options,
+                    EpdResult* result) {
+    Position pos;
+    Position::ParseFen(record.fen, &pos);
+    MinMaxPlayer player(options.depth);
+    player.set_time_limit(options.seconds);
+    double start = GetTime();
+    SolutionListener listener(record, start);
+    player.set_listener(&listener);
+
+    Move move;
+    bool found = player.NextMove(pos, &move);
+    result->time = GetTime() - start;
+    result->nodes = player.nodes();
+    result->depth = listener.depth();
+    result->score = player.score();
+    result->solved = found && IsSolution(record, move);
+    result->solve_time = result->solved ? listener.solve_time() : -1;
+    result->move = move;
+  }
+
+  void* Worker(void* arg) {
+    Suite* suite = static_cast<Suite*>(arg);
+    int size = suite->records->size();
+    while (1) {
+      int i = __sync_fetch_and_add(&suite->next, 1);
+      if (i >= size) {
+        break;
+      }
+      SearchRecord((*suite->records)[i], *suite->options, &(*suite->results)[i]);
+    }
+    return NULL;
+  }
+
+  string JsonString(const string& s) {
+    string out = "\"";
+    for (size_t i = 0; i < s.size(); ++i) {
+      if (s[i] == '"' || s[i] == '\\') {
+        out += '\\';
+      }
+      out += s[i];
+    }
+    return out + "\"";
+  }
+
+}  // namespace
+
+bool ParseEpd(const string& line, EpdRecord* record, string* error) {
+  istringstream is(line);
+  string fields[4];
+  for (int i = 0; i < 4; ++i) {
+    if (!(is >> fields[i])) {
+      *error = "missing position fields";
+      return false;
+    }
+  }
+  string ops;
+  getline(is, ops);
+  vector<vector<string> > operations;
+  if (!SplitOperations(ops, &operations)) {
+    *error = "malformed operations";
+    return false;
+  }
+
+  record->id.clear();
+  record->best_moves.clear();
+  record->avoid_moves.clear();
+  string halfmove_clock = "0";
+  string fullmove_counter = "1";
+  for (size_t i = 0; i < operations.size(); ++i) {
+    const vector<string>& op = operations[i];
+    if (op[0] == "hmvc" && op.size() > 1) {
+      halfmove_clock = op[1];
+    } else if (op[0] == "fmvn" && op.size() > 1) {
+      fullmove_counter = op[1];
+    } else if (op[0] == "id" && op.size() > 1) {
+      record->id = op[1];
+    }
+  }
+  record->fen = fields[0] + " " + fields[1] + " " + fields[2] + " " + fields[3] +
+  " " + halfmove_clock + " " + fullmove_counter;
+
+  // Moves are in SAN, which needs the position.
+  Position pos;
+  if (!Position::ParseFen(record->fen, &pos)) {
+    *error = "invalid position " + record->fen;
+    return false;
+  }
+  for (size_t i = 0; i < operations.size(); ++i) {
+    const vector<string>& op = operations[i];
+    if (op[0] != "bm" && op[0] != "am") {
+      continue;
+    }
+    vector<Move>* moves = (op[0] == "bm") ? &record->best_moves : &record->avoid_moves;
+    for (size_t j = 1; j < op.size(); ++j) {
+      Move move;
+      if (!ParseSan(pos, op[j], &move)) {
+        *error = "illegal move " + op[j];
+        return false;
+      }
+      moves->push_back(move);
+    }
+  }
+  return true;
+}
+
+bool IsSolution(const EpdRecord& record, const Move& move) {
+  if (!record.best_moves.empty() &&
+      find(record.best_moves.begin(), record.best_moves.end(), move) ==
+      record.best_moves.end()) {
+    return false;
+  }
+  return find(record.avoid_moves.begin(), record.avoid_moves.end(), move) ==
+  record.avoid_moves.end();
+}
+
+int RunEpdSuite(const string& path, const EpdOptions& options) {
+  ifstream in(path.c_str());
+  if (!in) {
+    cerr << "Cannot open " << path << endl;
+    return -1;
+  }
+  vector<EpdRecord> records;
+  string line;
+  for (int line_number = 1; getline(in, line); ++line_number) {
+    if (line.find_first_not_of(" \t\r") == string::npos || line[0] == '#') {
+      continue;
+    }
+    EpdRecord record;
+    string error;
+    if (!ParseEpd(line, &record, &error)) {
+      cerr << path << ":" << line_number << ": " << error << endl;
+      continue;
+    }
+    if (record.best_moves.empty() && record.avoid_moves.empty()) {
+      // Any move would count as a solution.
+      cerr << path << ":" << line_number << ": no bm or am, skipped" << endl;
+      continue;
+    }
+    if (record.id.empty()) {
+      ostringstream id;
+      id << "line " << line_number;
+      record.id = id.str();
+    }
+    records.push_back(record);
+  }
+
+  vector<EpdResult> results(records.size());
+  Suite suite;
+  suite.records = &records;
+  suite.results = &results;
+  suite.options = &options;
+  suite.next = 0;
+
+  double start = GetTime();
+  int threads = max(1, options.threads);
+  vector<pthread_t> workers(threads);
+  for (int i = 0; i < threads; ++i) {
+    pthread_create(&workers[i], NULL, Worker, &suite);
+  }
+  for (int i = 0; i < threads; ++i) {
+    pthread_join(workers[i], NULL);
+  }
+  double elapsed = GetTime() - start;
+
+  int solved = 0;
+  long long total_nodes = 0;
+  double total_solve_time = 0;
+  if (options.json) {
+    cout << "{\"positions\": [";
+  } else {
+    printf("%-16s %-6s %-8s %5s %6s %8s %8s %10s\n",
+           "id", "result", "move", "depth", "score", "solve", "time", "nodes");
+  }
+  for (size_t i = 0; i < records.size(); ++i) {
+    const EpdResult& r = results[i];
+    Position pos;
+    Position::ParseFen(records[i].fen, &pos);
+    string san = MoveToSan(pos, r.move);
+    if (r.solved) {
+      ++solved;
+      total_solve_time += r.solve_time;
+    }
+    total_nodes += r.nodes;
+    if (options.json) {
+      cout << (i ? ", " : "") << "{\"id\": " << JsonString(records[i].id)
+      << ", \"solved\": " << (r.solved ? "true" : "false")
+      << ", \"move\": " << JsonString(san)
+      << ", \"depth\": " << r.depth
+      << ", \"score\": " << r.score
+      << ", \"solve_time\": " << r.solve_time
+      << ", \"time\": " << r.time
+      << ", \"nodes\": " << r.nodes << "}";
+    } else {
+      printf("%-16s %-6s %-8s %5d %6d %8.3f %8.3f %10d\n",
+             records[i].id.c_str(), r.solved ? "ok" : "FAIL", san.c_str(),
+             r.depth, r.score, r.solve_time, r.time, r.nodes);
+    }
+  }
+  if (options.json) {
+    cout << "], \"solved\": " << solved
+    << ", \"total\": " << records.size()
+    << ", \"threads\": " << threads
+    << ", \"time\": " << elapsed
+    << ", \"nodes\": " << total_nodes
+    << ", \"nps\": " << static_cast<long long>(total_nodes / elapsed) << "}" << endl;
+  } else {
+    cout << "Solved          : " << solved << "/" << records.size() << endl;
+    if (solved) {
+      cout << "Mean solve time : " << total_solve_time / solved << endl;
+    }
+    cout << "Total time (ms) : " << static_cast<long long>(elapsed * 1000) << endl;
+    cout << "Nodes searched  : " << total_nodes << endl;
+    cout << "Nodes/second    : " << static_cast<long long>(total_nodes / elapsed) << endl;
+  }
+  return solved;
+}
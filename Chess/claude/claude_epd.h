@@ -0,0 +1,52 @@
+//
+//  claude_epd.h
+//  EPD test suites.
+//
+//  An EPD record is the first four fields of a FEN followed by operations,
+//  e.g. 2rr3k/pp3pp1/1nnqbN1p/3pN3/2pP4/2P3Q1/PPB4P/R4RK1 w - - bm Qg6; id "WAC.001";
+//  The runner searches every record and checks the move against its
+//  "bm" (best moves) and "am" (avoid moves) operations.
+//
+
+#ifndef game_claude_epd_h
+#define game_claude_epd_h
+
+#include <string>
+#include <vector>
+
+#include "claude.h"
+
+struct EpdRecord {
+  // FEN of the position; the move counters come from "hmvc" and "fmvn".
+  string fen;
+  string id;
+  vector<Move> best_moves;
+  vector<Move> avoid_moves;
+};
+
+// Parses one line of an EPD file. Returns false and sets error if the line
+// is malformed or a bm/am move is not legal in the position.
+bool ParseEpd(const string& line, EpdRecord* record, string* error);
+
+// Returns true if move satisfies the bm and am operations of record. A
+// record with neither accepts any move.
+bool IsSolution(const EpdRecord& record, const Move& move);
+
+struct EpdOptions {
+  EpdOptions() : threads(1), depth(64), seconds(1.0), json(false) {}
+
+  // Worker threads, each searching with its own player.
+  int threads;
+  // Search limits of each position; seconds is 0 for no time limit.
+  int depth;
+  double seconds;
+  bool json;
+};
+
+// Searches every record of the EPD file that has a bm or am operation and
+// prints, per position, whether it was solved, the time to solution and
+// the nodes searched, then the totals. Returns the number of solved
+// positions, or -1 if the file cannot be read.
+int RunEpdSuite(const string& path, const EpdOptions& options);
+
+#endif  // game_claude_epd_h
@@ -0,0 +1,15 @@
+//
+//  claude_eval.h
+//  Evaluation parameters.
+//
+//  Written by the tuner (claude -U). Values are in centipawns, like the
+//  scores of the search.
+//
+
+#ifndef game_claude_eval_h
+#define game_claude_eval_h
+
+// Material value of each piece, indexed by piece (1 pawn to 5 queen).
+const int PIECE_VALUE[6] = { 0, 100, 300, 300, 500, 900 };
+
+#endif  // game_claude_eval_h
@@ -0,0 +1,208 @@
+//
+//  claude_fen_file.cc
+//  Bulk loading of FEN files.
+//
+
+#include "claude_fen_file.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace {
+
+  // Files smaller than this are parsed by one thread.
+  const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+  template <class Record>
+  struct Chunk {
+    // Parses a line without its leading blanks.
+    bool (*parse)(const char* line, size_t length, Record* record);
+    const char* begin;
+    const char* end;
+    vector<Record> records;
+    size_t lines;
+    size_t errors;
+    // Line of the first error within the chunk, 0-based.
+    size_t first_error_line;
+    // Lines of the chunk, blank ones included.
+    size_t line_count;
+  };
+
+  template <class Record>
+  void* ParseChunk(void* arg) {
+    Chunk<Record>* chunk = static_cast<Chunk<Record>*>(arg);
+    // About 60 bytes a line.
+    chunk->records.reserve((chunk->end - chunk->begin) / 60);
+    const char* p = chunk->begin;
+    while (p < chunk->end) {
+      const char* eol = static_cast<const char*>(memchr(p, '\n', chunk->end - p));
+      if (eol == NULL) {
+        eol = chunk->end;
+      }
+      const char* first = p;
+      while (first < eol && (*first == ' ' || *first == '\t' || *first == '\r')) {
+        ++first;
+      }
+      if (first < eol && *first != '#') {
+        ++chunk->lines;
+        Record record;
+        if (chunk->parse(first, eol - first, &record)) {
+          chunk->records.push_back(record);
+        } else if (chunk->errors++ == 0) {
+          chunk->first_error_line = chunk->line_count;
+        }
+      }
+      ++chunk->line_count;
+      p = eol + 1;
+    }
+    return NULL;
+  }
+
+  template <class Record>
+  bool LoadFile(const string& path, int threads,
+                bool (*parse)(const char* line, size_t length, Record* record),
+                vector<Record>* records, FenFileStats* stats) {
+    double start = GetTime();
+    *stats = FenFileStats();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return false;
+    }
+    if (st.st_size == 0) {
+      close(fd);
+      return true;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      return false;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    const char* begin = static_cast<const char*>(data);
+    const char* end = begin + st.st_size;
+
+    // Chunks end after a newline, so no line is split.
+    size_t size = st.st_size;
+    int count = static_cast<int>(max<size_t>(1, min<size_t>(max(1, threads), size / MIN_CHUNK_SIZE)));
+    vector<Chunk<Record> > chunks(count);
+    const char* p = begin;
+    for (int i = 0; i < count; ++i) {
+      Chunk<Record>& chunk = chunks[i];
+      chunk.parse = parse;
+      chunk.begin = p;
+      if (i == count - 1) {
+        p = end;
+      } else {
+        p = max(p, begin + size / count * (i + 1));
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        p = eol ? eol + 1 : end;
+      }
+      chunk.end = p;
+      chunk.lines = 0;
+      chunk.errors = 0;
+      chunk.first_error_line = 0;
+      chunk.line_count = 0;
+    }
+
+    vector<pthread_t> workers(count);
+    for (int i = 1; i < count; ++i) {
+      pthread_create(&workers[i], NULL, ParseChunk<Record>, &chunks[i]);
+    }
+    ParseChunk<Record>(&chunks[0]);
+    for (int i = 1; i < count; ++i) {
+      pthread_join(workers[i], NULL);
+    }
+    munmap(data, st.st_size);
+
+    size_t total = records->size();
+    for (int i = 0; i < count; ++i) {
+      total += chunks[i].records.size();
+    }
+    records->reserve(total);
+    size_t line_count = 0;
+    for (int i = 0; i < count; ++i) {
+      const Chunk<Record>& chunk = chunks[i];
+      records->insert(records->end(), chunk.records.begin(), chunk.records.end());
+      if (chunk.errors > 0 && stats->errors == 0) {
+        stats->first_error_line = line_count + chunk.first_error_line + 1;
+      }
+      stats->lines += chunk.lines;
+      stats->errors += chunk.errors;
+      line_count += chunk.line_count;
+    }
+    stats->seconds = GetTime() - start;
+    return true;
+  }
+
+  bool IsResultSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == ';' || c == '"' ||
+    c == '[' || c == ']';
+  }
+
+  bool ParseLabeledFen(const char* line, size_t length, LabeledPosition* record) {
+    // The result is the last token, quoted, bracketed or bare.
+    const char* end = line + length;
+    while (end > line && IsResultSpace(end[-1])) {
+      --end;
+    }
+    const char* token = end;
+    while (token > line && !IsResultSpace(token[-1])) {
+      --token;
+    }
+    size_t size = end - token;
+    if (size == 3 && memcmp(token, "1-0", 3) == 0) {
+      record->result = 1;
+    } else if (size == 3 && memcmp(token, "0-1", 3) == 0) {
+      record->result = 0;
+    } else if (size == 7 && memcmp(token, "1/2-1/2", 7) == 0) {
+      record->result = 0.5;
+    } else if (size >= 3 && size < 16 && (token[0] == '0' || token[0] == '1') &&
+               token[1] == '.') {
+      // 1.0, 0.5 or 0.0; a bare 1 or 0 is the move counter of an unlabeled
+      // FEN.
+      char number[16];
+      memcpy(number, token, size);
+      number[size] = '\0';
+      char* number_end;
+      record->result = static_cast<float>(strtod(number, &number_end));
+      if (number_end != number + size || record->result < 0 || record->result > 1) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+    // The EPD opcode of the result, if any.
+    const char* fen_end = token;
+    while (fen_end > line && IsResultSpace(fen_end[-1])) {
+      --fen_end;
+    }
+    if (fen_end - line >= 3 && memcmp(fen_end - 3, " c9", 3) == 0) {
+      fen_end -= 3;
+    }
+    return Position::ParseFen(line, fen_end - line, &record->pos);
+  }
+
+}  // namespace
+
+bool LoadFenFile(const string& path, int threads, vector<Position>* positions,
+                 FenFileStats* stats) {
+  bool (*parse)(const char*, size_t, Position*) = Position::ParseFen;
+  return LoadFile(path, threads, parse, positions, stats);
+}
+
+bool LoadLabeledFenFile(const string& path, int threads, vector<LabeledPosition>* positions,
+                        FenFileStats* stats) {
+  return LoadFile(path, threads, ParseLabeledFen, positions, stats);
+}
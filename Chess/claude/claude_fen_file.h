@@ -0,0 +1,55 @@
+//
+//  claude_fen_file.h
+//  Bulk loading of FEN files.
+//
+//  A FEN file holds one position per line, possibly with the result of its
+//  game; blank lines and lines starting with '#' are skipped. The file is
+//  mapped and split at line boundaries into one chunk per thread, each
+//  parsed without allocating per line.
+//
+
+#ifndef game_claude_fen_file_h
+#define game_claude_fen_file_h
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "claude.h"
+
+struct FenFileStats {
+  FenFileStats() : lines(0), errors(0), first_error_line(0), seconds(0) {}
+
+  // Lines holding a FEN, good or not.
+  size_t lines;
+  size_t errors;
+  // 1-based; 0 if there are no errors.
+  size_t first_error_line;
+  double seconds;
+};
+
+// Appends the positions of the file to *positions in file order, skipping
+// malformed lines, parsed by up to threads threads. Returns false if the
+// file cannot be read.
+bool LoadFenFile(const string& path, int threads, vector<Position>* positions,
+                 FenFileStats* stats);
+
+// A position and the result of its game, for tuning.
+struct LabeledPosition {
+  Position pos;
+  // Score of white: 1, 0.5 or 0.
+  float result;
+};
+
+// Like LoadFenFile, for lines of a FEN and a result: 1-0, 0-1, 1/2-1/2 or
+// 1.0, 0.5, 0.0, bare, bracketed or quoted, possibly as an EPD c9
+// operation. A line without a result is an error, even if it ends with a
+// move counter of 1 or 0:
+//
+//   rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1 [0.5]
+//   rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - c9 "1/2-1/2";
+bool LoadLabeledFenFile(const string& path, int threads, vector<LabeledPosition>* positions,
+                        FenFileStats* stats);
+
+#endif  // game_claude_fen_file_h
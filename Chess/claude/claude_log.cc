@@ -0,0 +1,195 @@
+//
+//  claude_log.cc
+//  Asynchronous logger.
+//
+
+#include "claude_log.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+
+namespace {
+
+  const char* const LEVEL_NAMES[] = { "debug", "info", "warning", "error", "none" };
+
+  // Sleep of the writer thread when the ring is empty.
+  const long IDLE_NANOSECONDS = 2000000;
+
+}  // namespace
+
+bool ParseLogLevel(const string& name, LogLevel* level) {
+  for (int i = LOG_DEBUG; i <= LOG_NONE; ++i) {
+    if (name == LEVEL_NAMES[i]) {
+      *level = static_cast<LogLevel>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+AsyncLogger::AsyncLogger()
+: file_(NULL),
+level_(LOG_INFO),
+slots_(NULL),
+mask_(0),
+write_position_(0),
+read_position_(0),
+dropped_(0),
+reported_dropped_(0),
+stopping_(false) {}
+
+AsyncLogger::~AsyncLogger() {
+  Close();
+}
+
+bool AsyncLogger::Open(const string& path, LogLevel level, size_t budget) {
+  Close();
+  if (level == LOG_NONE) {
+    return true;
+  }
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file) {
+    return false;
+  }
+  size_t count = 2;
+  while (count * 2 * sizeof(Slot) <= budget) {
+    count *= 2;
+  }
+  slots_ = static_cast<Slot*>(malloc(count * sizeof(Slot)));
+  if (!slots_) {
+    fclose(file);
+    return false;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    slots_[i].sequence = i;
+  }
+  mask_ = count - 1;
+  write_position_ = 0;
+  read_position_ = 0;
+  dropped_ = 0;
+  reported_dropped_ = 0;
+  stopping_ = false;
+  level_ = level;
+  file_ = file;
+  if (pthread_create(&writer_, NULL, Run, this) != 0) {
+    file_ = NULL;
+    free(slots_);
+    slots_ = NULL;
+    fclose(file);
+    return false;
+  }
+  return true;
+}
+
+void AsyncLogger::Close() {
+  if (!file_) {
+    return;
+  }
+  stopping_ = true;
+  pthread_join(writer_, NULL);
+  fclose(file_);
+  file_ = NULL;
+  free(slots_);
+  slots_ = NULL;
+}
+
+void AsyncLogger::Log(LogLevel level, const char* format, ...) {
+  if (!IsEnabled(level)) {
+    return;
+  }
+  // Claims a position whose slot is free (the bounded queue of Dmitry
+  // Vyukov). The slot is free when its sequence equals the position.
+  size_t position = write_position_;
+  Slot* slot;
+  while (1) {
+    slot = &slots_[position & mask_];
+    size_t sequence = slot->sequence;
+    __sync_synchronize();
+    ptrdiff_t diff = static_cast<ptrdiff_t>(sequence - position);
+    if (diff == 0) {
+      if (__sync_bool_compare_and_swap(&write_position_, position, position + 1)) {
+        break;
+      }
+      position = write_position_;
+    } else if (diff < 0) {
+      // The ring is full.
+      __sync_fetch_and_add(&dropped_, 1);
+      return;
+    } else {
+      // Claimed by another thread.
+      position = write_position_;
+    }
+  }
+  slot->time = GetTime();
+  slot->level = level;
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(slot->text, sizeof(slot->text), format, args);
+  va_end(args);
+  if (length > MAX_MESSAGE_LENGTH) {
+    slot->text[MAX_MESSAGE_LENGTH - 1] = '.';
+    slot->text[MAX_MESSAGE_LENGTH - 2] = '.';
+    slot->text[MAX_MESSAGE_LENGTH - 3] = '.';
+  }
+  __sync_synchronize();
+  slot->sequence = position + 1;
+}
+
+/* static */
+void* AsyncLogger::Run(void* arg) {
+  AsyncLogger* logger = static_cast<AsyncLogger*>(arg);
+  while (1) {
+    // Reads stopping_ before draining, so no message logged before Close()
+    // is left behind.
+    bool stopping = logger->stopping_;
+    __sync_synchronize();
+    if (logger->Drain() == 0) {
+      if (stopping) {
+        break;
+      }
+      struct timespec idle = { 0, IDLE_NANOSECONDS };
+      nanosleep(&idle, NULL);
+    }
+  }
+  return NULL;
+}
+
+void AsyncLogger::Write(double time, int level, const char* text) {
+  time_t seconds = static_cast<time_t>(time);
+  struct tm local;
+  localtime_r(&seconds, &local);
+  fprintf(file_, "%02d:%02d:%02d.%06ld %-7s %s\n", local.tm_hour, local.tm_min,
+          local.tm_sec, static_cast<long>((time - seconds) * 1e6), LEVEL_NAMES[level], text);
+}
+
+size_t AsyncLogger::Drain() {
+  size_t count = 0;
+  while (1) {
+    Slot* slot = &slots_[read_position_ & mask_];
+    size_t sequence = slot->sequence;
+    __sync_synchronize();
+    if (sequence != read_position_ + 1) {
+      break;
+    }
+    Write(slot->time, slot->level, slot->text);
+    __sync_synchronize();
+    // Frees the slot for the position one lap ahead.
+    slot->sequence = read_position_ + mask_ + 1;
+    ++read_position_;
+    ++count;
+  }
+  size_t dropped = dropped_;
+  if (dropped != reported_dropped_) {
+    char text[64];
+    snprintf(text, sizeof(text), "%lu messages dropped",
+             static_cast<unsigned long>(dropped - reported_dropped_));
+    Write(GetTime(), LOG_WARNING, text);
+    reported_dropped_ = dropped;
+    ++count;
+  }
+  if (count > 0) {
+    fflush(file_);
+  }
+  return count;
+}
@@ -0,0 +1,93 @@
+//
+//  claude_log.h
+//  Asynchronous logger.
+//
+//  Messages are formatted by the calling thread into the slots of a
+//  lock-free ring buffer and written to the file by a background thread,
+//  so logging never waits for the disk. Any thread may log. When the ring
+//  is full, messages are dropped and counted instead of blocking; the
+//  count is written once there is room again.
+//
+
+#ifndef game_claude_log_h
+#define game_claude_log_h
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "claude.h"
+
+enum LogLevel {
+  LOG_DEBUG = 0,
+  LOG_INFO = 1,
+  LOG_WARNING = 2,
+  LOG_ERROR = 3,
+  // Disables logging, as a level.
+  LOG_NONE = 4
+};
+
+// Parses "debug", "info", "warning", "error" or "none". Returns false if
+// name is none of them.
+bool ParseLogLevel(const string& name, LogLevel* level);
+
+class AsyncLogger {
+public:
+  AsyncLogger();
+  // Writes the messages still in the ring.
+  ~AsyncLogger();
+
+  // Starts logging messages of level and above to the file, with a ring of
+  // about budget bytes. Returns false if the file cannot be opened.
+  bool Open(const string& path, LogLevel level, size_t budget);
+  // Writes the messages in the ring and closes the file. No thread may be
+  // logging.
+  void Close();
+
+  bool IsEnabled(LogLevel level) const { return file_ != NULL && level >= level_; }
+
+  // Logs a printf-style message, truncated to MAX_MESSAGE_LENGTH chars.
+  // Does not allocate, lock or wait.
+  void Log(LogLevel level, const char* format, ...)
+      __attribute__((format(printf, 3, 4)));
+
+  // Messages dropped because the ring was full.
+  size_t dropped() const { return dropped_; }
+
+  enum { MAX_MESSAGE_LENGTH = 495 };
+
+private:
+  struct Slot {
+    // Position of the message for which the slot is free, plus one once
+    // the message is written.
+    volatile size_t sequence;
+    double time;
+    int level;
+    char text[MAX_MESSAGE_LENGTH + 1];
+  };
+
+  static void* Run(void* arg);
+  // Writes a line with the local time and the level.
+  void Write(double time, int level, const char* text);
+  // Writes the messages in the ring. Returns their number.
+  size_t Drain();
+
+  FILE* file_;
+  LogLevel level_;
+  Slot* slots_;
+  size_t mask_;
+  // Next position to write, shared by the logging threads.
+  volatile size_t write_position_;
+  // Next position to read, owned by the writer thread.
+  size_t read_position_;
+  volatile size_t dropped_;
+  size_t reported_dropped_;
+  volatile bool stopping_;
+  pthread_t writer_;
+
+  DISALLOW_COPY_AND_ASSIGN(AsyncLogger);
+};
+
+#endif  // game_claude_log_h
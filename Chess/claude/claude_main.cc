@@ -2,27 +2,31 @@
 
 #include <iostream>
 
+#include <ctype.h>
 #include <stdlib.h>
 #include <time.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 
-namespace {
-  Position positions[100];
-};  // namespace positions;
-
+#include "claude_bench.h"
+#include "claude_bitbase.h"
+#include "claude_book.h"
+#include "claude_book_builder.h"
+#include "claude_datagen.h"
+#include "claude_epd.h"
+#include "claude_fen_file.h"
+#include "claude_pgn.h"
+#include "claude_san.h"
+#include "claude_server.h"
+#include "claude_syzygy.h"
+#include "claude_tournament.h"
+#include "claude_tune.h"
 
 // Benchmark
 namespace {
   
-  double GetTime() {
-    struct timeval t;
-    struct timezone tzp;
-    gettimeofday(&t, &tzp);
-    return t.tv_sec + t.tv_usec*1e-6;
-  }
-  
-  void Benchmark() {
+  // Self-play games between MinMaxPlayer(2).
+  void GameBenchmark() {
     /*
      double s0 = GetTime();
      Move* m = new Move[10000000];
@@ -36,13 +40,13 @@ namespace {
     
     //RandomPlayer player;
     MinMaxPlayer player(2);
+    Position positions[100];
     
     for (int i = 0; i < 100; ++i) {
       positions[0].StartPosition();
       int ply = 0;
       while (1) {
         Position& pos = positions[ply];
-        pos.CalcMoves();
         //printf("%d.\n", ply);
         //pos.Print();
         Move move;
@@ -64,14 +68,310 @@ namespace {
     cout << "time=" << end - start << endl;
   }
   
+  // Counts the leaves of the move tree. Measures move generation and
+  // copy-make (DoMove) without the search.
+  long long Perft(const Position& pos, int depth) {
+    MoveList moves;
+    pos.CalcMoves(&moves);
+    if (depth <= 1) {
+      return moves.size();
+    }
+    long long nodes = 0;
+    for (const Move* it = moves.begin(); it != moves.end(); ++it) {
+      Position next_pos;
+      pos.DoMove(*it, &next_pos);
+      nodes += Perft(next_pos, depth - 1);
+    }
+    return nodes;
+  }
+  
+  void PerftBenchmark() {
+    const static char* FENS[] = {
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"
+    };
+    const static int DEPTHS[] = { 5, 4 };
+    
+    for (int i = 0; i < 2; ++i) {
+      Position pos;
+      Position::ParseFen(FENS[i], &pos);
+      double start = GetTime();
+      long long nodes = Perft(pos, DEPTHS[i]);
+      double end = GetTime();
+      cout << FENS[i] << endl;
+      cout << "depth=" << DEPTHS[i] << " nodes=" << nodes
+      << " time=" << end - start
+      << " nps=" << static_cast<long long>(nodes / (end - start)) << endl;
+    }
+  }
+  
+  // Reads and replays every game of a PGN file, reporting illegal moves
+  // and the throughput.
+  bool PgnBenchmark(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+      cerr << "Cannot open " << path << endl;
+      return false;
+    }
+    double start = GetTime();
+    PgnReader reader(file);
+    PgnGame game;
+    long long plies = 0;
+    int errors = 0;
+    Position pos;
+    while (reader.Next(&game)) {
+      string fen = game.Tag("FEN");
+      if (fen.empty()) {
+        pos.StartPosition();
+      } else if (!Position::ParseFen(fen, &pos)) {
+        cerr << "game " << reader.games() << ": invalid FEN " << fen << endl;
+        ++errors;
+        continue;
+      }
+      for (size_t i = 0; i < game.moves.size(); ++i) {
+        Move move;
+        if (!ParseSan(pos, game.moves[i], &move)) {
+          cerr << "game " << reader.games() << ": illegal move "
+          << game.moves[i] << endl;
+          ++errors;
+          break;
+        }
+        Position next_pos;
+        pos.DoMove(move, &next_pos);
+        pos = next_pos;
+        ++plies;
+      }
+    }
+    double end = GetTime();
+    long bytes = ftell(file);
+    fclose(file);
+    cout << "games=" << reader.games() << " plies=" << plies
+    << " errors=" << errors << " time=" << end - start
+    << " games/s=" << static_cast<long long>(reader.games() / (end - start))
+    << " MB/s=" << bytes / (end - start) / 1e6 << endl;
+    return errors == 0;
+  }
+  
 }  // namespace
 
 int main(int argc, char* argv[]) {
+  bool json = false;
+  int cpu = -1;
+  int bench_hash_megabytes = 0;
+  EpdOptions epd_options;
+  TournamentOptions tournament_options;
+  ServerOptions server_options;
+  TuneOptions tune_options;
+  DatagenOptions datagen_options;
+  PolyglotBook book;
+  string bitbase_dir;
   while (*++argv) {
     if (**argv == '-') {
       switch ((*argv)[1]) {
-        case 'B': 
-          Benchmark();
+        case 'j':
+          // JSON output
+          json = true;
+          break;
+        case 'B': {
+          // -B [depth]: with -H, compares small and huge pages of the hash
+          int depth = BENCH_DEPTH;
+          if (argv[1] && isdigit(argv[1][0])) {
+            depth = atoi(*++argv);
+          }
+          if (bench_hash_megabytes > 0) {
+            HashBench(depth, bench_hash_megabytes, json);
+          } else {
+            Bench(depth, json);
+          }
+          return 0;
+        }
+        case 'G':
+          GameBenchmark();
+          return 0;
+        case 'b':
+          // -b book.bin: Polyglot opening book of the engine
+          if (argv[1] && !book.Open(*++argv)) {
+            cerr << "Cannot open book " << *argv << endl;
+            return 1;
+          }
+          break;
+        case 'c':
+          // -c cpu: pin micro benchmarks to a core
+          if (argv[1]) {
+            cpu = atoi(*++argv);
+          }
+          break;
+        case 'M':
+          // -M [repetitions]
+          if (argv[1] && isdigit(argv[1][0])) {
+            MicroBench(atoi(*++argv), cpu, json);
+          } else {
+            MicroBench(100, cpu, json);
+          }
+          return 0;
+        case 'E':
+          // -E file: run an EPD suite
+          if (argv[1]) {
+            epd_options.json = json;
+            InitBitbases(bitbase_dir);
+            RunEpdSuite(*++argv, epd_options);
+          }
+          return 0;
+        case 'd':
+          // -d depth: depth limit of -E and -D
+          if (argv[1]) {
+            epd_options.depth = atoi(*++argv);
+            datagen_options.depth = epd_options.depth;
+          }
+          break;
+        case 't':
+          // -t threads: worker threads of -E, -A, -F, -U and -D, concurrent games of -R
+          if (argv[1]) {
+            epd_options.threads = atoi(*++argv);
+            tournament_options.concurrency = epd_options.threads;
+            server_options.workers = epd_options.threads;
+            tune_options.threads = epd_options.threads;
+            datagen_options.threads = epd_options.threads;
+          }
+          break;
+        case 'n':
+          // -n games: maximum number of games of -R, games of -D
+          if (argv[1]) {
+            tournament_options.games = atoi(*++argv);
+            datagen_options.games = tournament_options.games;
+          }
+          break;
+        case 'w':
+          // -w file: record the games of -R in PGN
+          if (argv[1]) {
+            tournament_options.pgn_path = *++argv;
+          }
+          break;
+        case 'V':
+          // -V games.pgn: replay a PGN file
+          if (argv[1]) {
+            return PgnBenchmark(*++argv) ? 0 : 1;
+          }
+          return 1;
+        case 'F':
+          // -F file: load a FEN file with -t threads
+          if (argv[1]) {
+            vector<Position> loaded;
+            FenFileStats stats;
+            if (!LoadFenFile(*++argv, epd_options.threads, &loaded, &stats)) {
+              cerr << "Cannot read " << *argv << endl;
+              return 1;
+            }
+            if (stats.errors > 0) {
+              cerr << *argv << ":" << stats.first_error_line << ": invalid FEN" << endl;
+            }
+            cout << "positions=" << loaded.size() << " errors=" << stats.errors
+            << " time=" << stats.seconds
+            << " positions/s=" << static_cast<long long>(stats.lines / stats.seconds) << endl;
+            return stats.errors == 0 ? 0 : 1;
+          }
+          return 1;
+        case 'U':
+          // -U positions.epd [claude_eval.h]: tune the evaluation
+          if (argv[1]) {
+            string data_path = *++argv;
+            string header_path = argv[1] ? *++argv : "claude_eval.h";
+            return TuneEvaluation(data_path, header_path, tune_options) ? 0 : 1;
+          }
+          return 1;
+        case 'D':
+          // -D train.bin: append self-play training data
+          if (argv[1]) {
+            InitBitbases(bitbase_dir);
+            return GenerateTrainingData(*++argv, datagen_options) < 0 ? 1 : 0;
+          }
+          return 1;
+        case 'I':
+          // -I iterations: gradient descent steps of -U
+          if (argv[1]) {
+            tune_options.iterations = atoi(*++argv);
+          }
+          break;
+        case 'o':
+          // -o file: openings (FENs) of -R
+          if (argv[1]) {
+            tournament_options.openings_path = *++argv;
+          }
+          break;
+        case 'e':
+          // -e elo0 elo1: SPRT hypotheses of -R
+          if (argv[1] && argv[2]) {
+            tournament_options.elo0 = atof(*++argv);
+            tournament_options.elo1 = atof(*++argv);
+          }
+          break;
+        case 'R': {
+          // -R configA configB: match, e.g. -R depth=4 depth=3
+          EngineConfig a;
+          EngineConfig b;
+          if (!argv[1] || !argv[2] || !a.Parse(argv[1]) || !b.Parse(argv[2])) {
+            cerr << "Usage: -R depth=4,time=0.1 depth=3" << endl;
+            return 1;
+          }
+          InitBitbases(bitbase_dir);
+          return RunTournament(a, b, tournament_options) > 0 ? 0 : 1;
+        }
+        case 'T':
+          // -T seconds: time limit per position of -E, 0 for none
+          if (argv[1]) {
+            epd_options.seconds = atof(*++argv);
+          }
+          break;
+        case 'K': {
+          // -K book.bin games.pgn...: build an opening book
+          if (!argv[1] || !argv[2]) {
+            cerr << "Usage: -K book.bin games.pgn..." << endl;
+            return 1;
+          }
+          string book_path = *++argv;
+          vector<string> pgn_paths;
+          while (argv[1]) {
+            pgn_paths.push_back(*++argv);
+          }
+          return BuildBook(pgn_paths, book_path, BookBuildOptions()) < 0 ? 1 : 0;
+        }
+        case 'Z':
+          // -Z dir: where bitbases are kept, and KBNK is built
+          if (argv[1]) {
+            bitbase_dir = *++argv;
+          }
+          break;
+        case 'S':
+          // -S dir[:dir...]: Syzygy tablebases
+          if (argv[1]) {
+            InitBitbases(bitbase_dir);
+            InitSyzygy(*++argv);
+          }
+          break;
+        case 'Y':
+          // -Y [stride]: check the tablebases of -S against the bitbases
+          if (argv[1] && isdigit(argv[1][0])) {
+            return VerifySyzygy(atoi(*++argv)) ? 0 : 1;
+          }
+          return VerifySyzygy(1) ? 0 : 1;
+        case 'H':
+          // -H megabytes: transposition table of each worker of -A, and of -B
+          if (argv[1]) {
+            server_options.hash_megabytes = atoi(*++argv);
+            bench_hash_megabytes = server_options.hash_megabytes;
+          }
+          break;
+        case 'A':
+          // -A socket: analysis server on a Unix domain socket, - for stdin
+          if (argv[1]) {
+            string path = *++argv;
+            server_options.socket_path = (path == "-") ? "" : path;
+            InitBitbases(bitbase_dir);
+            return RunAnalysisServer(server_options);
+          }
+          return 1;
+        case 'P':
+          PerftBenchmark();
           return 0;
         default:
           cerr << "Unkown option " << *argv << endl;
@@ -83,19 +383,25 @@ int main(int argc, char* argv[]) {
   }
   
   srand((unsigned)time(NULL));
+  book.set_seed(rand());
+  InitBitbases(bitbase_dir);
   
-  positions[0].StartPosition();
+  Position start;
+  start.StartPosition();
+  vector<Position> positions(1, start);
   
   //RandomPlayer player;
   MinMaxPlayer player(4);
   
   int ply = 0;
   while (1) {
+    positions.resize(ply + 2, start);
     Position& pos = positions[ply];
-    pos.CalcMoves();
+    MoveList moves;
+    pos.CalcMoves(&moves);
     cout << ply << "." << endl;
     pos.Print();
-    if (pos.next_moves().empty()) {
+    if (moves.empty()) {
       if (pos.IsCheck()) {
         // check mate!
         if (ply % 2 == 0) {
@@ -121,12 +427,23 @@ int main(int argc, char* argv[]) {
       }
     } else {
       Move move;
+      if (book.Probe(pos, &move)) {
+        cout << "book -> ";
+        move.Print();
+        cout << endl << endl;
+        pos.DoMove(move, &positions[ply+1]);
+        ++ply;
+        continue;
+      }
       double start = GetTime();
       player.NextMove(pos, &move);
       double end = GetTime();
       cout << "time = " << end - start << endl;
-      cout << "time/count = " << (end - start)/player.count * 1000. << " ms" << endl;
-      cout << "score = " << player.last_score << endl;
+      cout << "time/count = " << (end - start)/player.nodes() * 1000. << " ms" << endl;
+      cout << "score = " << player.score() << endl;
+      cout << "fail high/low = " << player.fail_high_count() << "/"
+      << player.fail_low_count() << " (" << player.research_count()
+      << " nodes re-searched)" << endl;
       cout << "-> ";
       move.Print();
       cout << endl << endl;
@@ -0,0 +1,227 @@
+//
+//  claude_mate.cc
+//  Mate solver (depth-first proof-number search).
+//
+
+#include "claude_mate.h"
+
+#include <algorithm>
+
+namespace {
+
+  // Numbers of a settled position. Sums are capped here.
+  const uint32_t INFINITE_NUMBER = 1u << 30;
+
+  uint32_t Add(uint32_t a, uint32_t b) {
+    return static_cast<uint32_t>(min<uint64_t>(static_cast<uint64_t>(a) + b, INFINITE_NUMBER));
+  }
+
+  // The same position with other plies left is another node.
+  uint64_t NodeKey(const Position& pos, int plies) {
+    return pos.key() ^ (plies * 0x9e3779b97f4a7c15ULL);
+  }
+
+}  // namespace
+
+// Numbers are from the side to move of a node: phi is the cost of proving
+// it wins, delta of proving it loses. The attacker wins by mate; the
+// defender wins by anything else, a stalemate or running out the plies.
+
+MateSolver::MateSolver(size_t megabytes)
+: mask_(0),
+nodes_(0),
+proved_(0),
+disproved_(0),
+node_limit_(0),
+stop_flag_(NULL),
+stopped_(false) {
+  size_t count = BUCKET_SIZE;
+  while (count * 2 * sizeof(Entry) <= (megabytes << 20)) {
+    count *= 2;
+  }
+  Entry empty = { 0, 0, 0, 0 };
+  entries_.assign(count, empty);
+  mask_ = count - 1;
+}
+
+bool MateSolver::Solve(const Position& pos, int max_moves, MateResult* result) {
+  double start = GetTime();
+  *result = MateResult();
+  nodes_ = 0;
+  proved_ = 0;
+  disproved_ = 0;
+  stopped_ = false;
+  for (int moves = 1; moves <= max_moves && !stopped_; ++moves) {
+    int plies = 2 * moves - 1;
+    uint32_t phi;
+    uint32_t delta;
+    LookUp(pos, plies, true, &phi, &delta);
+    if (phi != 0 && delta != 0) {
+      Mid(pos, plies, true, INFINITE_NUMBER, INFINITE_NUMBER, &phi, &delta);
+    }
+    if (phi == 0 && !stopped_) {
+      result->found = true;
+      result->moves = moves;
+      ExtractLine(pos, plies, &result->line);
+      break;
+    }
+  }
+  result->nodes = nodes_;
+  result->proved = proved_;
+  result->disproved = disproved_;
+  result->seconds = GetTime() - start;
+  return result->found;
+}
+
+uint32_t MateSolver::LookUp(const Position& pos, int plies, bool attacker, uint32_t* phi,
+                            uint32_t* delta) {
+  uint64_t key = NodeKey(pos, plies);
+  const Entry* bucket = &entries_[key & mask_ & ~static_cast<size_t>(BUCKET_SIZE - 1)];
+  uint32_t key32 = key >> 32;
+  for (int i = 0; i < BUCKET_SIZE; ++i) {
+    if (bucket[i].key == key32 && (bucket[i].phi | bucket[i].delta) != 0) {
+      *phi = bucket[i].phi;
+      *delta = bucket[i].delta;
+      return bucket[i].work;
+    }
+  }
+  MoveList moves;
+  pos.CalcMoves(&moves);
+  if (moves.empty()) {
+    // Mated, or stalemate.
+    bool won = !pos.IsCheck() && !attacker;
+    *phi = won ? 0 : INFINITE_NUMBER;
+    *delta = won ? INFINITE_NUMBER : 0;
+  } else if (plies == 0) {
+    // The defender is not mated in time.
+    *phi = attacker ? INFINITE_NUMBER : 0;
+    *delta = attacker ? 0 : INFINITE_NUMBER;
+  } else {
+    // Fewer moves are quicker to refute.
+    *phi = 1;
+    *delta = moves.size();
+  }
+  return 0;
+}
+
+void MateSolver::Store(uint64_t key, uint32_t phi, uint32_t delta, uint32_t work) {
+  Entry* bucket = &entries_[key & mask_ & ~static_cast<size_t>(BUCKET_SIZE - 1)];
+  uint32_t key32 = key >> 32;
+  Entry* replace = &bucket[0];
+  for (int i = 0; i < BUCKET_SIZE; ++i) {
+    if (bucket[i].key == key32) {
+      replace = &bucket[i];
+      break;
+    }
+    if (bucket[i].work < replace->work) {
+      replace = &bucket[i];
+    }
+  }
+  replace->key = key32;
+  replace->phi = phi;
+  replace->delta = delta;
+  replace->work = max<uint32_t>(work, 1);
+}
+
+void MateSolver::Mid(const Position& pos, int plies, bool attacker, uint32_t threshold_phi,
+                     uint32_t threshold_delta, uint32_t* phi, uint32_t* delta) {
+  ++nodes_;
+  long long start_nodes = nodes_;
+  MoveList moves;
+  pos.CalcMoves(&moves);
+  int count = moves.size();
+  vector<Position> children(count, pos);
+  vector<uint32_t> phis(count);
+  vector<uint32_t> deltas(count);
+  for (int i = 0; i < count; ++i) {
+    pos.DoMove(moves[i], &children[i]);
+    LookUp(children[i], plies - 1, !attacker, &phis[i], &deltas[i]);
+  }
+  while (1) {
+    // The side to move wins by one child the opponent loses, and loses if
+    // the opponent wins every child.
+    *phi = INFINITE_NUMBER;
+    *delta = 0;
+    int best = 0;
+    uint32_t second_delta = INFINITE_NUMBER;
+    for (int i = 0; i < count; ++i) {
+      *delta = Add(*delta, phis[i]);
+      if (deltas[i] < *phi) {
+        second_delta = *phi;
+        *phi = deltas[i];
+        best = i;
+      } else if (deltas[i] < second_delta) {
+        second_delta = deltas[i];
+      }
+    }
+    if (*phi >= threshold_phi || *delta >= threshold_delta || CheckLimits()) {
+      break;
+    }
+    // Expand the best child until it is no longer the best, or the node
+    // reaches its thresholds.
+    uint64_t child_phi = static_cast<uint64_t>(threshold_delta) + phis[best] - *delta;
+    uint32_t child_delta = min(threshold_phi, Add(second_delta, 1));
+    Mid(children[best], plies - 1, !attacker,
+        static_cast<uint32_t>(min<uint64_t>(child_phi, INFINITE_NUMBER)), child_delta,
+        &phis[best], &deltas[best]);
+  }
+  if (stopped_) {
+    return;
+  }
+  if (*phi == 0 || *delta == 0) {
+    if ((*phi == 0) == attacker) {
+      ++proved_;
+    } else {
+      ++disproved_;
+    }
+  }
+  Store(NodeKey(pos, plies), *phi, *delta,
+        static_cast<uint32_t>(min<long long>(nodes_ - start_nodes + 1, INFINITE_NUMBER)));
+}
+
+void MateSolver::ExtractLine(const Position& pos, int plies, vector<Move>* line) {
+  Position current = pos;
+  for (bool attacker = true; plies > 0; attacker = !attacker, --plies) {
+    MoveList moves;
+    current.CalcMoves(&moves);
+    int best = -1;
+    uint32_t best_work = 0;
+    Position next_pos;
+    for (int i = 0; i < static_cast<int>(moves.size()); ++i) {
+      Position child;
+      current.DoMove(moves[i], &child);
+      uint32_t phi;
+      uint32_t delta;
+      uint32_t work = LookUp(child, plies - 1, !attacker, &phi, &delta);
+      if (phi != 0 && delta != 0) {
+        // Lost from the table; prove it again.
+        Mid(child, plies - 1, !attacker, INFINITE_NUMBER, INFINITE_NUMBER, &phi, &delta);
+        work = 1;
+      }
+      // The attacker takes a move that mates in time. Every reply of the
+      // defender is mated; it takes the one that took the most work.
+      if (attacker ? delta == 0 : (phi == 0 && (best < 0 || work > best_work))) {
+        best = i;
+        best_work = work;
+        next_pos = child;
+        if (attacker) {
+          break;
+        }
+      }
+    }
+    if (best < 0) {
+      // Mated.
+      return;
+    }
+    line->push_back(moves[best]);
+    current = next_pos;
+  }
+}
+
+// Sets stopped_ when the node limit is reached or the stop flag is set.
+bool MateSolver::CheckLimits() {
+  if ((stop_flag_ && *stop_flag_) || (node_limit_ > 0 && nodes_ >= node_limit_)) {
+    stopped_ = true;
+  }
+  return stopped_;
+}
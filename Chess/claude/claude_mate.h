@@ -0,0 +1,96 @@
+//
+//  claude_mate.h
+//  Mate solver (depth-first proof-number search).
+//
+//  df-pn expands the position that is cheapest to settle next, measured
+//  by proof and disproof numbers: the number of leaves still to show to
+//  prove a mate, or to refute it. Forced lines with few replies are thus
+//  followed deep while wide positions wait, which finds long mates far
+//  sooner than a full-width search. Numbers are kept in a table; each
+//  node is expanded until a threshold given by its parent is reached, so
+//  memory stays bounded by the table.
+//
+//  Nodes are keyed by the Zobrist key and the plies left, so the searched
+//  graph has no cycles and repetitions need no special care. Mates of 1
+//  to N moves are tried in turn, so the mate found is the shortest.
+//
+
+#ifndef game_claude_mate_h
+#define game_claude_mate_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "claude.h"
+
+struct MateResult {
+  MateResult() : found(false), moves(0), nodes(0), proved(0), disproved(0), seconds(0) {}
+
+  bool found;
+  // Moves of the side to move to mate.
+  int moves;
+  // The mate, defended by the replies that held out longest in the search.
+  vector<Move> line;
+  // Positions expanded.
+  long long nodes;
+  // Positions settled as mates, and as no mate within the limit.
+  long long proved;
+  long long disproved;
+  double seconds;
+};
+
+class MateSolver {
+public:
+  // The table of proof and disproof numbers takes about megabytes.
+  explicit MateSolver(size_t megabytes);
+
+  // Stops after about the given number of nodes; 0 means no limit.
+  void set_node_limit(long long nodes) { node_limit_ = nodes; }
+  // Not owned; NULL for none. The search stops as soon as *stop is set,
+  // which another thread may do.
+  void set_stop_flag(const volatile bool* stop) { stop_flag_ = stop; }
+
+  // Searches a mate of the side to move in at most max_moves moves. Returns
+  // false if there is none, or if the search was stopped first.
+  bool Solve(const Position& pos, int max_moves, MateResult* result);
+
+private:
+  struct Entry {
+    // Upper half of the key.
+    uint32_t key;
+    uint32_t phi;
+    uint32_t delta;
+    // Nodes expanded below the entry; the least worked are replaced.
+    uint32_t work;
+  };
+
+  enum { BUCKET_SIZE = 4 };
+
+  // Sets the numbers of pos with plies left from the table, or from its
+  // moves if it is not there. Returns the work of the entry, 0 for none.
+  uint32_t LookUp(const Position& pos, int plies, bool attacker, uint32_t* phi,
+                  uint32_t* delta);
+  void Store(uint64_t key, uint32_t phi, uint32_t delta, uint32_t work);
+  // Expands pos until its numbers reach the thresholds, and sets them.
+  void Mid(const Position& pos, int plies, bool attacker, uint32_t threshold_phi,
+           uint32_t threshold_delta, uint32_t* phi, uint32_t* delta);
+  // Follows the proof from pos, which must be proven, into *line.
+  void ExtractLine(const Position& pos, int plies, vector<Move>* line);
+  bool CheckLimits();
+
+  vector<Entry> entries_;
+  size_t mask_;
+
+  long long nodes_;
+  long long proved_;
+  long long disproved_;
+  long long node_limit_;
+  const volatile bool* stop_flag_;
+  bool stopped_;
+
+  DISALLOW_COPY_AND_ASSIGN(MateSolver);
+};
+
+#endif  // game_claude_mate_h
@@ -0,0 +1,277 @@
+//
+//  claude_pgn.cc
+//  Portable Game Notation (PGN) files.
+//
+
+#include "claude_pgn.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "claude_san.h"
+
+void PgnGame::Clear() {
+  tags.clear();
+  moves.clear();
+  result.clear();
+}
+
+string PgnGame::Tag(const string& name) const {
+  for (size_t i = 0; i < tags.size(); ++i) {
+    if (tags[i].first == name) {
+      return tags[i].second;
+    }
+  }
+  return "";
+}
+
+void PgnGame::SetTag(const string& name, const string& value) {
+  for (size_t i = 0; i < tags.size(); ++i) {
+    if (tags[i].first == name) {
+      tags[i].second = value;
+      return;
+    }
+  }
+  tags.push_back(make_pair(name, value));
+}
+
+void PgnGame::AddMove(const Position& pos, const Move& move) {
+  moves.push_back(MoveToSan(pos, move));
+}
+
+
+// PgnReader
+
+PgnReader::PgnReader(FILE* file)
+: file_(file),
+pos_(0),
+end_(0),
+games_(0) {}
+
+bool PgnReader::Fill() {
+  end_ = fread(buffer_, 1, BUFFER_SIZE, file_);
+  pos_ = 0;
+  return end_ > 0;
+}
+
+namespace {
+
+  bool IsResult(const string& token) {
+    return token == "1-0" || token == "0-1" || token == "1/2-1/2" || token == "*";
+  }
+
+}  // namespace
+
+bool PgnReader::Next(PgnGame* game) {
+  game->Clear();
+  string token;
+  while (1) {
+    int c = Get();
+    if (c == EOF) {
+      // A game without a result at the end of the file.
+      if (!game->tags.empty() || !game->moves.empty()) {
+        game->result = "*";
+        ++games_;
+        return true;
+      }
+      return false;
+    }
+    if (isspace(c)) {
+      continue;
+    }
+    switch (c) {
+      case '[': {
+        if (!game->moves.empty()) {
+          // The next game begins; this one had no result.
+          Unget();
+          game->result = "*";
+          ++games_;
+          return true;
+        }
+        // [Name "Value"]
+        string name;
+        while ((c = Get()) != EOF && !isspace(c) && c != '"' && c != ']') {
+          name += c;
+        }
+        while (c != EOF && c != '"' && c != ']') {
+          c = Get();
+        }
+        string value;
+        if (c == '"') {
+          while ((c = Get()) != EOF && c != '"') {
+            if (c == '\\') {
+              c = Get();
+            }
+            value += c;
+          }
+          while (c != EOF && c != ']') {
+            c = Get();
+          }
+        }
+        game->tags.push_back(make_pair(name, value));
+        break;
+      }
+
+      case '{':
+        // comment
+        while ((c = Get()) != EOF && c != '}') {}
+        break;
+
+      case ';':
+        // comment to the end of the line
+        while ((c = Get()) != EOF && c != '\n') {}
+        break;
+
+      case '(': {
+        // variation, possibly nested, with comments
+        int level = 1;
+        while (level > 0 && (c = Get()) != EOF) {
+          if (c == '(') {
+            ++level;
+          } else if (c == ')') {
+            --level;
+          } else if (c == '{') {
+            while ((c = Get()) != EOF && c != '}') {}
+          }
+        }
+        break;
+      }
+
+      case '$':
+        // numeric annotation glyph
+        while ((c = Get()) != EOF && isdigit(c)) {}
+        if (c != EOF) {
+          Unget();
+        }
+        break;
+
+      default:
+        token.clear();
+        token += c;
+        while ((c = Get()) != EOF && !isspace(c) &&
+               c != '{' && c != '(' && c != ')' && c != ';' && c != '[') {
+          token += c;
+        }
+        if (c != EOF) {
+          Unget();
+        }
+        if (IsResult(token)) {
+          game->result = token;
+          ++games_;
+          return true;
+        }
+        // Drop the move number of "12.", "12..." and "12.e4".
+        if (isdigit(token[0])) {
+          size_t i = token.find_first_not_of("0123456789");
+          if (i == string::npos || token[i] != '.') {
+            break;
+          }
+          i = token.find_first_not_of('.', i);
+          if (i == string::npos) {
+            break;
+          }
+          token.erase(0, i);
+        }
+        game->moves.push_back(token);
+        break;
+    }
+  }
+}
+
+
+// PgnWriter
+
+namespace {
+
+  const char* SEVEN_TAG_ROSTER[] = {
+    "Event", "Site", "Date", "Round", "White", "Black", "Result"
+  };
+
+  void AppendTag(const string& name, const string& value, string* out) {
+    *out += "[" + name + " \"";
+    for (size_t i = 0; i < value.size(); ++i) {
+      if (value[i] == '"' || value[i] == '\\') {
+        *out += '\\';
+      }
+      *out += value[i];
+    }
+    *out += "\"]\n";
+  }
+
+  // Appends a token of the movetext, starting a new line before column 80.
+  void AppendToken(const string& token, string* out, size_t* line_start) {
+    if (out->size() > *line_start) {
+      if (out->size() - *line_start + 1 + token.size() > 79) {
+        *out += '\n';
+        *line_start = out->size();
+      } else {
+        *out += ' ';
+      }
+    }
+    *out += token;
+  }
+
+}  // namespace
+
+string FormatPgn(const PgnGame& game) {
+  string out;
+  string result = game.result.empty() ? "*" : game.result;
+  for (int i = 0; i < 7; ++i) {
+    string value = (i == 6) ? result : game.Tag(SEVEN_TAG_ROSTER[i]);
+    AppendTag(SEVEN_TAG_ROSTER[i], value.empty() ? "?" : value, &out);
+  }
+  for (size_t i = 0; i < game.tags.size(); ++i) {
+    if (find(SEVEN_TAG_ROSTER, SEVEN_TAG_ROSTER + 7, game.tags[i].first) ==
+        SEVEN_TAG_ROSTER + 7) {
+      AppendTag(game.tags[i].first, game.tags[i].second, &out);
+    }
+  }
+  out += '\n';
+
+  // Move numbers continue from the FEN, if any.
+  int side = WHITE;
+  int number = 1;
+  string fen = game.Tag("FEN");
+  if (!fen.empty()) {
+    Position pos;
+    if (Position::ParseFen(fen, &pos)) {
+      side = pos.side();
+      number = pos.fullmove_counter();
+    }
+  }
+  size_t line_start = out.size();
+  for (size_t i = 0; i < game.moves.size(); ++i) {
+    if (side == WHITE || i == 0) {
+      ostringstream os;
+      os << number << (side == WHITE ? "." : "...");
+      AppendToken(os.str(), &out, &line_start);
+    }
+    AppendToken(game.moves[i], &out, &line_start);
+    if (side == BLACK) {
+      ++number;
+    }
+    side = -side;
+  }
+  AppendToken(result, &out, &line_start);
+  out += "\n\n";
+  return out;
+}
+
+bool AppendPgn(const string& path, const PgnGame& game) {
+  string text = FormatPgn(game);
+  int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size());
+  return close(fd) == 0 && ok;
+}
+
+bool PgnWriter::Write(const PgnGame& game) {
+  string text = FormatPgn(game);
+  return fwrite(text.data(), 1, text.size(), file_) == text.size();
+}
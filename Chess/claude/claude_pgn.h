@@ -0,0 +1,94 @@
+//
+//  claude_pgn.h
+//  Portable Game Notation (PGN) files.
+//
+//  Games are read one at a time through a fixed buffer, so files of any
+//  size are processed in constant memory. Moves are kept in SAN; see
+//  claude_san.h to convert them.
+//
+
+#ifndef game_claude_pgn_h
+#define game_claude_pgn_h
+
+#include <stdio.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "claude.h"
+
+struct PgnGame {
+  void Clear();
+
+  // Value of a tag, or "" if missing.
+  string Tag(const string& name) const;
+  // Sets a tag, replacing its value if it exists.
+  void SetTag(const string& name, const string& value);
+
+  // Appends a legal move of pos, the position before it, in SAN.
+  void AddMove(const Position& pos, const Move& move);
+
+  // Tag pairs in file order.
+  vector<pair<string, string> > tags;
+  // Moves of the main line in SAN, without move numbers, comments,
+  // annotations and variations.
+  vector<string> moves;
+  // "1-0", "0-1", "1/2-1/2" or "*".
+  string result;
+};
+
+class PgnReader {
+public:
+  // Reads from file, which is not closed.
+  explicit PgnReader(FILE* file);
+
+  // Reads the next game. Returns false at the end of the file.
+  bool Next(PgnGame* game);
+
+  // Games read so far.
+  int games() const { return games_; }
+
+private:
+  // Returns the next character, or EOF.
+  int Get() {
+    if (pos_ == end_ && !Fill()) {
+      return EOF;
+    }
+    return static_cast<unsigned char>(buffer_[pos_++]);
+  }
+  void Unget() { --pos_; }
+  bool Fill();
+
+  FILE* file_;
+  enum { BUFFER_SIZE = 1 << 16 };
+  char buffer_[BUFFER_SIZE];
+  int pos_;
+  int end_;
+  int games_;
+
+  DISALLOW_COPY_AND_ASSIGN(PgnReader);
+};
+
+// Formats a game in export format: the seven tag roster ("?" for missing
+// tags), the other tags, and the movetext wrapped at 79 columns.
+string FormatPgn(const PgnGame& game);
+
+// Appends the game to the file in one write(2) on O_APPEND, so processes
+// can record games to the same file concurrently.
+bool AppendPgn(const string& path, const PgnGame& game);
+
+class PgnWriter {
+public:
+  // Writes to file, which is not closed.
+  explicit PgnWriter(FILE* file) : file_(file) {}
+
+  bool Write(const PgnGame& game);
+
+private:
+  FILE* file_;
+
+  DISALLOW_COPY_AND_ASSIGN(PgnWriter);
+};
+
+#endif  // game_claude_pgn_h
@@ -0,0 +1,306 @@
+//
+//  claude_san.cc
+//  Standard algebraic notation (SAN) of moves.
+//
+
+#include "claude_san.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+
+#include "claude.h"
+
+namespace {
+
+  const char* PIECE_LETTER = "?PNBRQK";
+
+  // SAN without the check mark. legal_moves are the legal moves of pos.
+  string San(const Position& pos, const Move& move, const MoveList& legal_moves) {
+    int p = abs(pos.get_board(move.from_x(), move.from_y()));
+    bool capture = pos.get_board(move.to_x(), move.to_y()) != 0;
+
+    string san;
+    if (p == 6 && move.to_x() - move.from_x() == 2) {
+      return "O-O";
+    }
+    if (p == 6 && move.from_x() - move.to_x() == 2) {
+      return "O-O-O";
+    }
+    if (p == 1) {
+      if (move.from_x() != move.to_x()) {
+        // Includes en passant, where the target square is empty.
+        san += 'a' + move.from_x();
+        capture = true;
+      }
+    } else {
+      san += PIECE_LETTER[p];
+      // Disambiguate from other pieces of the same kind reaching the square.
+      bool ambiguous = false;
+      bool same_file = false;
+      bool same_rank = false;
+      for (const Move* it = legal_moves.begin(); it != legal_moves.end(); ++it) {
+        if (it->to_x() == move.to_x() && it->to_y() == move.to_y() &&
+            (it->from_x() != move.from_x() || it->from_y() != move.from_y()) &&
+            abs(pos.get_board(it->from_x(), it->from_y())) == p) {
+          ambiguous = true;
+          same_file |= it->from_x() == move.from_x();
+          same_rank |= it->from_y() == move.from_y();
+        }
+      }
+      if (ambiguous) {
+        if (!same_file) {
+          san += 'a' + move.from_x();
+        } else if (!same_rank) {
+          san += '1' + move.from_y();
+        } else {
+          san += 'a' + move.from_x();
+          san += '1' + move.from_y();
+        }
+      }
+    }
+    if (capture) {
+      san += 'x';
+    }
+    san += 'a' + move.to_x();
+    san += '1' + move.to_y();
+    if (move.piece() != 0) {
+      san += '=';
+      san += PIECE_LETTER[abs(move.piece())];
+    }
+    return san;
+  }
+
+  int PieceOfLetter(char c) {
+    switch (c) {
+      case 'N':
+        return 2;
+      case 'B':
+        return 3;
+      case 'R':
+        return 4;
+      case 'Q':
+        return 5;
+      case 'K':
+        return 6;
+      default:
+        return 0;
+    }
+  }
+
+  // Returns true if the move does not leave the king of the side to move
+  // in check.
+  bool IsLegal(const Position& pos, const Move& move) {
+    Position next_pos;
+    pos.DoMove(move, &next_pos);
+    int king = next_pos.king_square(pos.side());
+    return !next_pos.IsAttacked(SquareX(king), SquareY(king), -pos.side());
+  }
+
+  // Finds the only legal move of a piece of the side to move (1 to 6, no
+  // castling) to (to_x, to_y), from the given file and rank if they are not
+  // -1. Only the pieces that reach the square are tried, which is much
+  // faster than generating all the moves.
+  bool FindMove(const Position& pos, int piece, int from_x, int from_y,
+                int to_x, int to_y, int promotion, Move* move) {
+    const int side = pos.side();
+    const int to = MakeSquare(to_x, to_y);
+    const int target = pos.get_board(to_x, to_y) * side;
+    if (target > 0) {
+      return false;
+    }
+    const int last_rank = (side == WHITE) ? 7 : 0;
+    if ((piece == 1 && to_y == last_rank) != (promotion != 0)) {
+      return false;
+    }
+
+    Bitboard candidates = 0;
+    if (piece == 1) {
+      int y = to_y - side;
+      if (y < 0 || y > 7) {
+        return false;
+      }
+      if (from_x < 0 || from_x == to_x) {
+        // push
+        if (target != 0) {
+          return false;
+        }
+        if (pos.get_board(to_x, y) == side) {
+          candidates = SquareBit(MakeSquare(to_x, y));
+        } else if (pos.get_board(to_x, y) == 0 &&
+                   to_y == ((side == WHITE) ? 3 : 4) &&
+                   pos.get_board(to_x, y - side) == side) {
+          candidates = SquareBit(MakeSquare(to_x, y - side));
+        }
+      } else if (abs(from_x - to_x) == 1 &&
+                 (target < 0 || to == pos.en_passant_square()) &&
+                 pos.get_board(from_x, y) == side) {
+        // capture
+        candidates = SquareBit(MakeSquare(from_x, y));
+      }
+    } else {
+      Bitboard occupied = 0;
+      Bitboard pieces = 0;
+      for (int sq = 0; sq < 64; ++sq) {
+        int p = pos.get_board(SquareX(sq), SquareY(sq));
+        if (p != 0) {
+          occupied |= SquareBit(sq);
+          if (p == piece * side) {
+            pieces |= SquareBit(sq);
+          }
+        }
+      }
+      switch (piece) {
+        case 2:
+          candidates = pieces & KnightAttacks(to);
+          break;
+        case 3:
+          candidates = pieces & BishopAttacks(to, occupied);
+          break;
+        case 4:
+          candidates = pieces & RookAttacks(to, occupied);
+          break;
+        case 5:
+          candidates = pieces & QueenAttacks(to, occupied);
+          break;
+        case 6:
+          candidates = pieces & KingAttacks(to);
+          break;
+      }
+    }
+
+    int found = 0;
+    while (candidates) {
+      int from = PopLsb(&candidates);
+      if ((from_x >= 0 && SquareX(from) != from_x) ||
+          (from_y >= 0 && SquareY(from) != from_y)) {
+        continue;
+      }
+      Move m(SquareX(from), SquareY(from), to_x, to_y, promotion * side);
+      if (IsLegal(pos, m)) {
+        if (found++) {
+          // ambiguous
+          return false;
+        }
+        *move = m;
+      }
+    }
+    return found == 1;
+  }
+
+}  // namespace
+
+string MoveToSan(const Position& pos, const Move& move) {
+  MoveList moves;
+  pos.CalcMoves(&moves);
+  string san = San(pos, move, moves);
+
+  Position next_pos;
+  pos.DoMove(move, &next_pos);
+  if (next_pos.IsCheck()) {
+    MoveList replies;
+    next_pos.CalcMoves(&replies);
+    san += replies.empty() ? '#' : '+';
+  }
+  return san;
+}
+
+// Parses the SAN into its parts and looks for the pieces that can make
+// the move. All moves are generated only for castling and coordinate
+// notation.
+bool ParseSan(const Position& pos, const string& san, Move* move) {
+  // Drop check marks and annotations.
+  size_t size = san.size();
+  while (size > 0 && (san[size - 1] == '+' || san[size - 1] == '#' ||
+                      san[size - 1] == '!' || san[size - 1] == '?')) {
+    --size;
+  }
+  string s = san.substr(0, size);
+
+  if (s == "O-O" || s == "0-0" || s == "O-O-O" || s == "0-0-0") {
+    int dx = (size == 3) ? 2 : -2;
+    MoveList moves;
+    pos.CalcMoves(&moves);
+    for (const Move* it = moves.begin(); it != moves.end(); ++it) {
+      if (abs(pos.get_board(it->from_x(), it->from_y())) == 6 &&
+          it->to_x() - it->from_x() == dx) {
+        *move = *it;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // [piece][from file][from rank][x]to[=promotion]
+  int piece = 1;
+  size_t i = 0;
+  if (size > 0 && PieceOfLetter(s[0])) {
+    piece = PieceOfLetter(s[0]);
+    i = 1;
+  }
+  int promotion = 0;
+  if (size >= 3 && piece == 1 && s[size - 2] != '=' &&
+      isdigit(s[size - 2]) && PieceOfLetter(toupper(s[size - 1]))) {
+    // "e8Q", or "e7e8q" in coordinate notation
+    promotion = PieceOfLetter(toupper(s[size - 1]));
+    --size;
+  } else if (size >= 3 && piece == 1 && s[size - 2] == '=' &&
+             PieceOfLetter(s[size - 1])) {
+    promotion = PieceOfLetter(s[size - 1]);
+    size -= 2;
+  }
+  int from_x = -1;
+  int from_y = -1;
+  int to_x = -1;
+  int to_y = -1;
+  for (; i < size; ++i) {
+    char c = s[i];
+    // A letter or digit seen before is part of the from square.
+    if (c >= 'a' && c <= 'h') {
+      if (to_x >= 0) {
+        from_x = to_x;
+      }
+      to_x = c - 'a';
+    } else if (c >= '1' && c <= '8') {
+      if (to_y >= 0) {
+        from_y = to_y;
+      }
+      to_y = c - '1';
+    } else if (c == 'x' || c == '-') {
+      // A capture, or the hyphen of long algebraic notation.
+      if (to_x >= 0) {
+        from_x = to_x;
+      }
+      if (to_y >= 0) {
+        from_y = to_y;
+      }
+      to_x = -1;
+      to_y = -1;
+    } else {
+      return false;
+    }
+  }
+  if (to_x < 0 || to_y < 0) {
+    return false;
+  }
+  if (piece != 1 || from_x < 0 || from_y < 0) {
+    return FindMove(pos, piece, from_x, from_y, to_x, to_y, promotion, move);
+  }
+
+  // Coordinate notation, where any piece may move.
+  MoveList moves;
+  pos.CalcMoves(&moves);
+  const Move* found = NULL;
+  for (const Move* it = moves.begin(); it != moves.end(); ++it) {
+    if (it->to_x() == to_x && it->to_y() == to_y &&
+        it->from_x() == from_x && it->from_y() == from_y &&
+        abs(it->piece()) == promotion) {
+      found = &*it;
+      break;
+    }
+  }
+  if (!found) {
+    return false;
+  }
+  *move = *found;
+  return true;
+}
@@ -0,0 +1,25 @@
+//
+//  claude_san.h
+//  Standard algebraic notation (SAN) of moves, e.g. "Nbd7", "exd5", "O-O",
+//  "e8=Q+".
+//
+
+#ifndef game_claude_san_h
+#define game_claude_san_h
+
+#include <string>
+
+class Move;
+class Position;
+
+// Returns the SAN of a legal move in pos, with "+" or "#" if it checks.
+std::string MoveToSan(const Position& pos, const Move& move);
+
+// Finds the legal move of pos written as san. Check marks and annotations
+// ("+", "#", "!", "?") are ignored, castling may be written with zeros and
+// the "=" of promotions may be omitted. Long algebraic ("Ng1-f3") and
+// coordinate notation ("e2e4", "e7e8q") are accepted as well. Returns false
+// if no legal move or more than one matches.
+bool ParseSan(const Position& pos, const std::string& san, Move* move);
+
+#endif  // game_claude_san_h
@@ -0,0 +1,628 @@
+//
+//  claude_server.cc
+//  Batch analysis server.
+//
+
+#include "claude_server.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "claude_tt.h"
+
+namespace {
+
+  const int DEFAULT_DEPTH = 6;
+  const int MAX_DEPTH = 64;
+  const int MAX_MULTI_PV = 64;
+
+  // Latencies kept for the percentiles.
+  const size_t LATENCY_SAMPLES = 4096;
+
+  // Where the answers to the requests of one client go. It is deleted
+  // once the client is gone and its last job answered.
+  struct Connection {
+    Connection(int fd, bool owns_fd) : fd(fd), owns_fd(owns_fd), pending(0), closed(false) {
+      pthread_mutex_init(&mutex, NULL);
+    }
+    ~Connection() {
+      pthread_mutex_destroy(&mutex);
+      if (owns_fd) {
+        close(fd);
+      }
+    }
+
+    int fd;
+    bool owns_fd;
+    // Guards the writes and the fields below.
+    pthread_mutex_t mutex;
+    int pending;
+    bool closed;
+  };
+
+  struct Job {
+    string id;
+    Position pos;
+    int depth;
+    double seconds;
+    int nodes;
+    int multi_pv;
+    double received;
+    Connection* connection;
+  };
+
+  class JobQueue {
+  public:
+    JobQueue() : closed_(false) {
+      pthread_mutex_init(&mutex_, NULL);
+      pthread_cond_init(&ready_, NULL);
+    }
+    ~JobQueue() {
+      pthread_cond_destroy(&ready_);
+      pthread_mutex_destroy(&mutex_);
+    }
+
+    void Push(Job* job) {
+      pthread_mutex_lock(&mutex_);
+      jobs_.push_back(job);
+      pthread_cond_signal(&ready_);
+      pthread_mutex_unlock(&mutex_);
+    }
+
+    // Waits for a job. Returns NULL once closed and empty.
+    Job* Pop() {
+      pthread_mutex_lock(&mutex_);
+      while (jobs_.empty() && !closed_) {
+        pthread_cond_wait(&ready_, &mutex_);
+      }
+      Job* job = NULL;
+      if (!jobs_.empty()) {
+        job = jobs_.front();
+        jobs_.pop_front();
+      }
+      pthread_mutex_unlock(&mutex_);
+      return job;
+    }
+
+    void Close() {
+      pthread_mutex_lock(&mutex_);
+      closed_ = true;
+      pthread_cond_broadcast(&ready_);
+      pthread_mutex_unlock(&mutex_);
+    }
+
+  private:
+    pthread_mutex_t mutex_;
+    pthread_cond_t ready_;
+    deque<Job*> jobs_;
+    bool closed_;
+
+    DISALLOW_COPY_AND_ASSIGN(JobQueue);
+  };
+
+  class ServerStats {
+  public:
+    ServerStats() : start_(GetTime()), jobs_(0), nodes_(0), latency_sum_(0), search_sum_(0) {
+      pthread_mutex_init(&mutex_, NULL);
+    }
+
+    void Add(double latency, double search_time, int nodes) {
+      pthread_mutex_lock(&mutex_);
+      if (latencies_.size() < LATENCY_SAMPLES) {
+        latencies_.push_back(latency);
+      } else {
+        latencies_[jobs_ % LATENCY_SAMPLES] = latency;
+      }
+      ++jobs_;
+      nodes_ += nodes;
+      latency_sum_ += latency;
+      search_sum_ += search_time;
+      pthread_mutex_unlock(&mutex_);
+    }
+
+    string ToJson() {
+      pthread_mutex_lock(&mutex_);
+      vector<double> sorted = latencies_;
+      long jobs = jobs_;
+      double nodes = nodes_;
+      double latency_sum = latency_sum_;
+      double search_sum = search_sum_;
+      pthread_mutex_unlock(&mutex_);
+
+      sort(sorted.begin(), sorted.end());
+      double elapsed = GetTime() - start_;
+      ostringstream os;
+      os << "{\"jobs\": " << jobs
+      << ", \"jobs_per_second\": " << (elapsed > 0 ? jobs / elapsed : 0)
+      << ", \"nps\": " << static_cast<long long>(search_sum > 0 ? nodes / search_sum : 0)
+      << ", \"search\": " << (jobs ? search_sum * 1000 / jobs : 0)
+      << ", \"latency\": " << (jobs ? latency_sum * 1000 / jobs : 0)
+      << ", \"latency_p50\": " << Percentile(sorted, 0.5)
+      << ", \"latency_p99\": " << Percentile(sorted, 0.99)
+      << ", \"uptime\": " << elapsed << "}";
+      return os.str();
+    }
+
+  private:
+    // in milliseconds
+    static double Percentile(const vector<double>& sorted, double p) {
+      if (sorted.empty()) {
+        return 0;
+      }
+      return sorted[min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))] * 1000;
+    }
+
+    pthread_mutex_t mutex_;
+    double start_;
+    long jobs_;
+    double nodes_;
+    double latency_sum_;
+    double search_sum_;
+    vector<double> latencies_;
+
+    DISALLOW_COPY_AND_ASSIGN(ServerStats);
+  };
+
+  struct Server {
+    const ServerOptions* options;
+    JobQueue queue;
+    ServerStats stats;
+    // Number of the next worker to start.
+    volatile int next_worker;
+  };
+
+  string JsonString(const string& s) {
+    string out = "\"";
+    for (size_t i = 0; i < s.size(); ++i) {
+      if (s[i] == '"' || s[i] == '\\') {
+        out += '\\';
+        out += s[i];
+      } else if (static_cast<unsigned char>(s[i]) < 0x20) {
+        char escape[8];
+        snprintf(escape, sizeof(escape), "\\u%04x", s[i]);
+        out += escape;
+      } else {
+        out += s[i];
+      }
+    }
+    return out + "\"";
+  }
+
+  bool WriteAll(int fd, const string& text) {
+    size_t done = 0;
+    while (done < text.size()) {
+      ssize_t n = write(fd, text.data() + done, text.size() - done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      done += n;
+    }
+    return true;
+  }
+
+  // Writes a line to the connection. Answers to clients that are gone
+  // are dropped.
+  void Reply(Connection* connection, const string& json) {
+    pthread_mutex_lock(&connection->mutex);
+    WriteAll(connection->fd, json + "\n");
+    pthread_mutex_unlock(&connection->mutex);
+  }
+
+  // Called when a job of the connection is answered, or with job_done
+  // false when its client is gone.
+  void Release(Connection* connection, bool job_done) {
+    pthread_mutex_lock(&connection->mutex);
+    if (job_done) {
+      --connection->pending;
+    } else {
+      connection->closed = true;
+    }
+    bool last = connection->closed && connection->pending == 0;
+    pthread_mutex_unlock(&connection->mutex);
+    if (last) {
+      delete connection;
+    }
+  }
+
+  // "cp" or "mate" and the score, as UCI reports them.
+  string ScoreJson(int score) {
+    ostringstream os;
+    if (score > MATE_SCORE - 1000) {
+      os << "\"mate\": " << (MATE_SCORE - score + 1) / 2;
+    } else if (score < -(MATE_SCORE - 1000)) {
+      os << "\"mate\": " << -(MATE_SCORE + score) / 2;
+    } else {
+      os << "\"cp\": " << score;
+    }
+    return os.str();
+  }
+
+  // Records the depth of the last completed iteration.
+  class DepthListener : public SearchListener {
+  public:
+    DepthListener() : depth_(0) {}
+
+    virtual void OnIteration(int depth, int score, const Move& best_move, int nodes) {
+      depth_ = depth;
+    }
+
+    int depth() const { return depth_; }
+
+  private:
+    int depth_;
+  };
+
+  void RunJob(Job* job, TranspositionTable* tt, int worker, ServerStats* stats) {
+    MinMaxPlayer player(job->depth);
+    player.set_time_limit(job->seconds);
+    player.set_node_limit(job->nodes);
+    player.set_hash_table(tt);
+    player.set_multi_pv(job->multi_pv);
+    DepthListener listener;
+    player.set_listener(&listener);
+
+    double start = GetTime();
+    Move move;
+    bool found = player.NextMove(job->pos, &move);
+    double end = GetTime();
+    stats->Add(end - job->received, end - start, player.nodes());
+
+    ostringstream os;
+    os << "{\"id\": " << JsonString(job->id)
+    << ", \"bestmove\": " << JsonString(found ? move.ToString() : "0000")
+    << ", " << ScoreJson(player.score());
+    if (job->multi_pv > 1) {
+      const vector<PvLine>& lines = player.lines();
+      os << ", \"lines\": [";
+      for (size_t i = 0; i < lines.size(); ++i) {
+        os << (i ? ", " : "") << "{" << ScoreJson(lines[i].score) << ", \"pv\": \"";
+        for (size_t j = 0; j < lines[i].moves.size(); ++j) {
+          os << (j ? " " : "") << lines[i].moves[j].ToString();
+        }
+        os << "\"}";
+      }
+      os << "]";
+    }
+    os << ", \"depth\": " << listener.depth()
+    << ", \"nodes\": " << player.nodes()
+    << ", \"tbhits\": " << player.tb_hits()
+    << ", \"time\": " << (end - start) * 1000
+    << ", \"latency\": " << (end - job->received) * 1000
+    << ", \"worker\": " << worker << "}";
+    Reply(job->connection, os.str());
+  }
+
+  void* Worker(void* arg) {
+    Server* server = static_cast<Server*>(arg);
+    int worker = __sync_fetch_and_add(&server->next_worker, 1);
+    TranspositionTable tt;
+    if (!tt.Resize(server->options->hash_megabytes)) {
+      cerr << "worker " << worker << ": no memory for the hash table" << endl;
+    }
+    while (Job* job = server->queue.Pop()) {
+      RunJob(job, &tt, worker, &server->stats);
+      Release(job->connection, true);
+      delete job;
+    }
+    return NULL;
+  }
+
+  // Turns a request into a job. Returns false and sets error if it is
+  // malformed.
+  bool ParseJob(const map<string, string>& fields, Job* job, string* error) {
+    map<string, string>::const_iterator it = fields.find("fen");
+    if (it == fields.end()) {
+      *error = "missing fen";
+      return false;
+    }
+    if (!Position::ParseFen(it->second, &job->pos)) {
+      *error = "invalid fen";
+      return false;
+    }
+    it = fields.find("id");
+    job->id = (it == fields.end()) ? "" : it->second;
+    it = fields.find("depth");
+    job->depth = (it == fields.end()) ? 0 : atoi(it->second.c_str());
+    it = fields.find("movetime");
+    job->seconds = (it == fields.end()) ? 0 : atof(it->second.c_str()) / 1000;
+    it = fields.find("nodes");
+    job->nodes = (it == fields.end()) ? 0 : atoi(it->second.c_str());
+    it = fields.find("multipv");
+    job->multi_pv = (it == fields.end()) ? 1 : max(1, min(atoi(it->second.c_str()), MAX_MULTI_PV));
+    if (job->depth <= 0) {
+      job->depth = (job->seconds > 0 || job->nodes > 0) ? MAX_DEPTH : DEFAULT_DEPTH;
+    }
+    job->depth = min(job->depth, MAX_DEPTH);
+    return true;
+  }
+
+  void HandleLine(const string& line, Connection* connection, Server* server) {
+    if (line.find_first_not_of(" \t\r") == string::npos) {
+      return;
+    }
+    map<string, string> fields;
+    if (!ParseJsonObject(line, &fields)) {
+      Reply(connection, "{\"error\": \"malformed request\"}");
+      return;
+    }
+    if (fields.count("cmd")) {
+      if (fields["cmd"] == "stats") {
+        Reply(connection, server->stats.ToJson());
+      } else {
+        Reply(connection, "{\"error\": " + JsonString("unknown cmd " + fields["cmd"]) + "}");
+      }
+      return;
+    }
+    Job* job = new Job;
+    string error;
+    if (!ParseJob(fields, job, &error)) {
+      Reply(connection, "{\"id\": " + JsonString(fields["id"]) +
+            ", \"error\": " + JsonString(error) + "}");
+      delete job;
+      return;
+    }
+    job->received = GetTime();
+    job->connection = connection;
+    pthread_mutex_lock(&connection->mutex);
+    ++connection->pending;
+    pthread_mutex_unlock(&connection->mutex);
+    server->queue.Push(job);
+  }
+
+  // Reads the requests of a client until it is gone.
+  void ReadRequests(int fd, Connection* connection, Server* server) {
+    char buffer[1 << 16];
+    string line;
+    while (1) {
+      ssize_t n = read(fd, buffer, sizeof(buffer));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      for (ssize_t i = 0; i < n; ++i) {
+        if (buffer[i] == '\n') {
+          HandleLine(line, connection, server);
+          line.clear();
+        } else {
+          line += buffer[i];
+        }
+      }
+    }
+    HandleLine(line, connection, server);
+  }
+
+  struct Client {
+    int fd;
+    Server* server;
+  };
+
+  void* ClientReader(void* arg) {
+    Client* client = static_cast<Client*>(arg);
+    Connection* connection = new Connection(client->fd, true);
+    ReadRequests(client->fd, connection, client->server);
+    shutdown(client->fd, SHUT_RD);
+    Release(connection, false);
+    delete client;
+    return NULL;
+  }
+
+  int Listen(const string& path, Server* server) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (fd < 0 || path.size() >= sizeof(address.sun_path)) {
+      cerr << "Cannot create socket " << path << endl;
+      return 1;
+    }
+    strcpy(address.sun_path, path.c_str());
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(fd, 64) != 0) {
+      cerr << "Cannot listen on " << path << ": " << strerror(errno) << endl;
+      close(fd);
+      return 1;
+    }
+    cerr << "Listening on " << path << endl;
+    while (1) {
+      int client_fd = accept(fd, NULL, NULL);
+      if (client_fd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) {
+          continue;
+        }
+        cerr << "accept: " << strerror(errno) << endl;
+        close(fd);
+        return 1;
+      }
+      Client* client = new Client;
+      client->fd = client_fd;
+      client->server = server;
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, ClientReader, client) != 0) {
+        close(client_fd);
+        delete client;
+        continue;
+      }
+      pthread_detach(thread);
+    }
+  }
+
+  // Appends the UTF-8 encoding of a code point.
+  void AppendUtf8(unsigned code, string* out) {
+    if (code < 0x80) {
+      *out += static_cast<char>(code);
+    } else if (code < 0x800) {
+      *out += static_cast<char>(0xc0 | (code >> 6));
+      *out += static_cast<char>(0x80 | (code & 0x3f));
+    } else {
+      *out += static_cast<char>(0xe0 | (code >> 12));
+      *out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+      *out += static_cast<char>(0x80 | (code & 0x3f));
+    }
+  }
+
+  // Reads a JSON string starting after its opening quote.
+  bool ParseJsonString(const string& s, size_t* i, string* out) {
+    out->clear();
+    while (*i < s.size()) {
+      char c = s[(*i)++];
+      if (c == '"') {
+        return true;
+      }
+      if (c != '\\') {
+        *out += c;
+        continue;
+      }
+      if (*i >= s.size()) {
+        return false;
+      }
+      c = s[(*i)++];
+      switch (c) {
+        case 'n':
+          *out += '\n';
+          break;
+        case 't':
+          *out += '\t';
+          break;
+        case 'r':
+          *out += '\r';
+          break;
+        case 'b':
+          *out += '\b';
+          break;
+        case 'f':
+          *out += '\f';
+          break;
+        case 'u': {
+          if (*i + 4 > s.size()) {
+            return false;
+          }
+          char* end;
+          string hex = s.substr(*i, 4);
+          unsigned code = strtoul(hex.c_str(), &end, 16);
+          if (end != hex.c_str() + 4) {
+            return false;
+          }
+          AppendUtf8(code, out);
+          *i += 4;
+          break;
+        }
+        default:
+          // '"', '\\' and '/'
+          *out += c;
+          break;
+      }
+    }
+    return false;
+  }
+
+}  // namespace
+
+bool ParseJsonObject(const string& line, map<string, string>* fields) {
+  fields->clear();
+  size_t i = line.find_first_not_of(" \t\r");
+  if (i == string::npos || line[i] != '{') {
+    return false;
+  }
+  ++i;
+  while (1) {
+    i = line.find_first_not_of(" \t\r", i);
+    if (i == string::npos) {
+      return false;
+    }
+    if (line[i] == '}' && fields->empty()) {
+      break;
+    }
+    string name;
+    if (line[i] != '"' || !ParseJsonString(line, &++i, &name)) {
+      return false;
+    }
+    i = line.find_first_not_of(" \t\r", i);
+    if (i == string::npos || line[i] != ':') {
+      return false;
+    }
+    i = line.find_first_not_of(" \t\r", i + 1);
+    if (i == string::npos) {
+      return false;
+    }
+    string value;
+    if (line[i] == '"') {
+      if (!ParseJsonString(line, &++i, &value)) {
+        return false;
+      }
+    } else {
+      // number, true, false or null
+      size_t end = line.find_first_of(",} \t\r", i);
+      if (end == string::npos || end == i) {
+        return false;
+      }
+      value = line.substr(i, end - i);
+      for (size_t j = 0; j < value.size(); ++j) {
+        if (!isalnum(value[j]) && !strchr("+-.", value[j])) {
+          return false;
+        }
+      }
+      i = end;
+    }
+    (*fields)[name] = value;
+    i = line.find_first_not_of(" \t\r", i);
+    if (i == string::npos) {
+      return false;
+    }
+    if (line[i] == '}') {
+      break;
+    }
+    if (line[i] != ',') {
+      return false;
+    }
+    ++i;
+  }
+  return line.find_first_not_of(" \t\r", i + 1) == string::npos;
+}
+
+int RunAnalysisServer(const ServerOptions& options) {
+  // A client may leave before its answers are written.
+  signal(SIGPIPE, SIG_IGN);
+
+  Server server;
+  server.options = &options;
+  server.next_worker = 0;
+  int workers = max(1, options.workers);
+  vector<pthread_t> threads(workers);
+  for (int i = 0; i < workers; ++i) {
+    pthread_create(&threads[i], NULL, Worker, &server);
+  }
+
+  if (!options.socket_path.empty()) {
+    return Listen(options.socket_path, &server);
+  }
+
+  // The connection of stdin outlives the workers.
+  Connection connection(STDOUT_FILENO, false);
+  ReadRequests(STDIN_FILENO, &connection, &server);
+  server.queue.Close();
+  for (int i = 0; i < workers; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  cerr << server.stats.ToJson() << endl;
+  return 0;
+}
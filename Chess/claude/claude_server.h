@@ -0,0 +1,58 @@
+//
+//  claude_server.h
+//  Batch analysis server.
+//
+//  Requests are JSON objects, one per line, read from stdin or from the
+//  connections of a Unix domain socket:
+//
+//    {"id": "q1", "fen": "...", "depth": 8, "movetime": 500, "nodes": 100000,
+//     "multipv": 3}
+//
+//  depth, movetime (milliseconds) and nodes limit the search; without any
+//  the depth is DEFAULT_DEPTH. A pool of workers searches the positions,
+//  each with its own transposition table kept warm from job to job, and
+//  answers on the connection of the request, in the order of completion:
+//
+//    {"id": "q1", "bestmove": "e2e4", "cp": 35, "depth": 8, "nodes": 52113,
+//     "tbhits": 0, "time": 41.2, "latency": 43.0, "worker": 2}
+//
+//  with "mate" instead of "cp" for mate scores; time is the search and
+//  latency the whole stay of the job in the server, in milliseconds. With
+//  multipv above 1, the answer also has the lines, best first:
+//
+//    "lines": [{"cp": 35, "pv": "e2e4 e7e5 g1f3"}, {"cp": 20, "pv": ...}]
+//
+//  {"cmd": "stats"} answers with the throughput and latency so far.
+//
+
+#ifndef game_claude_server_h
+#define game_claude_server_h
+
+#include <stddef.h>
+
+#include <map>
+#include <string>
+
+#include "claude.h"
+
+struct ServerOptions {
+  ServerOptions() : workers(1), hash_megabytes(16) {}
+
+  int workers;
+  // Transposition table of each worker.
+  size_t hash_megabytes;
+  // Unix domain socket to listen on; stdin and stdout if empty.
+  string socket_path;
+};
+
+// Parses a JSON object of strings, numbers, booleans and nulls, the
+// values kept as their text (strings unescaped). Returns false for
+// anything else, nested objects and arrays included.
+bool ParseJsonObject(const string& line, map<string, string>* fields);
+
+// Serves requests until stdin ends, then waits for the jobs in progress
+// and prints the stats to stderr. In socket mode, serves forever.
+// Returns nonzero if the server cannot start.
+int RunAnalysisServer(const ServerOptions& options);
+
+#endif  // game_claude_server_h
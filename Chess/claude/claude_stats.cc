@@ -0,0 +1,71 @@
+//
+//  claude_stats.cc
+//  Profiling counters of the search.
+//
+
+#include "claude_stats.h"
+
+#include <iomanip>
+#include <iostream>
+
+#include <string.h>
+#include <time.h>
+
+uint64_t GetTicksSlow() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void SearchStats::Clear() {
+  memset(this, 0, sizeof(*this));
+}
+
+namespace {
+
+  double Percent(uint64_t part, uint64_t total) {
+    return total ? 100.0 * part / total : 0.0;
+  }
+
+}  // namespace
+
+void SearchStats::Print(std::ostream& out) const {
+  using std::endl;
+  std::ios::fmtflags flags = out.flags();
+  std::streamsize precision = out.precision();
+  out << std::fixed << std::setprecision(1);
+
+  out << "nodes " << main_nodes << endl;
+
+  out << "tt probes " << tt_probes
+  << " hits " << tt_hits << " (" << Percent(tt_hits, tt_probes) << "%)"
+  << " cutoffs " << tt_cutoffs << " (" << Percent(tt_cutoffs, tt_probes) << "%)"
+  << endl;
+
+  out << "movegen calls " << movegen_calls << ", eval calls " << eval_calls << endl;
+
+  uint64_t search_ticks = total_ticks - movegen_ticks - eval_ticks;
+  out << "time movegen " << Percent(movegen_ticks, total_ticks) << "%"
+  << ", eval " << Percent(eval_ticks, total_ticks) << "%"
+  << ", search " << Percent(search_ticks, total_ticks) << "%" << endl;
+
+  // Effective branching factor: growth of the tree from one iteration to the
+  // next.
+  out << "ebf";
+  for (int depth = 2; depth <= iterations && depth < MAX_PLY; ++depth) {
+    if (iteration_nodes[depth - 1]) {
+      out << " " << static_cast<double>(iteration_nodes[depth]) / iteration_nodes[depth - 1];
+    }
+  }
+  out << endl;
+
+  out << "ply nodes" << endl;
+  for (int ply = 0; ply < MAX_PLY; ++ply) {
+    if (nodes[ply]) {
+      out << std::setw(3) << ply << " " << nodes[ply] << endl;
+    }
+  }
+
+  out.flags(flags);
+  out.precision(precision);
+}
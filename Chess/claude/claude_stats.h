@@ -0,0 +1,73 @@
+//
+//  claude_stats.h
+//  Profiling counters of the search.
+//
+//  The counters are compiled in only with -DCLAUDE_STATS. Otherwise the
+//  SEARCH_STATS() hooks expand to nothing and the search runs unchanged.
+//
+
+#ifndef game_claude_stats_h
+#define game_claude_stats_h
+
+#include <stdint.h>
+
+#include <iosfwd>
+
+// Returns a monotonic tick count, cheap enough to be read at every node.
+inline uint64_t GetTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  extern uint64_t GetTicksSlow();
+  return GetTicksSlow();
+#endif
+}
+
+// Counters of one search, cleared at its start.
+struct SearchStats {
+  enum { MAX_PLY = 64 };
+
+  void Clear();
+
+  // Prints the counters and the per-ply histogram.
+  void Print(std::ostream& out) const;
+
+  // Nodes entered at each ply; the deepest plies share the last slot.
+  uint64_t nodes[MAX_PLY];
+  // Nodes searched by each iteration, indexed by its depth.
+  uint64_t iteration_nodes[MAX_PLY];
+  int iterations;
+
+  uint64_t main_nodes;
+
+  uint64_t tt_probes;
+  uint64_t tt_hits;
+  uint64_t tt_cutoffs;
+
+  uint64_t movegen_calls;
+  uint64_t eval_calls;
+
+  // Ticks spent generating moves, evaluating and in the whole search.
+  uint64_t movegen_ticks;
+  uint64_t eval_ticks;
+  uint64_t total_ticks;
+};
+
+// Adds the ticks of its scope to a counter.
+class StatsTimer {
+public:
+  explicit StatsTimer(uint64_t* ticks) : ticks_(ticks), start_(GetTicks()) {}
+  ~StatsTimer() { *ticks_ += GetTicks() - start_; }
+
+private:
+  uint64_t* ticks_;
+  uint64_t start_;
+};
+
+#ifdef CLAUDE_STATS
+#define SEARCH_STATS(statement) statement
+#else
+#define SEARCH_STATS(statement)
+#endif
+
+#endif  // game_claude_stats_h
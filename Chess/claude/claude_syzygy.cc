@@ -0,0 +1,1258 @@
+//
+//  claude_syzygy.cc
+//  Probing of Syzygy endgame tablebases (.rtbw and .rtbz files).
+//
+//  The file format is the one of the tablebase generator by Ronald de Man.
+//  A table stores one value per position index; the positions are indexed
+//  by groups of pieces, after mirroring the leading piece (or pawn) to the
+//  a1-d1-d4 triangle (or the a-d files), and the values are compressed by
+//  recursive pairing followed by a canonical Huffman code, in blocks that
+//  can be decoded independently.
+//
+
+#include "claude_syzygy.h"
+
+#include <ctype.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "claude_bitbase.h"
+
+namespace {
+
+  // Pieces of the largest tables, kings included.
+  const int TB_PIECES = 7;
+
+  // Pieces of the tables VerifySyzygy checks. Larger tables are not
+  // probed: nothing shows yet that they decode right.
+  const int CHECKED_PIECES = 3;
+
+  // Positions sampled by InitSyzygy: about 3000, a few seconds at most.
+  const int CHECK_STRIDE = 997;
+  // Mismatches printed by VerifySyzygy.
+  const int MAX_PRINTED_MISMATCHES = 10;
+
+  enum {
+    WDL_TABLE,
+    DTZ_TABLE
+  };
+
+  // Flags of the values of a table.
+  enum {
+    FLAG_STM = 1,
+    FLAG_MAPPED = 2,
+    FLAG_WIN_PLIES = 4,
+    FLAG_LOSS_PLIES = 8,
+    FLAG_WIDE = 16,
+    FLAG_SINGLE_VALUE = 128
+  };
+
+  enum ProbeState {
+    PROBE_FAIL,
+    PROBE_OK,
+    // The DTZ table stores the other side to move.
+    PROBE_CHANGE_STM,
+    // The best move is a capture or a pawn move; DTZ does not apply.
+    PROBE_ZEROING_BEST_MOVE
+  };
+
+  // The files store numbers in either byte order, whatever the host.
+  uint16_t ReadLe16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+  }
+
+  uint32_t ReadLe32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+  }
+
+  uint32_t ReadBe32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+  }
+
+  uint64_t ReadBe64(const uint8_t* p) {
+    return (static_cast<uint64_t>(ReadBe32(p)) << 32) | ReadBe32(p + 4);
+  }
+
+  // Children of a symbol of the recursive pairing, 12 bits each. A leaf
+  // has 0xfff on the right and its value on the left.
+  int LeftSymbol(const uint8_t* btree, int sym) {
+    const uint8_t* lr = btree + 3 * sym;
+    return ((lr[1] & 0xf) << 8) | lr[0];
+  }
+
+  int RightSymbol(const uint8_t* btree, int sym) {
+    const uint8_t* lr = btree + 3 * sym;
+    return (lr[2] << 4) | (lr[1] >> 4);
+  }
+
+  // Decoding and indexing data of one table of a file. A file has one
+  // table per side to move (WDL files of unlike sides only) and per file
+  // of the leading pawn (files with pawns only).
+  struct PairsData {
+    PairsData()
+    : flags(0), max_sym_len(0), min_sym_len(0), num_blocks(0), block_size(0),
+    span(0), lowest_sym(NULL), btree(NULL), block_length(NULL),
+    block_length_size(0), sparse_index(NULL), sparse_index_size(0), data(NULL) {
+      memset(pieces, 0, sizeof(pieces));
+      memset(group_idx, 0, sizeof(group_idx));
+      memset(group_len, 0, sizeof(group_len));
+      memset(map_idx, 0, sizeof(map_idx));
+    }
+
+    uint8_t flags;
+    // Lengths in bits of the Huffman codes.
+    uint8_t max_sym_len;
+    uint8_t min_sym_len;
+    uint32_t num_blocks;
+    uint64_t block_size;
+    // Every span values have an entry in sparse_index.
+    uint64_t span;
+    // Little endian 16 bit lowest symbol of each code length.
+    const uint8_t* lowest_sym;
+    const uint8_t* btree;
+    // Little endian 16 bit number of values minus one of each block.
+    const uint8_t* block_length;
+    uint32_t block_length_size;
+    // 6 byte entries: block number and offset of the value within it.
+    const uint8_t* sparse_index;
+    uint64_t sparse_index_size;
+    const uint8_t* data;
+    // base64[l - min_sym_len] is the lowest code of length l, left aligned.
+    vector<uint64_t> base64;
+    // Number of values minus one that each symbol expands to.
+    vector<uint8_t> sym_len;
+    // Pieces in index order (1-6 white, 9-14 black), which defines the
+    // groups of pieces encoded together.
+    int pieces[TB_PIECES];
+    uint64_t group_idx[TB_PIECES + 1];
+    int group_len[TB_PIECES + 1];
+    // Offsets in the DTZ value map of wins, losses, cursed wins and
+    // blessed losses.
+    uint32_t map_idx[4];
+  };
+
+  struct TbTable {
+    TbTable() : ready(false), base(NULL), mapped_size(0), map(NULL) {}
+
+    // Set once the file was looked for; base is NULL if it is missing.
+    volatile bool ready;
+    void* base;
+    size_t mapped_size;
+    // DTZ value map.
+    const uint8_t* map;
+    PairsData items[2][4];
+  };
+
+  // An endgame, like KRvK, with its WDL and DTZ tables.
+  struct TbEntry {
+    string name;
+    // Material keys with the pieces of the name on the white side, and on
+    // the black side.
+    uint64_t key;
+    uint64_t key2;
+    int piece_count;
+    bool has_pawns;
+    bool has_unique_pieces;
+    // Pawns of the leading color, and of the other one.
+    int pawn_count[2];
+    TbTable tables[2];
+  };
+
+  // Indexing tables, see InitIndexTables().
+  int map_pawns[64];
+  int map_b1h1h7[64];
+  int map_a1d1d4[64];
+  int map_kk[10][64];
+  int binomial[6][64];
+  int lead_pawn_idx[6][64];
+  int lead_pawns_size[6][4];
+
+  vector<string> paths;
+  vector<TbEntry*> entries;
+  map<uint64_t, TbEntry*> entry_by_key;
+  int largest = 0;
+  // Set once the tables passed VerifySyzygy.
+  bool verified = false;
+  pthread_mutex_t map_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+  // Signed distance of the square from the a1-h8 diagonal, above it if
+  // positive.
+  int OffDiagonal(int sq) {
+    return SquareY(sq) - SquareX(sq);
+  }
+
+  bool PawnsLess(int a, int b) {
+    return map_pawns[a] < map_pawns[b];
+  }
+
+  void InitIndexTables() {
+    // b1-h1-h7 triangle to 0..27
+    int code = 0;
+    for (int sq = 0; sq < 64; ++sq) {
+      if (OffDiagonal(sq) < 0) {
+        map_b1h1h7[sq] = code++;
+      }
+    }
+
+    // a1-d1-d4 triangle to 0..9, the diagonal last
+    vector<int> diagonal;
+    code = 0;
+    for (int sq = 0; sq <= MakeSquare(3, 3); ++sq) {
+      if (OffDiagonal(sq) < 0 && SquareX(sq) <= 3) {
+        map_a1d1d4[sq] = code++;
+      } else if (OffDiagonal(sq) == 0 && SquareX(sq) <= 3) {
+        diagonal.push_back(sq);
+      }
+    }
+    for (size_t i = 0; i < diagonal.size(); ++i) {
+      map_a1d1d4[diagonal[i]] = code++;
+    }
+
+    // The 462 legal placements of two kings, the first in the a1-d1-d4
+    // triangle and the second not above the diagonal if the first is on
+    // it; placements with both on the diagonal last.
+    vector<pair<int, int> > both_on_diagonal;
+    code = 0;
+    for (int idx = 0; idx < 10; ++idx) {
+      for (int s1 = 0; s1 <= MakeSquare(3, 3); ++s1) {
+        // b1 is mapped to 0 like the squares outside the triangle.
+        if (map_a1d1d4[s1] != idx || (idx == 0 && s1 != MakeSquare(1, 0))) {
+          continue;
+        }
+        for (int s2 = 0; s2 < 64; ++s2) {
+          if ((KingAttacks(s1) | SquareBit(s1)) & SquareBit(s2)) {
+            continue;
+          } else if (OffDiagonal(s1) == 0 && OffDiagonal(s2) > 0) {
+            continue;
+          } else if (OffDiagonal(s1) == 0 && OffDiagonal(s2) == 0) {
+            both_on_diagonal.push_back(make_pair(idx, s2));
+          } else {
+            map_kk[idx][s2] = code++;
+          }
+        }
+      }
+    }
+    for (size_t i = 0; i < both_on_diagonal.size(); ++i) {
+      map_kk[both_on_diagonal[i].first][both_on_diagonal[i].second] = code++;
+    }
+
+    // binomial[k][n]: ways to choose k of n
+    binomial[0][0] = 1;
+    for (int n = 1; n < 64; ++n) {
+      for (int k = 0; k < 6 && k <= n; ++k) {
+        binomial[k][n] = (k > 0 ? binomial[k - 1][n - 1] : 0) +
+        (k < n ? binomial[k][n - 1] : 0);
+      }
+    }
+
+    // map_pawns[] numbers a2-h7 so that the leading pawn, the one with the
+    // highest value, is the nearest to the edge and the lowest on its file.
+    // Then lead_pawn_idx[] indexes the leading pawns by file.
+    int available = 47;
+    for (int count = 1; count <= 5; ++count) {
+      for (int f = 0; f < 4; ++f) {
+        int idx = 0;
+        for (int r = 1; r <= 6; ++r) {
+          int sq = MakeSquare(f, r);
+          if (count == 1) {
+            map_pawns[sq] = available--;
+            map_pawns[sq ^ 7] = available--;
+          }
+          lead_pawn_idx[count][sq] = idx;
+          idx += binomial[count - 1][map_pawns[sq]];
+        }
+        lead_pawns_size[count][f] = idx;
+      }
+    }
+  }
+
+  // Material key: 4 bits of count per piece type but the king, white in
+  // the low 20 bits.
+  uint64_t PieceKey(int piece) {
+    return 1ULL << (4 * (abs(piece) - 1) + (piece < 0 ? 20 : 0));
+  }
+
+  uint64_t SwapKey(uint64_t key) {
+    return (key >> 20) | ((key & 0xfffff) << 20);
+  }
+
+  // Parses a table name like "KRPvKR". Returns false if it is not one.
+  bool ParseName(const string& name, TbEntry* e) {
+    static const char LETTERS[] = "PNBRQK";
+    e->name = name;
+    e->key = 0;
+    e->piece_count = 0;
+    int side = 1;
+    int pawns[2] = { 0, 0 };
+    int counts[2][6];
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < name.size(); ++i) {
+      if (name[i] == 'v' && side == 1 && i > 0) {
+        side = -1;
+        continue;
+      }
+      const char* letter = strchr(LETTERS, name[i]);
+      if (!letter || !*letter) {
+        return false;
+      }
+      int piece = (letter - LETTERS + 1) * side;
+      counts[side < 0][abs(piece) - 1]++;
+      if (abs(piece) != 6) {
+        e->key += PieceKey(piece);
+      }
+      if (abs(piece) == 1) {
+        pawns[side < 0]++;
+      }
+      ++e->piece_count;
+    }
+    if (side == 1 || counts[0][5] != 1 || counts[1][5] != 1 ||
+        e->piece_count > TB_PIECES) {
+      return false;
+    }
+    e->key2 = SwapKey(e->key);
+    e->has_pawns = pawns[0] + pawns[1] > 0;
+    e->has_unique_pieces = false;
+    for (int s = 0; s < 2; ++s) {
+      for (int p = 0; p < 5; ++p) {
+        if (counts[s][p] == 1) {
+          e->has_unique_pieces = true;
+        }
+      }
+    }
+    // The leading color has the fewer pawns, or white if equal.
+    bool white_leads = !pawns[1] || (pawns[0] && pawns[1] >= pawns[0]);
+    e->pawn_count[0] = white_leads ? pawns[0] : pawns[1];
+    e->pawn_count[1] = white_leads ? pawns[1] : pawns[0];
+    return true;
+  }
+
+  PairsData* GetPairs(TbEntry* e, int type, int stm, int file) {
+    return &e->tables[type].items[type == WDL_TABLE ? stm : 0][e->has_pawns ? file : 0];
+  }
+
+  // Splits the pieces in groups and computes the factor of each group in
+  // the index. The order of the groups in the index is given by the file.
+  void SetGroups(const TbEntry& e, PairsData* d, const int order[2], int file) {
+    int n = 0;
+    int first_len = e.has_pawns ? 0 : (e.has_unique_pieces ? 3 : 2);
+    d->group_len[n] = 1;
+    for (int i = 1; i < e.piece_count; ++i) {
+      if (--first_len > 0 || d->pieces[i] == d->pieces[i - 1]) {
+        d->group_len[n]++;
+      } else {
+        d->group_len[++n] = 1;
+      }
+    }
+    d->group_len[++n] = 0;
+
+    // pawns on both sides
+    bool pp = e.has_pawns && e.pawn_count[1];
+    int next = pp ? 2 : 1;
+    int free_squares = 64 - d->group_len[0] - (pp ? d->group_len[1] : 0);
+    uint64_t idx = 1;
+    for (int k = 0; next < n || k == order[0] || k == order[1]; ++k) {
+      if (k == order[0]) {
+        // leading pawns or pieces
+        d->group_idx[0] = idx;
+        idx *= e.has_pawns ? lead_pawns_size[d->group_len[0]][file]
+        : (e.has_unique_pieces ? 31332 : 462);
+      } else if (k == order[1]) {
+        // other pawns
+        d->group_idx[1] = idx;
+        idx *= binomial[d->group_len[1]][48 - d->group_len[0]];
+      } else {
+        // other pieces
+        d->group_idx[next] = idx;
+        idx *= binomial[d->group_len[next]][free_squares];
+        free_squares -= d->group_len[next++];
+      }
+    }
+    d->group_idx[n] = idx;
+  }
+
+  // Number of values minus one that a symbol expands to.
+  int SetSymLen(PairsData* d, int sym, vector<bool>* visited) {
+    (*visited)[sym] = true;
+    int right = RightSymbol(d->btree, sym);
+    if (right == 0xfff) {
+      return 0;
+    }
+    int left = LeftSymbol(d->btree, sym);
+    if (!(*visited)[left]) {
+      d->sym_len[left] = SetSymLen(d, left, visited);
+    }
+    if (!(*visited)[right]) {
+      d->sym_len[right] = SetSymLen(d, right, visited);
+    }
+    return d->sym_len[left] + d->sym_len[right] + 1;
+  }
+
+  const uint8_t* SetSizes(PairsData* d, const uint8_t* data) {
+    d->flags = *data++;
+    if (d->flags & FLAG_SINGLE_VALUE) {
+      // The value is kept in min_sym_len.
+      d->min_sym_len = *data++;
+      return data;
+    }
+
+    uint64_t table_size = d->group_idx[find(d->group_len, d->group_len + TB_PIECES, 0) -
+                                       d->group_len];
+    d->block_size = 1ULL << *data++;
+    d->span = 1ULL << *data++;
+    d->sparse_index_size = (table_size + d->span - 1) / d->span;
+    int padding = *data++;
+    d->num_blocks = ReadLe32(data);
+    data += 4;
+    // padded so that the sparse index does not point out of range
+    d->block_length_size = d->num_blocks + padding;
+    d->max_sym_len = *data++;
+    d->min_sym_len = *data++;
+    d->lowest_sym = data;
+    if (d->max_sym_len < d->min_sym_len || d->max_sym_len > 32) {
+      return NULL;
+    }
+    d->base64.assign(d->max_sym_len - d->min_sym_len + 1, 0);
+
+    // Longer codes have lower values in the canonical code, so the lowest
+    // code of each length, left aligned to 64 bits, decreases with the
+    // length; the length of a code is found by comparing with these.
+    for (int i = static_cast<int>(d->base64.size()) - 2; i >= 0; --i) {
+      d->base64[i] = (d->base64[i + 1] + ReadLe16(d->lowest_sym + 2 * i) -
+                      ReadLe16(d->lowest_sym + 2 * (i + 1))) / 2;
+    }
+    for (size_t i = 0; i < d->base64.size(); ++i) {
+      d->base64[i] <<= 64 - i - d->min_sym_len;
+    }
+
+    data += d->base64.size() * 2;
+    d->sym_len.assign(ReadLe16(data), 0);
+    data += 2;
+    d->btree = data;
+    vector<bool> visited(d->sym_len.size());
+    for (size_t sym = 0; sym < d->sym_len.size(); ++sym) {
+      if (!visited[sym]) {
+        d->sym_len[sym] = SetSymLen(d, sym, &visited);
+      }
+    }
+    return data + d->sym_len.size() * 3 + (d->sym_len.size() & 1);
+  }
+
+  // DTZ values are stored by rank of frequency; the map gives them back.
+  const uint8_t* SetDtzMap(TbTable* t, const uint8_t* data, int max_file) {
+    t->map = data;
+    for (int f = 0; f <= max_file; ++f) {
+      PairsData* d = &t->items[0][f];
+      if (!(d->flags & FLAG_MAPPED)) {
+        continue;
+      }
+      if (d->flags & FLAG_WIDE) {
+        data += reinterpret_cast<uintptr_t>(data) & 1;
+        for (int i = 0; i < 4; ++i) {
+          d->map_idx[i] = data - t->map + 2;
+          data += 2 * ReadLe16(data) + 2;
+        }
+      } else {
+        for (int i = 0; i < 4; ++i) {
+          d->map_idx[i] = data - t->map + 1;
+          data += *data + 1;
+        }
+      }
+    }
+    return data + (reinterpret_cast<uintptr_t>(data) & 1);
+  }
+
+  // Reads the layout of a mapped file, data pointing after the magic.
+  bool SetUp(TbEntry* e, int type, const uint8_t* data, const uint8_t* end) {
+    enum { SPLIT = 1, HAS_PAWNS = 2 };
+    if (e->has_pawns != ((*data & HAS_PAWNS) != 0) ||
+        (e->key != e->key2) != ((*data & SPLIT) != 0)) {
+      return false;
+    }
+    ++data;
+
+    TbTable* t = &e->tables[type];
+    int sides = (type == WDL_TABLE && e->key != e->key2) ? 2 : 1;
+    int max_file = e->has_pawns ? 3 : 0;
+    bool pp = e->has_pawns && e->pawn_count[1];
+    for (int f = 0; f <= max_file; ++f) {
+      for (int i = 0; i < sides; ++i) {
+        t->items[i][f] = PairsData();
+      }
+      int order[2][2] = {
+        { *data & 0xf, pp ? data[1] & 0xf : 0xf },
+        { *data >> 4, pp ? data[1] >> 4 : 0xf }
+      };
+      data += 1 + pp;
+      for (int k = 0; k < e->piece_count; ++k, ++data) {
+        for (int i = 0; i < sides; ++i) {
+          t->items[i][f].pieces[k] = i ? *data >> 4 : *data & 0xf;
+        }
+      }
+      for (int i = 0; i < sides; ++i) {
+        SetGroups(*e, &t->items[i][f], order[i], f);
+      }
+    }
+    data += reinterpret_cast<uintptr_t>(data) & 1;
+
+    for (int f = 0; f <= max_file; ++f) {
+      for (int i = 0; i < sides; ++i) {
+        data = SetSizes(&t->items[i][f], data);
+        if (!data || data > end) {
+          return false;
+        }
+      }
+    }
+    if (type == DTZ_TABLE) {
+      data = SetDtzMap(t, data, max_file);
+    }
+    for (int f = 0; f <= max_file; ++f) {
+      for (int i = 0; i < sides; ++i) {
+        t->items[i][f].sparse_index = data;
+        data += t->items[i][f].sparse_index_size * 6;
+      }
+    }
+    for (int f = 0; f <= max_file; ++f) {
+      for (int i = 0; i < sides; ++i) {
+        t->items[i][f].block_length = data;
+        data += t->items[i][f].block_length_size * 2;
+      }
+    }
+    for (int f = 0; f <= max_file; ++f) {
+      for (int i = 0; i < sides; ++i) {
+        // 64 byte alignment
+        data = reinterpret_cast<const uint8_t*>((reinterpret_cast<uintptr_t>(data) + 63) & ~63);
+        t->items[i][f].data = data;
+        data += t->items[i][f].num_blocks * t->items[i][f].block_size;
+      }
+    }
+    return data <= end;
+  }
+
+  // Maps the file of a table on its first probe. Returns false if it is
+  // missing or broken.
+  bool Mapped(TbEntry* e, int type) {
+    TbTable* t = &e->tables[type];
+    if (t->ready) {
+      __sync_synchronize();
+      return t->base != NULL;
+    }
+    pthread_mutex_lock(&map_mutex);
+    if (!t->ready) {
+      static const uint8_t MAGIC[2][4] = {
+        { 0x71, 0xe8, 0x23, 0x5d },
+        { 0xd7, 0x66, 0x0c, 0xa5 }
+      };
+      string name = e->name + (type == WDL_TABLE ? ".rtbw" : ".rtbz");
+      for (size_t i = 0; i < paths.size() && !t->base; ++i) {
+        int fd = open((paths[i] + "/" + name).c_str(), O_RDONLY);
+        if (fd < 0) {
+          continue;
+        }
+        struct stat st;
+        void* data = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 16) {
+          data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (data == MAP_FAILED) {
+          continue;
+        }
+        madvise(data, st.st_size, MADV_RANDOM);
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        if (memcmp(bytes, MAGIC[type], 4) != 0 ||
+            !SetUp(e, type, bytes + 4, bytes + st.st_size)) {
+          cerr << "Corrupted table " << paths[i] << "/" << name << endl;
+          munmap(data, st.st_size);
+          continue;
+        }
+        t->base = data;
+        t->mapped_size = st.st_size;
+      }
+      __sync_synchronize();
+      t->ready = true;
+    }
+    pthread_mutex_unlock(&map_mutex);
+    return t->base != NULL;
+  }
+
+  // Returns the value at index idx.
+  int DecompressPairs(const PairsData* d, uint64_t idx) {
+    if (d->flags & FLAG_SINGLE_VALUE) {
+      return d->min_sym_len;
+    }
+
+    // The sparse index gives the block and the offset within it of the
+    // value k * span + span / 2; walk from there to the block of idx.
+    uint32_t k = static_cast<uint32_t>(idx / d->span);
+    uint32_t block = ReadLe32(d->sparse_index + 6 * k);
+    int offset = ReadLe16(d->sparse_index + 6 * k + 4);
+    offset += static_cast<int>(idx % d->span) - static_cast<int>(d->span / 2);
+    while (offset < 0) {
+      offset += ReadLe16(d->block_length + 2 * --block) + 1;
+    }
+    while (offset > ReadLe16(d->block_length + 2 * block)) {
+      offset -= ReadLe16(d->block_length + 2 * block++) + 1;
+    }
+
+    // Decode the symbols of the block up to the one covering offset.
+    const uint8_t* ptr = d->data + block * d->block_size;
+    uint64_t buf64 = ReadBe64(ptr);
+    ptr += 8;
+    int buf64_size = 64;
+    int sym;
+    while (1) {
+      int len = 0;
+      while (buf64 < d->base64[len]) {
+        ++len;
+      }
+      sym = static_cast<int>((buf64 - d->base64[len]) >> (64 - len - d->min_sym_len));
+      sym += ReadLe16(d->lowest_sym + 2 * len);
+      if (offset < d->sym_len[sym] + 1) {
+        break;
+      }
+      offset -= d->sym_len[sym] + 1;
+      len += d->min_sym_len;
+      buf64 <<= len;
+      buf64_size -= len;
+      if (buf64_size <= 32) {
+        buf64_size += 32;
+        buf64 |= static_cast<uint64_t>(ReadBe32(ptr)) << (64 - buf64_size);
+        ptr += 4;
+      }
+    }
+
+    // Expand the symbol down to the value at offset.
+    while (d->sym_len[sym]) {
+      int left = LeftSymbol(d->btree, sym);
+      if (offset < d->sym_len[left] + 1) {
+        sym = left;
+      } else {
+        offset -= d->sym_len[left] + 1;
+        sym = RightSymbol(d->btree, sym);
+      }
+    }
+    return LeftSymbol(d->btree, sym);
+  }
+
+  int MapScore(TbEntry* e, int type, int file, int value, int wdl) {
+    if (type == WDL_TABLE) {
+      return value - 2;
+    }
+    static const int WDL_MAP[] = { 1, 3, 0, 2, 0 };
+    const PairsData* d = GetPairs(e, DTZ_TABLE, 0, file);
+    const uint8_t* map = e->tables[DTZ_TABLE].map;
+    if (d->flags & FLAG_MAPPED) {
+      uint32_t idx = d->map_idx[WDL_MAP[wdl + 2]];
+      if (d->flags & FLAG_WIDE) {
+        value = ReadLe16(map + idx + 2 * value);
+      } else {
+        value = map[idx + value];
+      }
+    }
+    // Convert moves to plies.
+    if ((wdl == WDL_WIN && !(d->flags & FLAG_WIN_PLIES)) ||
+        (wdl == WDL_LOSS && !(d->flags & FLAG_LOSS_PLIES)) ||
+        wdl == WDL_CURSED_WIN || wdl == WDL_BLESSED_LOSS) {
+      value *= 2;
+    }
+    return value + 1;
+  }
+
+  // Index of the pieces on squares, ordered like the table, with the
+  // lead_pawns_count leading pawns first.
+  uint64_t Encode(const TbEntry& e, const PairsData& d, int* squares, int size,
+                  int lead_pawns_count) {
+    // Bring the leading piece to the a-d files.
+    if (SquareX(squares[0]) > 3) {
+      for (int i = 0; i < size; ++i) {
+        squares[i] ^= 7;
+      }
+    }
+
+    uint64_t idx;
+    if (e.has_pawns) {
+      idx = lead_pawn_idx[lead_pawns_count][squares[0]];
+      stable_sort(squares + 1, squares + lead_pawns_count, PawnsLess);
+      for (int i = 1; i < lead_pawns_count; ++i) {
+        idx += binomial[i][map_pawns[squares[i]]];
+      }
+    } else {
+      // Without pawns, further to ranks 1-4 and below the a1-h8 diagonal.
+      if (SquareY(squares[0]) > 3) {
+        for (int i = 0; i < size; ++i) {
+          squares[i] ^= 56;
+        }
+      }
+      for (int i = 0; i < d.group_len[0]; ++i) {
+        if (!OffDiagonal(squares[i])) {
+          continue;
+        }
+        if (OffDiagonal(squares[i]) > 0) {
+          for (int j = i; j < size; ++j) {
+            squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+          }
+        }
+        break;
+      }
+
+      if (e.has_unique_pieces) {
+        // The first three pieces together: the first in the a1-d1-d4
+        // triangle, the next on the squares left.
+        int adjust1 = squares[1] > squares[0];
+        int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+        if (OffDiagonal(squares[0])) {
+          idx = (map_a1d1d4[squares[0]] * 63 + (squares[1] - adjust1)) * 62 +
+          squares[2] - adjust2;
+        } else if (OffDiagonal(squares[1])) {
+          idx = (6 * 63 + SquareY(squares[0]) * 28 + map_b1h1h7[squares[1]]) * 62 +
+          squares[2] - adjust2;
+        } else if (OffDiagonal(squares[2])) {
+          idx = 6 * 63 * 62 + 4 * 28 * 62 +
+          SquareY(squares[0]) * 7 * 28 +
+          (SquareY(squares[1]) - adjust1) * 28 +
+          map_b1h1h7[squares[2]];
+        } else {
+          idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 +
+          SquareY(squares[0]) * 7 * 6 +
+          (SquareY(squares[1]) - adjust1) * 6 +
+          (SquareY(squares[2]) - adjust2);
+        }
+      } else {
+        // just the kings
+        idx = map_kk[map_a1d1d4[squares[0]]][squares[1]];
+      }
+    }
+
+    // The other groups: pieces of a group by increasing square, each on
+    // the squares left by the previous groups.
+    idx *= d.group_idx[0];
+    int* group_squares = squares + d.group_len[0];
+    bool remaining_pawns = e.has_pawns && e.pawn_count[1];
+    for (int next = 1; d.group_len[next]; ++next) {
+      stable_sort(group_squares, group_squares + d.group_len[next]);
+      uint64_t group_index = 0;
+      for (int i = 0; i < d.group_len[next]; ++i) {
+        int adjust = 0;
+        for (const int* sq = squares; sq != group_squares; ++sq) {
+          adjust += group_squares[i] > *sq;
+        }
+        group_index += binomial[i + 1][group_squares[i] - adjust - 8 * remaining_pawns];
+      }
+      remaining_pawns = false;
+      idx += group_index * d.group_idx[next];
+      group_squares += d.group_len[next];
+    }
+
+    return idx;
+  }
+
+  // Looks up the position in the WDL or DTZ table of its material; wdl is
+  // its outcome for DTZ.
+  int ProbeTable(const Position& pos, int type, int wdl, ProbeState* state) {
+    int board_squares[TB_PIECES];
+    int board_pieces[TB_PIECES];
+    int n = 0;
+    uint64_t key = 0;
+    for (int sq = 0; sq < 64; ++sq) {
+      int p = pos.get_board(SquareX(sq), SquareY(sq));
+      if (!p) {
+        continue;
+      }
+      if (n == TB_PIECES) {
+        *state = PROBE_FAIL;
+        return 0;
+      }
+      board_squares[n] = sq;
+      board_pieces[n++] = (p > 0) ? p : 8 - p;
+      if (abs(p) != 6) {
+        key += PieceKey(p);
+      }
+    }
+    if (n == 2) {
+      // KvK
+      return WDL_DRAW;
+    }
+    map<uint64_t, TbEntry*>::const_iterator found = entry_by_key.find(key);
+    if (found == entry_by_key.end() || !Mapped(found->second, type)) {
+      *state = PROBE_FAIL;
+      return 0;
+    }
+    TbEntry* e = found->second;
+
+    // Tables have the pieces of the name on the white side, and only white
+    // to move if both sides are alike: flip the colors and the board if
+    // needed.
+    bool flip = (e->key == e->key2 && pos.side() == BLACK) || key != e->key;
+    int flip_color = flip ? 8 : 0;
+    int flip_squares = flip ? 56 : 0;
+    int stm = flip ^ (pos.side() == BLACK);
+
+    int squares[TB_PIECES];
+    int pieces[TB_PIECES];
+    int size = 0;
+    int lead_pawns_count = 0;
+    int lead_pawn = -1;
+    int tb_file = 0;
+    if (e->has_pawns) {
+      // With pawns, there is a table per file of the leading pawn.
+      lead_pawn = GetPairs(e, type, 0, 0)->pieces[0] ^ flip_color;
+      for (int i = 0; i < n; ++i) {
+        if (board_pieces[i] == lead_pawn) {
+          squares[size++] = board_squares[i] ^ flip_squares;
+        }
+      }
+      lead_pawns_count = size;
+      swap(squares[0], *max_element(squares, squares + lead_pawns_count, PawnsLess));
+      tb_file = SquareX(squares[0]);
+      if (tb_file > 3) {
+        tb_file = 7 - tb_file;
+      }
+    }
+
+    // DTZ tables have one side to move.
+    if (type == DTZ_TABLE) {
+      int flags = GetPairs(e, type, stm, tb_file)->flags;
+      if ((flags & FLAG_STM) != stm && !(e->key == e->key2 && !e->has_pawns)) {
+        *state = PROBE_CHANGE_STM;
+        return 0;
+      }
+    }
+
+    for (int i = 0; i < n; ++i) {
+      if (board_pieces[i] != lead_pawn) {
+        squares[size] = board_squares[i] ^ flip_squares;
+        pieces[size++] = board_pieces[i] ^ flip_color;
+      }
+    }
+    const PairsData* d = GetPairs(e, type, stm, tb_file);
+
+    // Order the pieces like the table.
+    for (int i = lead_pawns_count; i < size - 1; ++i) {
+      for (int j = i + 1; j < size; ++j) {
+        if (d->pieces[i] == pieces[j]) {
+          swap(pieces[i], pieces[j]);
+          swap(squares[i], squares[j]);
+          break;
+        }
+      }
+    }
+
+    uint64_t idx = Encode(*e, *d, squares, size, lead_pawns_count);
+    return MapScore(e, type, tb_file, DecompressPairs(d, idx), wdl);
+  }
+
+  bool IsCapture(const Position& pos, const Move& move) {
+    return pos.get_board(move.to_x(), move.to_y()) != 0 ||
+    (abs(pos.get_board(move.from_x(), move.from_y())) == 1 && move.from_x() != move.to_x());
+  }
+
+  bool IsMate(const Position& pos) {
+    MoveList moves;
+    pos.CalcMoves(&moves);
+    return moves.empty() && pos.IsCheck();
+  }
+
+  // DTZ, in plies, of the move before a capture or pawn move.
+  int DtzBeforeZeroing(int wdl) {
+    switch (wdl) {
+      case WDL_WIN:
+        return 1;
+      case WDL_CURSED_WIN:
+        return 101;
+      case WDL_BLESSED_LOSS:
+        return -101;
+      case WDL_LOSS:
+        return -1;
+      default:
+        return 0;
+    }
+  }
+
+  int Sign(int value) {
+    return (value > 0) - (value < 0);
+  }
+
+  // Tables may store any value for positions where a capture wins, and a
+  // loss for positions where a capture draws, as is better compressed; so
+  // the captures (and the pawn moves, for DTZ) are searched as well.
+  int SearchWdl(const Position& pos, bool zeroing_moves, ProbeState* state) {
+    MoveList moves;
+    pos.CalcMoves(&moves);
+    int best = WDL_LOSS;
+    int move_count = 0;
+    for (const Move* it = moves.begin(); it != moves.end(); ++it) {
+      if (!IsCapture(pos, *it) &&
+          (!zeroing_moves || abs(pos.get_board(it->from_x(), it->from_y())) != 1)) {
+        continue;
+      }
+      ++move_count;
+      Position next_pos;
+      pos.DoMove(*it, &next_pos);
+      int value = -SearchWdl(next_pos, false, state);
+      if (*state == PROBE_FAIL) {
+        return WDL_DRAW;
+      }
+      if (value > best) {
+        best = value;
+        if (value >= WDL_WIN) {
+          *state = PROBE_ZEROING_BEST_MOVE;
+          return value;
+        }
+      }
+    }
+
+    // If every move was searched, the table is not needed; it would be
+    // wrong with an en passant capture.
+    bool no_more_moves = move_count && move_count == moves.size();
+    int value;
+    if (no_more_moves) {
+      value = best;
+    } else {
+      value = ProbeTable(pos, WDL_TABLE, WDL_DRAW, state);
+      if (*state == PROBE_FAIL) {
+        return WDL_DRAW;
+      }
+    }
+    if (best >= value) {
+      *state = (best > WDL_DRAW || no_more_moves) ? PROBE_ZEROING_BEST_MOVE : PROBE_OK;
+      return best;
+    }
+    *state = PROBE_OK;
+    return value;
+  }
+
+  int SearchDtz(const Position& pos, ProbeState* state) {
+    *state = PROBE_OK;
+    int wdl = SearchWdl(pos, true, state);
+    if (*state == PROBE_FAIL || wdl == WDL_DRAW) {
+      return 0;
+    }
+    if (*state == PROBE_ZEROING_BEST_MOVE) {
+      return DtzBeforeZeroing(wdl);
+    }
+    int dtz = ProbeTable(pos, DTZ_TABLE, wdl, state);
+    if (*state == PROBE_FAIL) {
+      return 0;
+    }
+    if (*state != PROBE_CHANGE_STM) {
+      return (dtz + 100 * (wdl == WDL_BLESSED_LOSS || wdl == WDL_CURSED_WIN)) * Sign(wdl);
+    }
+
+    // The table has the other side to move: take the best move keeping
+    // the outcome.
+    int min_dtz = 0xffff;
+    MoveList moves;
+    pos.CalcMoves(&moves);
+    for (const Move* it = moves.begin(); it != moves.end(); ++it) {
+      Position next_pos;
+      pos.DoMove(*it, &next_pos);
+      bool zeroing = next_pos.halfmove_clock() == 0;
+      if (zeroing) {
+        *state = PROBE_OK;
+        dtz = -DtzBeforeZeroing(SearchWdl(next_pos, false, state));
+      } else {
+        dtz = -SearchDtz(next_pos, state);
+      }
+      if (*state == PROBE_FAIL) {
+        return 0;
+      }
+      if (dtz == 1 && IsMate(next_pos)) {
+        min_dtz = 1;
+      }
+      if (!zeroing) {
+        dtz += Sign(dtz);
+      }
+      if (dtz < min_dtz && Sign(dtz) == Sign(wdl)) {
+        min_dtz = dtz;
+      }
+    }
+    // no legal move: mated
+    return min_dtz == 0xffff ? -1 : min_dtz;
+  }
+
+  bool Covered(const Position& pos) {
+    return pos.castling() == 0 &&
+    pos.piece_count(WHITE) + pos.piece_count(BLACK) <= SyzygyLargest();
+  }
+
+  // Keeps the moves of pos preserving its outcome, as FilterRootMoves.
+  // Returns false if a needed table is missing.
+  bool RankRootMoves(const Position& pos, MoveList* moves) {
+    // Rank the moves: 2 for a win before the 50 moves rule, -2 for a loss,
+    // 0 otherwise. Then the shortest win, or the longest loss.
+    int ranks[256];
+    int dtzs[256];
+    int best_rank = -2;
+    for (int i = 0; i < moves->size(); ++i) {
+      Position next_pos;
+      pos.DoMove((*moves)[i], &next_pos);
+      ProbeState state = PROBE_OK;
+      int dtz;
+      if (next_pos.halfmove_clock() == 0) {
+        dtz = DtzBeforeZeroing(-SearchWdl(next_pos, false, &state));
+      } else {
+        dtz = -SearchDtz(next_pos, &state);
+        dtz += Sign(dtz);
+      }
+      if (state == PROBE_FAIL) {
+        return false;
+      }
+      if (dtz == 2 && IsMate(next_pos)) {
+        dtz = 1;
+      }
+      int plies = abs(dtz) + pos.halfmove_clock();
+      ranks[i] = (dtz > 0 && plies <= 100) ? 2 : (dtz < 0 && plies <= 100) ? -2 : 0;
+      dtzs[i] = dtz;
+      best_rank = max(best_rank, ranks[i]);
+    }
+    int best_dtz = 0;
+    for (int i = 0; i < moves->size(); ++i) {
+      if (ranks[i] == best_rank && (best_dtz == 0 || dtzs[i] < best_dtz)) {
+        best_dtz = dtzs[i];
+      }
+    }
+    MoveList kept;
+    for (int i = 0; i < moves->size(); ++i) {
+      if (ranks[i] == best_rank && (best_rank == 0 || dtzs[i] == best_dtz)) {
+        kept.push_back((*moves)[i]);
+      }
+    }
+    *moves = kept;
+    return true;
+  }
+
+  // Sets *pos to the position of a king of each side and one more piece,
+  // given by its FEN mark. Returns false if it is not legal.
+  bool SetUpPosition(int white_king, int black_king, int square, char mark, int side,
+                     Position* pos) {
+    if (white_king == black_king || square == white_king || square == black_king) {
+      return false;
+    }
+    char board[64];
+    memset(board, 0, sizeof(board));
+    board[white_king] = 'K';
+    board[black_king] = 'k';
+    board[square] = mark;
+    string fen;
+    for (int y = 7; y >= 0; --y) {
+      int empty = 0;
+      for (int x = 0; x < 8; ++x) {
+        char c = board[MakeSquare(x, y)];
+        if (!c) {
+          ++empty;
+          continue;
+        }
+        if (empty) {
+          fen += '0' + empty;
+          empty = 0;
+        }
+        fen += c;
+      }
+      if (empty) {
+        fen += '0' + empty;
+      }
+      fen += (y > 0) ? '/' : ' ';
+    }
+    fen += (side == WHITE) ? "w - -" : "b - -";
+    return Position::ParseFen(fen, pos);
+  }
+
+  // Outcome of pos for the side to move from the bitbases; positions they
+  // do not cover have a minor piece against a king, and are draws.
+  int BitbaseOutcome(const Position& pos) {
+    int result;
+    return ProbeBitbase(pos, &result) ? result : 0;
+  }
+
+  // Compares the tables with the bitbases on pos. Returns false and sets
+  // error if they differ.
+  bool CheckPosition(const Position& pos, string* error) {
+    int known = BitbaseOutcome(pos);
+    ProbeState state = PROBE_OK;
+    int wdl = SearchWdl(pos, false, &state);
+    if (state == PROBE_FAIL || wdl != 2 * known) {
+      *error = "WDL";
+      return false;
+    }
+    int dtz = SearchDtz(pos, &state);
+    if (state == PROBE_FAIL || Sign(dtz) != known) {
+      *error = "DTZ";
+      return false;
+    }
+    MoveList moves;
+    pos.CalcMoves(&moves);
+    if (moves.empty()) {
+      return true;
+    }
+    if (!RankRootMoves(pos, &moves) || moves.empty()) {
+      *error = "root moves";
+      return false;
+    }
+    for (int i = 0; i < moves.size(); ++i) {
+      Position next_pos;
+      pos.DoMove(moves[i], &next_pos);
+      if (BitbaseOutcome(next_pos) != -known) {
+        *error = "root move";
+        return false;
+      }
+    }
+    return true;
+  }
+
+}  // namespace
+
+void InitSyzygy(const string& path) {
+  static bool initialized = false;
+  if (!initialized) {
+    InitIndexTables();
+    initialized = true;
+  }
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    for (int type = WDL_TABLE; type <= DTZ_TABLE; ++type) {
+      TbTable& t = entries[i]->tables[type];
+      if (t.base) {
+        munmap(t.base, t.mapped_size);
+      }
+    }
+    delete entries[i];
+  }
+  entries.clear();
+  entry_by_key.clear();
+  paths.clear();
+  largest = 0;
+  verified = false;
+
+  // Only the WDL files are looked for now; every file is mapped later.
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find(':', start);
+    if (end == string::npos) {
+      end = path.size();
+    }
+    string dir = path.substr(start, end - start);
+    start = end + 1;
+    DIR* d = dir.empty() ? NULL : opendir(dir.c_str());
+    if (!d) {
+      continue;
+    }
+    paths.push_back(dir);
+    while (struct dirent* file = readdir(d)) {
+      string name = file->d_name;
+      if (name.size() <= 5 || name.compare(name.size() - 5, 5, ".rtbw") != 0) {
+        continue;
+      }
+      TbEntry* e = new TbEntry;
+      if (!ParseName(name.substr(0, name.size() - 5), e) || entry_by_key.count(e->key)) {
+        delete e;
+        continue;
+      }
+      entries.push_back(e);
+      entry_by_key[e->key] = e;
+      entry_by_key[e->key2] = e;
+      largest = max(largest, e->piece_count);
+    }
+    closedir(d);
+  }
+  if (!path.empty()) {
+    cerr << "Found " << entries.size() << " tablebases" << endl;
+  }
+  if (!entries.empty()) {
+    VerifySyzygy(CHECK_STRIDE);
+  }
+}
+
+bool VerifySyzygy(int stride) {
+  verified = false;
+  const char* const NAMES[] = { "KQvK", "KRvK", "KPvK" };
+  const char MARKS[] = "QRP";
+  for (int i = 0; i < 3; ++i) {
+    bool found = false;
+    for (size_t j = 0; j < entries.size(); ++j) {
+      found = found || entries[j]->name == NAMES[i];
+    }
+    if (!found) {
+      cerr << "No " << NAMES[i] << " to check the tablebases with; not using them" << endl;
+      return false;
+    }
+  }
+
+  long long index = 0;
+  int checked = 0;
+  int mismatches = 0;
+  for (int i = 0; i < 3; ++i) {
+    for (int strong = 0; strong < 2; ++strong) {
+      char mark = strong ? tolower(MARKS[i]) : MARKS[i];
+      for (int side = WHITE; side >= BLACK; side -= 2) {
+        for (int white_king = 0; white_king < 64; ++white_king) {
+          for (int black_king = 0; black_king < 64; ++black_king) {
+            for (int square = 0; square < 64; ++square) {
+              Position pos;
+              if (index++ % max(stride, 1) != 0 ||
+                  !SetUpPosition(white_king, black_king, square, mark, side, &pos)) {
+                continue;
+              }
+              ++checked;
+              string error;
+              if (!CheckPosition(pos, &error) && mismatches++ < MAX_PRINTED_MISMATCHES) {
+                cerr << "Tablebase " << error << " mismatch: " << pos.Fen() << endl;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  if (mismatches) {
+    cerr << "Tablebases differ from the bitbases on " << mismatches << " of " << checked
+    << " positions; not using them" << endl;
+    return false;
+  }
+  cerr << "Tablebases agree with the bitbases on " << checked << " positions" << endl;
+  if (largest > CHECKED_PIECES) {
+    cerr << "Not using the tablebases of more than " << CHECKED_PIECES << " pieces" << endl;
+  }
+  verified = true;
+  return true;
+}
+
+int SyzygyLargest() {
+  return verified ? min(largest, CHECKED_PIECES) : 0;
+}
+
+bool ProbeWdl(const Position& pos, int* wdl) {
+  if (!Covered(pos)) {
+    return false;
+  }
+  ProbeState state = PROBE_OK;
+  *wdl = SearchWdl(pos, false, &state);
+  return state != PROBE_FAIL;
+}
+
+bool ProbeDtz(const Position& pos, int* dtz) {
+  if (!Covered(pos)) {
+    return false;
+  }
+  ProbeState state;
+  *dtz = SearchDtz(pos, &state);
+  return state != PROBE_FAIL;
+}
+
+bool FilterRootMoves(const Position& pos, MoveList* moves) {
+  if (!Covered(pos) || moves->empty()) {
+    return false;
+  }
+  return RankRootMoves(pos, moves);
+}
@@ -0,0 +1,69 @@
+//
+//  claude_syzygy.h
+//  Probing of Syzygy endgame tablebases (.rtbw and .rtbz files).
+//
+//  The WDL tables give the outcome of a position with the 50 moves rule
+//  taken into account; the DTZ tables the distance to the next capture or
+//  pawn move (zeroing move) on a winning path. Tables are found by name in
+//  the directories of the path and mapped on their first probe. Positions
+//  with castling rights are never probed.
+//
+//  The tables are used only once KQvK, KRvK and KPvK agree with the
+//  bitbases (see VerifySyzygy), so that a table that decodes wrongly
+//  cannot mislead the search. Tables of more than 3 pieces are not used
+//  at all, as nothing checks them yet.
+//
+
+#ifndef game_claude_syzygy_h
+#define game_claude_syzygy_h
+
+#include <string>
+
+#include "claude.h"
+
+// Outcomes of the WDL tables, from the side to move. A cursed win is won
+// without the 50 moves rule only, a blessed loss is the other side of it.
+enum {
+  WDL_LOSS = -2,
+  WDL_BLESSED_LOSS = -1,
+  WDL_DRAW = 0,
+  WDL_CURSED_WIN = 1,
+  WDL_WIN = 2
+};
+
+// Scores of tablebase wins in the search lie below TB_WIN_SCORE and above
+// those of bitbase wins (see claude_bitbase.h).
+const int TB_WIN_SCORE = 30000;
+
+// Looks for tables in path, a list of directories separated by ':', and
+// checks them on a sample of positions with VerifySyzygy. Tables of a
+// previous path are unmapped. The bitbases must be initialized first (see
+// InitBitbases). Must not be called during a search.
+void InitSyzygy(const string& path);
+
+// Checks every stride-th position of KQvK, KRvK and KPvK, with either
+// side strong and to move, against the bitbases: the WDL value, the sign
+// of the DTZ value, and that the moves kept by FilterRootMoves keep the
+// outcome. Prints the mismatches. The tables of up to 3 pieces are used if
+// it passes, and none otherwise. Must not be called during a search.
+bool VerifySyzygy(int stride);
+
+// Largest number of pieces, kings included, of the tables used: at most 3,
+// and 0 if there are none or they have not passed VerifySyzygy.
+int SyzygyLargest();
+
+// Probes the WDL tables. Returns false if a needed table is missing.
+bool ProbeWdl(const Position& pos, int* wdl);
+
+// Probes the DTZ tables: *dtz is the number of plies to a zeroing move on
+// a path keeping the outcome, positive if the side to move wins, negative
+// if it loses, 100 more for cursed wins and blessed losses, and 0 for
+// draws. Returns false if a needed table is missing.
+bool ProbeDtz(const Position& pos, int* dtz);
+
+// Keeps the moves of a root position that preserve its outcome under the
+// 50 moves rule, the fastest ones if it is won. Returns false and leaves
+// moves untouched if the position is not covered.
+bool FilterRootMoves(const Position& pos, MoveList* moves);
+
+#endif  // game_claude_syzygy_h
@@ -0,0 +1,342 @@
+//
+//  claude_tournament.cc
+//  Self-play matches between two engine configurations.
+//
+
+#include "claude_tournament.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "claude_fen_file.h"
+#include "claude_pgn.h"
+
+namespace {
+
+  // Games longer than this are adjudicated as draws.
+  const int MAX_GAME_PLIES = 600;
+
+  // Plays one game from opening and returns its result for white, with
+  // the reason in *reason. The moves are recorded in *game.
+  int PlayGame(const Position& opening, const EngineConfig& white,
+               const EngineConfig& black, string* reason, PgnGame* game) {
+    MinMaxPlayer white_player(white.depth);
+    white_player.set_time_limit(white.seconds);
+    MinMaxPlayer black_player(black.depth);
+    black_player.set_time_limit(black.seconds);
+
+    vector<Position> history(1, opening);
+    while (1) {
+      int result = GameResult(history, MAX_GAME_PLIES, reason);
+      if (result != GAME_ONGOING) {
+        return result;
+      }
+
+      const Position& pos = history.back();
+      MinMaxPlayer& player = (pos.side() == WHITE) ? white_player : black_player;
+      Move move;
+      player.NextMove(history.back(), &move);
+      game->AddMove(history.back(), move);
+      Position next_pos;
+      history.back().DoMove(move, &next_pos);
+      history.push_back(next_pos);
+    }
+  }
+
+  // An opening made of random legal moves, the same for every call with
+  // the same seed.
+  Position RandomOpening(unsigned int seed, int plies) {
+    while (1) {
+      Position pos;
+      pos.StartPosition();
+      int ply = 0;
+      for (; ply < plies; ++ply) {
+        MoveList moves;
+        pos.CalcMoves(&moves);
+        if (moves.empty()) {
+          break;
+        }
+        Position next_pos;
+        pos.DoMove(moves[rand_r(&seed) % moves.size()], &next_pos);
+        pos = next_pos;
+      }
+      if (ply == plies) {
+        return pos;
+      }
+    }
+  }
+
+  bool ReadOpenings(const string& path, vector<Position>* openings) {
+    FenFileStats stats;
+    if (!LoadFenFile(path, 1, openings, &stats)) {
+      return false;
+    }
+    if (stats.errors > 0) {
+      cerr << path << ":" << stats.first_error_line << ": invalid FEN ("
+      << stats.errors << " skipped)" << endl;
+    }
+    return !openings->empty();
+  }
+
+  double Elo(double score) {
+    if (score <= 0 || score >= 1) {
+      return score <= 0 ? -HUGE_VAL : HUGE_VAL;
+    }
+    return -400 * log10(1 / score - 1);
+  }
+
+  double ExpectedScore(double elo) {
+    return 1 / (1 + pow(10, -elo / 400));
+  }
+
+}  // namespace
+
+bool EngineConfig::Parse(const string& spec) {
+  istringstream is(spec);
+  string item;
+  while (getline(is, item, ',')) {
+    size_t eq = item.find('=');
+    if (eq == string::npos) {
+      return false;
+    }
+    string key = item.substr(0, eq);
+    istringstream value(item.substr(eq + 1));
+    if (key == "depth") {
+      value >> depth;
+    } else if (key == "time") {
+      value >> seconds;
+    } else {
+      return false;
+    }
+    if (!value || !value.eof()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+string EngineConfig::ToString() const {
+  ostringstream os;
+  os << "depth=" << depth;
+  if (seconds > 0) {
+    os << ",time=" << seconds;
+  }
+  return os.str();
+}
+
+bool IsInsufficientMaterial(const Position& pos) {
+  int minors = 0;
+  for (int y = 0; y < 8; ++y) {
+    for (int x = 0; x < 8; ++x) {
+      int p = abs(pos.get_board(x, y));
+      if (p == 1 || p == 4 || p == 5) {
+        return false;
+      }
+      if (p == 2 || p == 3) {
+        ++minors;
+      }
+    }
+  }
+  return minors <= 1;
+}
+
+int GameResult(const vector<Position>& history, int max_plies, string* reason) {
+  string unused;
+  if (!reason) {
+    reason = &unused;
+  }
+  const Position& pos = history.back();
+  MoveList moves;
+  pos.CalcMoves(&moves);
+  if (moves.empty()) {
+    if (pos.IsCheck()) {
+      *reason = "checkmate";
+      return pos.side() == WHITE ? GAME_LOSS : GAME_WIN;
+    }
+    *reason = "stalemate";
+    return GAME_DRAW;
+  }
+  if (pos.halfmove_clock() >= 100) {
+    *reason = "50-move rule";
+    return GAME_DRAW;
+  }
+  // Only positions since the last capture or pawn move can repeat.
+  int repetitions = 1;
+  int size = history.size();
+  for (int i = size - 3; i >= 0 && i >= size - 1 - pos.halfmove_clock(); i -= 2) {
+    if (history[i].IsRepetitionOf(pos)) {
+      ++repetitions;
+    }
+  }
+  if (repetitions >= 3) {
+    *reason = "repetition";
+    return GAME_DRAW;
+  }
+  if (IsInsufficientMaterial(pos)) {
+    *reason = "insufficient material";
+    return GAME_DRAW;
+  }
+  if (size > max_plies) {
+    *reason = "adjudicated";
+    return GAME_DRAW;
+  }
+  return GAME_ONGOING;
+}
+
+double SprtLlr(int wins, int draws, int losses, double elo0, double elo1) {
+  int n = wins + draws + losses;
+  if (n == 0) {
+    return 0;
+  }
+  double score = (wins + 0.5 * draws) / n;
+  double variance = (wins * (1 - score) * (1 - score) +
+                     draws * (0.5 - score) * (0.5 - score) +
+                     losses * score * score) / n;
+  if (variance <= 0) {
+    return 0;
+  }
+  double s0 = ExpectedScore(elo0);
+  double s1 = ExpectedScore(elo1);
+  return n * (s1 - s0) * (2 * score - s0 - s1) / (2 * variance);
+}
+
+int RunTournament(const EngineConfig& a, const EngineConfig& b,
+                  const TournamentOptions& options) {
+  vector<Position> openings;
+  if (!options.openings_path.empty() &&
+      !ReadOpenings(options.openings_path, &openings)) {
+    cerr << "Cannot read openings from " << options.openings_path << endl;
+    return 0;
+  }
+
+  double lower = log(options.beta / (1 - options.alpha));
+  double upper = log((1 - options.beta) / options.alpha);
+  cout << "A: " << a.ToString() << endl;
+  cout << "B: " << b.ToString() << endl;
+  cout << "SPRT elo0=" << options.elo0 << " elo1=" << options.elo1
+  << " alpha=" << options.alpha << " beta=" << options.beta
+  << " bounds [" << lower << ", " << upper << "]" << endl;
+
+  int wins = 0;
+  int draws = 0;
+  int losses = 0;
+  int started = 0;
+  int running = 0;
+  int decision = 0;
+  vector<pid_t> children;
+  while (1) {
+    while (decision == 0 && started < options.games &&
+           running < max(1, options.concurrency)) {
+      // Games 2k and 2k+1 share an opening; A is white in the first one.
+      int game = started++;
+      int pair = game / 2;
+      Position opening = openings.empty() ?
+      RandomOpening(pair + 1, options.opening_plies) :
+      openings[pair % openings.size()];
+      bool a_is_white = (game % 2 == 0);
+
+      // Do not let the child print what is still buffered.
+      cout.flush();
+      fflush(stdout);
+      pid_t pid = fork();
+      if (pid < 0) {
+        perror("fork");
+        --started;
+        break;
+      }
+      if (pid == 0) {
+        string reason;
+        PgnGame record;
+        int result = a_is_white ? PlayGame(opening, a, b, &reason, &record) :
+        PlayGame(opening, b, a, &reason, &record);
+        const char* RESULT_MARK[] = { "0-1", "1/2-1/2", "1-0" };
+        if (!options.pgn_path.empty()) {
+          ostringstream round;
+          round << game + 1;
+          record.SetTag("Event", "claude match");
+          record.SetTag("Round", round.str());
+          record.SetTag("White", (a_is_white ? a : b).ToString());
+          record.SetTag("Black", (a_is_white ? b : a).ToString());
+          record.SetTag("FEN", opening.Fen());
+          record.SetTag("SetUp", "1");
+          record.SetTag("Termination", reason);
+          record.result = RESULT_MARK[result];
+          if (!AppendPgn(options.pgn_path, record)) {
+            perror(options.pgn_path.c_str());
+          }
+        }
+        printf("game %d: %s - %s %s (%s)\n", game + 1,
+               a_is_white ? "A" : "B", a_is_white ? "B" : "A",
+               RESULT_MARK[result], reason.c_str());
+        fflush(stdout);
+        // The exit code is the result of engine A.
+        _exit(a_is_white ? result : GAME_WIN - result);
+      }
+      children.push_back(pid);
+      ++running;
+    }
+    if (running == 0) {
+      break;
+    }
+
+    int status;
+    pid_t pid = wait(&status);
+    if (pid < 0) {
+      break;
+    }
+    --running;
+    children.erase(find(children.begin(), children.end(), pid));
+    if (decision != 0) {
+      continue;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) > GAME_WIN) {
+      cerr << "A game process failed" << endl;
+      continue;
+    }
+    switch (WEXITSTATUS(status)) {
+      case GAME_WIN:
+        ++wins;
+        break;
+      case GAME_DRAW:
+        ++draws;
+        break;
+      default:
+        ++losses;
+        break;
+    }
+    int n = wins + draws + losses;
+    double score = (wins + 0.5 * draws) / n;
+    double llr = SprtLlr(wins, draws, losses, options.elo0, options.elo1);
+    printf("A +%d =%d -%d  score %.3f  elo %+.1f  llr %.2f\n",
+           wins, draws, losses, score, Elo(score), llr);
+    fflush(stdout);
+    if (llr >= upper) {
+      decision = 1;
+    } else if (llr <= lower) {
+      decision = -1;
+    }
+    if (decision != 0) {
+      // The result is known; the games in progress do not matter.
+      for (size_t i = 0; i < children.size(); ++i) {
+        kill(children[i], SIGKILL);
+      }
+    }
+  }
+
+  if (decision > 0) {
+    cout << "H1 accepted (elo >= " << options.elo1 << ")" << endl;
+  } else if (decision < 0) {
+    cout << "H0 accepted (elo <= " << options.elo0 << ")" << endl;
+  } else {
+    cout << "No decision after " << wins + draws + losses << " games" << endl;
+  }
+  return decision;
+}
@@ -0,0 +1,84 @@
+//
+//  claude_tournament.h
+//  Self-play matches between two engine configurations.
+//
+//  Every game runs in its own process, so a match uses all cores and a
+//  crashing game does not take the match down. Games are played in pairs
+//  from the same opening with colors swapped, and the match stops as soon
+//  as a sequential probability ratio test (SPRT) accepts one hypothesis.
+//
+
+#ifndef game_claude_tournament_h
+#define game_claude_tournament_h
+
+#include <string>
+#include <vector>
+
+#include "claude.h"
+
+// Settings of one side of a match, written as "depth=4,time=0.1".
+struct EngineConfig {
+  EngineConfig() : depth(4), seconds(0) {}
+
+  // Returns false if spec has an unknown key or a malformed value.
+  bool Parse(const string& spec);
+  string ToString() const;
+
+  int depth;
+  // Time limit per move; 0 for none.
+  double seconds;
+};
+
+struct TournamentOptions {
+  TournamentOptions()
+  : games(1000), concurrency(1), opening_plies(4),
+  elo0(0), elo1(10), alpha(0.05), beta(0.05) {}
+
+  // Maximum number of games.
+  int games;
+  // Games played at the same time.
+  int concurrency;
+  // FENs of the openings, one per line. If empty, openings are made of
+  // opening_plies random moves from the start position.
+  string openings_path;
+  int opening_plies;
+  // If not empty, the games are appended to this PGN file.
+  string pgn_path;
+  // SPRT of H0: elo = elo0 against H1: elo = elo1, with the error rates
+  // alpha and beta.
+  double elo0;
+  double elo1;
+  double alpha;
+  double beta;
+};
+
+// Returns true if neither side can mate: kings and at most one minor piece.
+bool IsInsufficientMaterial(const Position& pos);
+
+// Results of a game for white.
+enum {
+  GAME_LOSS = 0,
+  GAME_DRAW = 1,
+  GAME_WIN = 2,
+  // The game goes on.
+  GAME_ONGOING = -1
+};
+
+// Returns the result for white of the game that went through history, the
+// current position last, or GAME_ONGOING: mate, stalemate, the 50 moves
+// rule, threefold repetition and insufficient material end it, and games
+// longer than max_plies are drawn. If reason is not NULL, sets it to why
+// the game ended.
+int GameResult(const vector<Position>& history, int max_plies, string* reason);
+
+// Log-likelihood ratio of H1 against H0 for the results of engine A,
+// using the normal approximation of the trinomial distribution.
+double SprtLlr(int wins, int draws, int losses, double elo0, double elo1);
+
+// Plays engine A against engine B and prints the running score, the elo
+// difference and the SPRT log-likelihood ratio after each game.
+// Returns 1 if H1 was accepted, -1 if H0 was, 0 if the games ran out.
+int RunTournament(const EngineConfig& a, const EngineConfig& b,
+                  const TournamentOptions& options);
+
+#endif  // game_claude_tournament_h
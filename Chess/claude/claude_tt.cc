@@ -0,0 +1,265 @@
+//
+//  claude_tt.cc
+//  Transposition table.
+//
+
+#include "claude_tt.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+  const char TT_FILE_MAGIC[8] = { 'C', 'L', 'A', 'U', 'D', 'E', 'T', 'T' };
+  const uint32_t TT_FILE_VERSION = 1;
+
+  // Header of a saved table, followed by the buckets.
+  struct TtFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t bucket_size;
+    uint32_t generation;
+    uint64_t bucket_count;
+    // Key of the start position, so tables of other Zobrist keys are
+    // refused.
+    uint64_t start_key;
+    // Keeps the buckets aligned to cache lines.
+    uint8_t reserved[24];
+  };
+
+  COMPILE_ASSERT(sizeof(TtFileHeader) == 64, tt_file_header_is_64_bytes);
+
+  const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+  uint64_t StartKey() {
+    Position pos;
+    pos.StartPosition();
+    return pos.key();
+  }
+
+}  // namespace
+
+TranspositionTable::TranspositionTable()
+: buckets_(NULL),
+bucket_count_(0),
+generation_(0),
+huge_pages_(false) {}
+
+TranspositionTable::~TranspositionTable() {
+  Release();
+}
+
+bool TranspositionTable::Resize(size_t megabytes, bool large_pages) {
+  if (megabytes == 0) {
+    Release();
+    return true;
+  }
+  size_t count = 1;
+  while (count * 2 * sizeof(Bucket) <= (megabytes << 20)) {
+    count *= 2;
+  }
+  if (!Allocate(count, large_pages)) {
+    return false;
+  }
+  Clear();
+  return true;
+}
+
+bool TranspositionTable::Allocate(size_t count, bool large_pages) {
+  Release();
+  size_t size = count * sizeof(Bucket);
+  large_pages = large_pages && size >= HUGE_PAGE_SIZE;
+  void* memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  // Reserved huge pages, if the administrator set some aside.
+  if (large_pages) {
+    memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    huge_pages_ = (memory != MAP_FAILED);
+  }
+#endif
+  if (memory == MAP_FAILED) {
+    // Transparent huge pages need a region aligned to them, so map more
+    // and trim the ends.
+    size_t padding = large_pages ? HUGE_PAGE_SIZE : 0;
+    char* region = static_cast<char*>(mmap(NULL, size + padding, PROT_READ | PROT_WRITE,
+                                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (region == MAP_FAILED) {
+      return false;
+    }
+    char* aligned = region;
+    if (large_pages) {
+      aligned = region + (HUGE_PAGE_SIZE - reinterpret_cast<uintptr_t>(region) % HUGE_PAGE_SIZE) %
+      HUGE_PAGE_SIZE;
+      if (aligned > region) {
+        munmap(region, aligned - region);
+      }
+      if (aligned + size < region + size + padding) {
+        munmap(aligned + size, region + size + padding - (aligned + size));
+      }
+    }
+    memory = aligned;
+#ifdef MADV_HUGEPAGE
+    huge_pages_ = large_pages && madvise(memory, size, MADV_HUGEPAGE) == 0;
+#endif
+  }
+  buckets_ = static_cast<Bucket*>(memory);
+  bucket_count_ = count;
+  return true;
+}
+
+void TranspositionTable::Release() {
+  if (buckets_) {
+    munmap(buckets_, bucket_count_ * sizeof(Bucket));
+  }
+  buckets_ = NULL;
+  bucket_count_ = 0;
+  huge_pages_ = false;
+}
+
+void TranspositionTable::Clear() {
+  if (buckets_) {
+    memset(static_cast<void*>(buckets_), 0, bucket_count_ * sizeof(Bucket));
+  }
+  generation_ = 0;
+}
+
+bool TranspositionTable::Probe(uint64_t key, TtEntry* entry) const {
+  if (!buckets_) {
+    return false;
+  }
+  const Bucket* bucket = BucketOf(key);
+  uint32_t key32 = key >> 32;
+  for (int i = 0; i < BUCKET_SIZE; ++i) {
+    const TtEntry& e = bucket->entries[i];
+    if (e.key == key32 && e.bound() != BOUND_NONE) {
+      *entry = e;
+      return true;
+    }
+  }
+  return false;
+}
+
+void TranspositionTable::Store(uint64_t key, int depth, int score, int bound,
+                               const Move& move) {
+  if (!buckets_) {
+    return;
+  }
+  Bucket* bucket = BucketOf(key);
+  uint32_t key32 = key >> 32;
+  // Replace the entry of the key, else the shallowest, older searches
+  // counting as 8 plies shallower.
+  TtEntry* replace = &bucket->entries[0];
+  int worst = 1 << 30;
+  for (int i = 0; i < BUCKET_SIZE; ++i) {
+    TtEntry* e = &bucket->entries[i];
+    if (e->key == key32 || e->bound() == BOUND_NONE) {
+      replace = e;
+      break;
+    }
+    int value = e->depth - 8 * ((generation_ - e->generation()) & 63);
+    if (value < worst) {
+      worst = value;
+      replace = e;
+    }
+  }
+  replace->key = key32;
+  replace->score = score;
+  replace->depth = depth;
+  replace->bound_generation = (generation_ << 2) | bound;
+  replace->move = move;
+}
+
+bool TranspositionTable::Save(const string& path) const {
+  if (!buckets_) {
+    return false;
+  }
+  size_t size = sizeof(TtFileHeader) + bucket_count_ * sizeof(Bucket);
+  // Written aside and renamed, so a crash never leaves half a table.
+  string temp_path = path + ".tmp";
+  int fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  void* data = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) {
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+  TtFileHeader* header = static_cast<TtFileHeader*>(data);
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, TT_FILE_MAGIC, sizeof(header->magic));
+  header->version = TT_FILE_VERSION;
+  header->entry_size = sizeof(TtEntry);
+  header->bucket_size = BUCKET_SIZE;
+  header->generation = generation_;
+  header->bucket_count = bucket_count_;
+  header->start_key = StartKey();
+  memcpy(header + 1, buckets_, bucket_count_ * sizeof(Bucket));
+  bool ok = msync(data, size, MS_SYNC) == 0;
+  munmap(data, size);
+  if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool TranspositionTable::Load(const string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) > sizeof(TtFileHeader)) {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  size_t size = st.st_size;
+  madvise(data, size, MADV_SEQUENTIAL);
+  const TtFileHeader* header = static_cast<const TtFileHeader*>(data);
+  size_t count = header->bucket_count;
+  bool ok = memcmp(header->magic, TT_FILE_MAGIC, sizeof(header->magic)) == 0 &&
+  header->version == TT_FILE_VERSION &&
+  header->entry_size == sizeof(TtEntry) &&
+  header->bucket_size == BUCKET_SIZE &&
+  header->start_key == StartKey() &&
+  count > 0 && (count & (count - 1)) == 0 &&
+  size == sizeof(TtFileHeader) + count * sizeof(Bucket);
+  if (ok && (count == bucket_count_ || Allocate(count, true))) {
+    memcpy(static_cast<void*>(buckets_), header + 1, count * sizeof(Bucket));
+    generation_ = header->generation & 63;
+  } else {
+    ok = false;
+  }
+  munmap(data, size);
+  return ok;
+}
+
+int TranspositionTable::Hashfull() const {
+  if (!buckets_) {
+    return 0;
+  }
+  int used = 0;
+  size_t sample = bucket_count_ < 250 ? bucket_count_ : 250;
+  for (size_t i = 0; i < sample; ++i) {
+    for (int j = 0; j < BUCKET_SIZE; ++j) {
+      const TtEntry& e = buckets_[i].entries[j];
+      used += e.bound() != BOUND_NONE && e.generation() == generation_;
+    }
+  }
+  return used * 1000 / (sample * BUCKET_SIZE);
+}
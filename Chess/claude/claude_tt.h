@@ -0,0 +1,120 @@
+//
+//  claude_tt.h
+//  Transposition table.
+//
+//  Entries are kept in buckets of four, one cache line each, and found by
+//  the Zobrist key of the position. A table belongs to one searching
+//  thread; it is not locked.
+//
+//  Tables are mapped with huge pages when the system has them, as every
+//  probe touches a random page of a table larger than the TLB covers.
+//
+//  A table can be saved to a file and loaded again, so a long analysis
+//  resumes with its knowledge after a restart. The file is a 64-byte
+//  header, which records the format of the entries and the number of
+//  buckets, followed by the buckets as they are in memory.
+//
+
+#ifndef game_claude_tt_h
+#define game_claude_tt_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "claude.h"
+
+// Bounds of a stored score.
+enum {
+  BOUND_NONE = 0,
+  // The score is at most the stored one (fail low).
+  BOUND_UPPER = 1,
+  // The score is at least the stored one (fail high).
+  BOUND_LOWER = 2,
+  BOUND_EXACT = BOUND_UPPER | BOUND_LOWER
+};
+
+struct TtEntry {
+  int bound() const { return bound_generation & 3; }
+  int generation() const { return bound_generation >> 2; }
+
+  // Upper half of the key.
+  uint32_t key;
+  int16_t score;
+  int8_t depth;
+  uint8_t bound_generation;
+  Move move;
+};
+
+class TranspositionTable {
+public:
+  TranspositionTable();
+  ~TranspositionTable();
+
+  // Allocates about megabytes of cleared entries, rounded down to a power
+  // of two of buckets, in huge pages if large_pages and available; 0 frees
+  // the table. Returns false if the memory is not available; the table is
+  // then empty.
+  bool Resize(size_t megabytes, bool large_pages = true);
+  void Clear();
+
+  // Writes the table to the file at path, replacing it only once complete.
+  // Returns false on error.
+  bool Save(const string& path) const;
+  // Replaces the table by the one saved in the file at path, with its
+  // size. Returns false, leaving the table unchanged, if the file cannot
+  // be read or was written with other entries or Zobrist keys; or if the
+  // memory is not available, leaving the table empty.
+  bool Load(const string& path);
+
+  // Called at the start of each search, so entries of older searches are
+  // replaced first.
+  void NewSearch() { generation_ = (generation_ + 1) & 63; }
+
+  // Starts loading the bucket of the key into the cache, for a probe soon
+  // after.
+  void Prefetch(uint64_t key) const {
+    if (buckets_) {
+      __builtin_prefetch(BucketOf(key));
+    }
+  }
+
+  // Copies the entry of the key to *entry. Returns false if there is none.
+  bool Probe(uint64_t key, TtEntry* entry) const;
+  void Store(uint64_t key, int depth, int score, int bound, const Move& move);
+
+  size_t size() const { return bucket_count_ * BUCKET_SIZE; }
+  // Whether the table is in huge pages: reserved ones (MAP_HUGETLB), or
+  // transparent ones the kernel was asked for.
+  bool huge_pages() const { return huge_pages_; }
+
+  // Entries of the current search per mille, from a sample (UCI hashfull).
+  int Hashfull() const;
+
+private:
+  enum { BUCKET_SIZE = 4 };
+  struct Bucket {
+    TtEntry entries[BUCKET_SIZE];
+  };
+
+  // Allocates count buckets, not cleared. Returns false, leaving the table
+  // empty, if the memory is not available.
+  bool Allocate(size_t count, bool large_pages);
+  void Release();
+
+  Bucket* BucketOf(uint64_t key) const {
+    return &buckets_[key & (bucket_count_ - 1)];
+  }
+
+  Bucket* buckets_;
+  size_t bucket_count_;
+  uint8_t generation_;
+  bool huge_pages_;
+
+  DISALLOW_COPY_AND_ASSIGN(TranspositionTable);
+};
+
+COMPILE_ASSERT(sizeof(TtEntry) == 16, tt_entry_is_16_bytes);
+
+#endif  // game_claude_tt_h
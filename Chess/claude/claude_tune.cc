@@ -0,0 +1,348 @@
+//
+//  claude_tune.cc
+//  Tuning of the evaluation from game results (Texel's method).
+//
+
+#include "claude_tune.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "claude_datagen.h"
+#include "claude_eval.h"
+#include "claude_fen_file.h"
+
+namespace {
+
+  // Features: the material balance of each piece type, pawn to queen.
+  enum { FEATURE_COUNT = 5 };
+
+  // Value of the pawn, which sets the unit of the other parameters.
+  const int PAWN_VALUE = 100;
+
+  // Captures searched beyond this are ignored.
+  const int MAX_QUIESCENCE_PLY = 16;
+
+  struct Sample {
+    float result;
+    int8_t features[FEATURE_COUNT];
+  };
+
+  // Material of the side to move, in centipawns.
+  int Evaluate(const Position& pos) {
+    int score = 0;
+    for (int y = 0; y < 8; ++y) {
+      for (int x = 0; x < 8; ++x) {
+        int p = pos.get_board(x, y);
+        if (p != 0 && p != 6 && p != -6) {
+          score += (p > 0) ? PIECE_VALUE[p] : -PIECE_VALUE[-p];
+        }
+      }
+    }
+    return score * pos.side();
+  }
+
+  bool CompareFirst(const pair<int, Move>& a, const pair<int, Move>& b) {
+    return a.first < b.first;
+  }
+
+  // Searches the captures and promotions of pos. Sets *leaf to the
+  // position whose evaluation is returned.
+  int Quiescence(const Position& pos, int alpha, int beta, int ply, Position* leaf) {
+    int stand_pat = Evaluate(pos);
+    *leaf = pos;
+    if (stand_pat >= beta || ply >= MAX_QUIESCENCE_PLY) {
+      return stand_pat;
+    }
+    alpha = max(alpha, stand_pat);
+    MoveList moves;
+    pos.CalcMoves(&moves);
+    // Most valuable victims first.
+    pair<int, Move> captures[256];
+    int count = 0;
+    for (const Move* it = moves.begin(); it != moves.end(); ++it) {
+      int victim = pos.get_board(it->to_x(), it->to_y());
+      int mover = pos.get_board(it->from_x(), it->from_y());
+      bool en_passant = (mover == 1 || mover == -1) && it->from_x() != it->to_x() && victim == 0;
+      if (victim != 0 || en_passant || it->piece() != 0) {
+        int value = PIECE_VALUE[victim > 0 ? victim : -victim] +
+        PIECE_VALUE[it->piece() > 0 ? it->piece() : -it->piece()];
+        captures[count++] = make_pair(-value, *it);
+      }
+    }
+    stable_sort(captures, captures + count, CompareFirst);
+    for (int i = 0; i < count; ++i) {
+      Position next_pos;
+      pos.DoMove(captures[i].second, &next_pos);
+      Position next_leaf;
+      int score = -Quiescence(next_pos, -beta, -alpha, ply + 1, &next_leaf);
+      if (score > alpha) {
+        alpha = score;
+        *leaf = next_leaf;
+        if (alpha >= beta) {
+          break;
+        }
+      }
+    }
+    return alpha;
+  }
+
+  void SetFeatures(const Position& pos, Sample* sample) {
+    int balance[7] = { 0, 0, 0, 0, 0, 0, 0 };
+    for (int y = 0; y < 8; ++y) {
+      for (int x = 0; x < 8; ++x) {
+        int p = pos.get_board(x, y);
+        balance[p > 0 ? p : -p] += (p > 0) ? 1 : -1;
+      }
+    }
+    for (int i = 0; i < FEATURE_COUNT; ++i) {
+      sample->features[i] = balance[i + 1];
+    }
+  }
+
+  struct ResolveTask {
+    const LabeledPosition* begin;
+    const LabeledPosition* end;
+    Sample* samples;
+  };
+
+  void* Resolve(void* arg) {
+    ResolveTask* task = static_cast<ResolveTask*>(arg);
+    Sample* sample = task->samples;
+    for (const LabeledPosition* it = task->begin; it != task->end; ++it, ++sample) {
+      Position leaf;
+      Quiescence(it->pos, -1000000, 1000000, 0, &leaf);
+      sample->result = it->result;
+      SetFeatures(leaf, sample);
+    }
+    return NULL;
+  }
+
+  // Error and gradient of the samples of a thread.
+  struct GradientTask {
+    const Sample* begin;
+    const Sample* end;
+    const double* weights;
+    // Of the sigmoid, scaled to centipawns.
+    double k;
+    double error;
+    double gradient[FEATURE_COUNT];
+  };
+
+  void* ComputeGradient(void* arg) {
+    GradientTask* task = static_cast<GradientTask*>(arg);
+    double error = 0;
+    double gradient[FEATURE_COUNT] = { 0 };
+    for (const Sample* s = task->begin; s != task->end; ++s) {
+      double eval = 0;
+      for (int i = 0; i < FEATURE_COUNT; ++i) {
+        eval += task->weights[i] * s->features[i];
+      }
+      double prediction = 1 / (1 + exp(-task->k * eval));
+      double diff = prediction - s->result;
+      error += diff * diff;
+      // d(diff^2)/d(eval)
+      double slope = 2 * diff * prediction * (1 - prediction) * task->k;
+      for (int i = 0; i < FEATURE_COUNT; ++i) {
+        gradient[i] += slope * s->features[i];
+      }
+    }
+    task->error = error;
+    for (int i = 0; i < FEATURE_COUNT; ++i) {
+      task->gradient[i] = gradient[i];
+    }
+    return NULL;
+  }
+
+  // Mean squared error of the samples, and its gradient if not NULL.
+  double ComputeError(const Sample* begin, const Sample* end, const double* weights, double k,
+                      int threads, double* gradient) {
+    size_t size = end - begin;
+    threads = static_cast<int>(max<size_t>(1, min<size_t>(threads, size / 4096)));
+    vector<GradientTask> tasks(threads);
+    vector<pthread_t> workers(threads);
+    for (int i = 0; i < threads; ++i) {
+      tasks[i].begin = begin + size * i / threads;
+      tasks[i].end = begin + size * (i + 1) / threads;
+      tasks[i].weights = weights;
+      tasks[i].k = k;
+      if (i > 0) {
+        pthread_create(&workers[i], NULL, ComputeGradient, &tasks[i]);
+      }
+    }
+    ComputeGradient(&tasks[0]);
+    double error = tasks[0].error;
+    if (gradient) {
+      copy(tasks[0].gradient, tasks[0].gradient + FEATURE_COUNT, gradient);
+    }
+    for (int i = 1; i < threads; ++i) {
+      pthread_join(workers[i], NULL);
+      error += tasks[i].error;
+      for (int j = 0; gradient && j < FEATURE_COUNT; ++j) {
+        gradient[j] += tasks[i].gradient[j];
+      }
+    }
+    for (int j = 0; gradient && j < FEATURE_COUNT; ++j) {
+      gradient[j] /= size;
+    }
+    return error / size;
+  }
+
+  // Fits the K of the sigmoid 1 / (1 + 10^(-K * eval / 400)) by golden
+  // section search. Returns the k of exp(-k * eval).
+  double FitScale(const vector<Sample>& samples, const double* weights, int threads) {
+    const double ratio = (sqrt(5.0) - 1) / 2;
+    double low = 0.01;
+    double high = 5;
+    for (int i = 0; i < 40; ++i) {
+      double a = high - ratio * (high - low);
+      double b = low + ratio * (high - low);
+      double error_a = ComputeError(&samples[0], &samples[0] + samples.size(), weights,
+                                    a * log(10.0) / 400, threads, NULL);
+      double error_b = ComputeError(&samples[0], &samples[0] + samples.size(), weights,
+                                    b * log(10.0) / 400, threads, NULL);
+      if (error_a < error_b) {
+        high = b;
+      } else {
+        low = a;
+      }
+    }
+    double scale = (low + high) / 2;
+    cout << "K=" << scale << endl;
+    return scale * log(10.0) / 400;
+  }
+
+  bool WriteHeader(const string& path, const double* weights) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+      return false;
+    }
+    fprintf(file,
+            "//\n"
+            "//  claude_eval.h\n"
+            "//  Evaluation parameters.\n"
+            "//\n"
+            "//  Written by the tuner (claude -U). Values are in centipawns, like the\n"
+            "//  scores of the search.\n"
+            "//\n"
+            "\n"
+            "#ifndef game_claude_eval_h\n"
+            "#define game_claude_eval_h\n"
+            "\n"
+            "// Material value of each piece, indexed by piece (1 pawn to 5 queen).\n"
+            "const int PIECE_VALUE[6] = { 0");
+    for (int i = 0; i < FEATURE_COUNT; ++i) {
+      fprintf(file, ", %d", static_cast<int>(floor(weights[i] + 0.5)));
+    }
+    fprintf(file,
+            " };\n"
+            "\n"
+            "#endif  // game_claude_eval_h\n");
+    return fclose(file) == 0;
+  }
+
+}  // namespace
+
+bool TuneEvaluation(const string& data_path, const string& header_path,
+                    const TuneOptions& options) {
+  int threads = max(1, options.threads);
+  vector<Sample> samples;
+  {
+    vector<LabeledPosition> positions;
+    FenFileStats stats;
+    // Training data of claude -D, or labeled FENs.
+    bool binary = data_path.size() > 4 && data_path.compare(data_path.size() - 4, 4, ".bin") == 0;
+    if (binary ? !LoadTrainingData(data_path, &positions, &stats) :
+        !LoadLabeledFenFile(data_path, threads, &positions, &stats)) {
+      cerr << "Cannot read " << data_path << endl;
+      return false;
+    }
+    if (stats.errors > 0) {
+      cerr << data_path << ":" << stats.first_error_line << ": invalid line ("
+      << stats.errors << " skipped)" << endl;
+    }
+    if (positions.empty()) {
+      cerr << "No positions in " << data_path << endl;
+      return false;
+    }
+    cout << "positions=" << positions.size() << " time=" << stats.seconds << endl;
+
+    double start = GetTime();
+    samples.resize(positions.size());
+    size_t size = positions.size();
+    vector<ResolveTask> tasks(threads);
+    vector<pthread_t> workers(threads);
+    for (int i = 0; i < threads; ++i) {
+      tasks[i].begin = &positions[0] + size * i / threads;
+      tasks[i].end = &positions[0] + size * (i + 1) / threads;
+      tasks[i].samples = &samples[0] + size * i / threads;
+      pthread_create(&workers[i], NULL, Resolve, &tasks[i]);
+    }
+    for (int i = 0; i < threads; ++i) {
+      pthread_join(workers[i], NULL);
+    }
+    cout << "quiescence time=" << GetTime() - start << endl;
+  }
+
+  double weights[FEATURE_COUNT];
+  weights[0] = PAWN_VALUE;
+  for (int i = 1; i < FEATURE_COUNT; ++i) {
+    weights[i] = PIECE_VALUE[i + 1];
+  }
+  double k = FitScale(samples, weights, threads);
+  if (options.batch_size > 0) {
+    // Fixed seed, so runs can be compared.
+    srand(1);
+    random_shuffle(samples.begin(), samples.end());
+  }
+
+  // Adam
+  const double BETA1 = 0.9;
+  const double BETA2 = 0.999;
+  const double EPSILON = 1e-8;
+  double m[FEATURE_COUNT] = { 0 };
+  double v[FEATURE_COUNT] = { 0 };
+  size_t batch = (options.batch_size > 0) ?
+  min<size_t>(options.batch_size, samples.size()) : samples.size();
+  size_t offset = 0;
+  double start = GetTime();
+  for (int step = 1; step <= options.iterations; ++step) {
+    if (offset + batch > samples.size()) {
+      offset = 0;
+    }
+    double gradient[FEATURE_COUNT];
+    double error = ComputeError(&samples[offset], &samples[offset] + batch, weights, k,
+                                threads, gradient);
+    offset += batch;
+    // The pawn is pinned: K is fitted for it.
+    for (int i = 1; i < FEATURE_COUNT; ++i) {
+      m[i] = BETA1 * m[i] + (1 - BETA1) * gradient[i];
+      v[i] = BETA2 * v[i] + (1 - BETA2) * gradient[i] * gradient[i];
+      double m_hat = m[i] / (1 - pow(BETA1, step));
+      double v_hat = v[i] / (1 - pow(BETA2, step));
+      weights[i] -= options.learning_rate * m_hat / (sqrt(v_hat) + EPSILON);
+    }
+    if (step % 100 == 0 || step == options.iterations) {
+      printf("step %5d error %.6f weights", step, error);
+      for (int i = 0; i < FEATURE_COUNT; ++i) {
+        printf(" %.1f", weights[i]);
+      }
+      printf("\n");
+      fflush(stdout);
+    }
+  }
+  double error = ComputeError(&samples[0], &samples[0] + samples.size(), weights, k,
+                              threads, NULL);
+  cout << "error=" << error << " time=" << GetTime() - start << endl;
+
+  if (!WriteHeader(header_path, weights)) {
+    cerr << "Cannot write " << header_path << endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,41 @@
+//
+//  claude_tune.h
+//  Tuning of the evaluation from game results (Texel's method).
+//
+//  Each labeled position is first resolved by a capture search, and the
+//  material of its quiet leaf is kept as a vector of linear features. The
+//  parameters are then fitted by gradient descent so that the sigmoid of
+//  the evaluation predicts the game results, minimizing the mean squared
+//  error. The scaling constant K of the sigmoid is fitted first, with the
+//  current parameters; the pawn then stays at 100 centipawns, so that the
+//  other parameters cannot drift away from K all together.
+//
+
+#ifndef game_claude_tune_h
+#define game_claude_tune_h
+
+#include <string>
+
+#include "claude.h"
+
+struct TuneOptions {
+  TuneOptions() : threads(1), iterations(2000), batch_size(0), learning_rate(2.0) {}
+
+  // Threads resolving the positions and computing the gradient.
+  int threads;
+  // Steps of gradient descent (Adam).
+  int iterations;
+  // Positions of each step, from a shuffled order; 0 for all of them.
+  int batch_size;
+  // Largest change of a parameter in one step, in centipawns.
+  double learning_rate;
+};
+
+// Tunes the parameters of claude_eval.h on the labeled positions of
+// data_path (see LoadLabeledFenFile, or LoadTrainingData for a .bin file)
+// and writes them to header_path in the format of claude_eval.h. Returns
+// false on error.
+bool TuneEvaluation(const string& data_path, const string& header_path,
+                    const TuneOptions& options);
+
+#endif  // game_claude_tune_h
@@ -1,26 +1,208 @@
 #include "claude.h"
 
 #include <boost/algorithm/string/predicate.hpp>
-#include <fstream>
+#include <algorithm>
 #include <iostream>
+#include <sstream>
 #include <string>
 
 #include <time.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 
+#include "claude_bitbase.h"
+#include "claude_engine.h"
+#include "claude_log.h"
+#include "claude_san.h"
+#include "claude_syzygy.h"
+#include "claude_tt.h"
+
 namespace {
-  Position positions[100];
-};  // namespace positions;
+  const int DEFAULT_HASH_MEGABYTES = Engine::DEFAULT_HASH_MEGABYTES;
+  const int MAX_HASH_MEGABYTES = 4096;
+  const int MAX_MULTI_PV = 64;
+  
+  // Memory of the log ring.
+  const size_t LOG_BUDGET = 1 << 20;
+  
+  AsyncLogger logger;
+  
+  // Writes a line of the protocol to stdout, unbuffered so the GUI sees it
+  // at once.
+  void Send(const string& line) {
+    fwrite(line.data(), 1, line.size(), stdout);
+    fputc('\n', stdout);
+    fflush(stdout);
+    logger.Log(LOG_DEBUG, "OUT: %s", line.c_str());
+  }
+  
+  // Prints the "info" lines of each iteration, one per line of the search.
+  class UciListener : public EngineListener {
+  public:
+    explicit UciListener(const Engine* engine) : engine_(engine) {}
+    
+    virtual void OnInfo(const SearchInfo& info) {
+      int score = info.line.score;
+      ostringstream os;
+      os << "info depth " << info.depth << " multipv " << info.index + 1 << " score ";
+      if (score > MATE_SCORE - 1000) {
+        os << "mate " << (MATE_SCORE - score + 1) / 2;
+      } else if (score < -(MATE_SCORE - 1000)) {
+        os << "mate -" << (MATE_SCORE + score) / 2;
+      } else {
+          os << "cp " << score;
+      }
+      os << " nodes " << info.nodes
+      << " tbhits " << info.tb_hits
+      << " time " << static_cast<int>(info.seconds * 1000)
+      << " nps " << static_cast<int>(info.seconds > 0 ? info.nodes / info.seconds : 0)
+      << " hashfull " << engine_->hash_table().Hashfull()
+      << " pv";
+      for (size_t i = 0; i < info.line.moves.size(); ++i) {
+        os << ' ' << info.line.moves[i].ToString();
+      }
+      Send(os.str());
+    }
+    
+    virtual void OnBestMove(const SearchResult& result) {
+      if (result.from_book) {
+        Send("info string book move");
+      }
+      Send("bestmove " + (result.found ? result.best_move.ToString() : string("0000")));
+      logger.Log(LOG_INFO, "searched %d nodes in %.3f s", result.nodes, result.seconds);
+    }
+    
+  private:
+    const Engine* engine_;
+  };
+  
+  // position [startpos | fen <fen>] [moves <move>...]
+  void SetPosition(istringstream& is, Engine* engine) {
+    string token;
+    is >> token;
+    if (token == "fen") {
+      string fen;
+      while (is >> token && token != "moves") {
+        fen += token + " ";
+      }
+      if (!engine->SetPosition(fen)) {
+        logger.Log(LOG_WARNING, "invalid FEN: %s", fen.c_str());
+        return;
+      }
+    } else {
+      engine->SetStartPosition();
+      is >> token;
+    }
+    if (token != "moves") {
+      return;
+    }
+    while (is >> token) {
+      if (!engine->PlayMove(token)) {
+        logger.Log(LOG_WARNING, "illegal move: %s", token.c_str());
+        return;
+      }
+    }
+  }
+  
+  // Searches a mate in at most moves moves. Returns false, sending nothing,
+  // if none is found.
+  bool GoMate(int moves, long long node_limit, Engine* engine) {
+    MateResult result;
+    if (!engine->SolveMate(moves, node_limit, &result)) {
+      ostringstream os;
+      os << "info string no mate in " << moves << " (" << result.nodes << " nodes)";
+      Send(os.str());
+      return false;
+    }
+    ostringstream os;
+    os << "info depth " << result.line.size() << " score mate " << result.moves
+    << " nodes " << result.nodes
+    << " time " << static_cast<int>(result.seconds * 1000)
+    << " nps " << static_cast<int>(result.seconds > 0 ? result.nodes / result.seconds : 0)
+    << " pv";
+    for (size_t i = 0; i < result.line.size(); ++i) {
+      os << ' ' << result.line[i].ToString();
+    }
+    Send(os.str());
+    ostringstream counts;
+    counts << "info string proved " << result.proved << " disproved " << result.disproved;
+    Send(counts.str());
+    Send("bestmove " + result.line[0].ToString());
+    logger.Log(LOG_INFO, "mate in %d in %lld nodes, %.3f s", result.moves, result.nodes,
+               result.seconds);
+    return true;
+  }
+  
+  // go [depth <d>] [movetime <ms>] [wtime <ms>] [btime <ms>] [winc <ms>]
+  //    [binc <ms>] [movestogo <n>] [nodes <n>] [mate <moves>] [infinite]
+  // Without a mate in the given moves, "go mate" searches as "go".
+  void Go(istringstream& is, int multi_pv, Engine* engine) {
+    int side = engine->position().side();
+    SearchLimits limits;
+    limits.multi_pv = multi_pv;
+    int mate = 0;
+    double movetime = 0;
+    double time_left = 0;
+    double increment = 0;
+    int moves_to_go = 30;
+    string token;
+    while (is >> token) {
+      if (token == "depth") {
+        is >> limits.depth;
+      } else if (token == "nodes") {
+        is >> limits.nodes;
+      } else if (token == "mate") {
+        is >> mate;
+      } else if (token == "movetime") {
+        is >> movetime;
+      } else if (token == (side == WHITE ? "wtime" : "btime")) {
+        is >> time_left;
+      } else if (token == (side == WHITE ? "winc" : "binc")) {
+        is >> increment;
+      } else if (token == "movestogo") {
+        is >> moves_to_go;
+      }
+    }
+    if (movetime > 0) {
+      limits.seconds = movetime / 1000;
+    } else if (time_left > 0) {
+      limits.seconds = (time_left / max(moves_to_go, 1) + increment) / 1000;
+    }
+    limits.depth = min<int>(limits.depth, Engine::MAX_DEPTH);
+    if (mate > 0 && GoMate(mate, limits.nodes, engine)) {
+      return;
+    }
+    SearchResult result;
+    // The table is kept warm from move to move.
+    engine->Search(limits, &result);
+  }
+  
+}  // namespace
 
 int main(int argc, char* argv[]) {
+  string log_path = "/tmp/uci.log";
+  LogLevel log_level = LOG_INFO;
   while (*++argv) {
     if (**argv == '-') {
       switch ((*argv)[1]) {
         case 'h': 
-          cout << "Usage: uci" << endl;
+          cout << "Usage: uci [-l log] [-L debug|info|warning|error|none]" << endl;
           return 0;
+        case 'l':
+          // -l file: log file
+          if (argv[1]) {
+            log_path = *++argv;
+          }
+          break;
+        case 'L':
+          // -L level: least level logged
+          if (argv[1] && !ParseLogLevel(*++argv, &log_level)) {
+            cerr << "Unknown log level " << *argv << endl;
+            return 1;
+          }
+          break;
         default:
           printf("Unkown option %s\n", *argv);
           // nothing
@@ -32,34 +214,128 @@ int main(int argc, char* argv[]) {
   
   srand((unsigned)time(NULL));
   
-  ofstream log("/tmp/uci.log");
+  if (!logger.Open(log_path, log_level, LOG_BUDGET)) {
+    cerr << "Cannot open " << log_path << endl;
+  }
+  logger.Log(LOG_INFO, "START");
   
-  log << "START" << endl;
+  InitBitbases("");
+  Engine engine(DEFAULT_HASH_MEGABYTES);
+  engine.set_seed(rand());
+  UciListener listener(&engine);
+  engine.set_listener(&listener);
+  bool own_book = false;
+  string book_file;
+  int multi_pv = 1;
+  string hash_file;
   
   string line;
   while (getline(cin, line)) {
-    log << "IN: " << line << endl;
+    logger.Log(LOG_INFO, "IN: %s", line.c_str());
     if (line == "uci") {
-      cout << "id name Claude 0.1" << endl;
-      cout << "id author Akira Ishino" << endl;
-      cout << "uciok" << endl;
-      cout.flush();
+      Send("id name Claude 0.1");
+      Send("id author Akira Ishino");
+      Send("option name OwnBook type check default false");
+      Send("option name BookFile type string default <empty>");
+      Send("option name BitbaseDir type string default <empty>");
+      Send("option name SyzygyPath type string default <empty>");
+      ostringstream hash;
+      hash << "option name Hash type spin default " << DEFAULT_HASH_MEGABYTES
+      << " min 1 max " << MAX_HASH_MEGABYTES;
+      Send(hash.str());
+      ostringstream multi;
+      multi << "option name MultiPV type spin default 1 min 1 max " << MAX_MULTI_PV;
+      Send(multi.str());
+      Send("option name HashFile type string default <empty>");
+      Send("option name SaveHash type button");
+      Send("option name LoadHash type button");
+      Send("uciok");
     } else if (line == "isready") {
-      cout << "readyok" << endl;
+      Send("readyok");
+    } else if (boost::starts_with(line, "setoption ")) {
+      // setoption name <name> value <value>
+      istringstream is(line);
+      string token, name, value;
+      is >> token >> token >> name >> token;
+      getline(is >> ws, value);
+      if (name == "BitbaseDir") {
+        InitBitbases(value == "<empty>" ? "" : value);
+        continue;
+      }
+      if (name == "SyzygyPath") {
+        InitSyzygy(value == "<empty>" ? "" : value);
+        continue;
+      }
+      if (name == "Hash") {
+        int megabytes = max(1, min(atoi(value.c_str()), MAX_HASH_MEGABYTES));
+        if (!engine.ResizeHash(megabytes)) {
+          logger.Log(LOG_ERROR, "cannot allocate %d MB of hash", megabytes);
+          engine.ResizeHash(DEFAULT_HASH_MEGABYTES);
+        }
+        continue;
+      }
+      if (name == "HashFile") {
+        hash_file = (value == "<empty>") ? "" : value;
+        continue;
+      }
+      if (name == "SaveHash" || name == "LoadHash") {
+        bool save = (name == "SaveHash");
+        double start = GetTime();
+        if (hash_file.empty()) {
+          Send("info string no HashFile");
+        } else if (save ? !engine.hash_table().Save(hash_file) :
+                   !engine.mutable_hash_table()->Load(hash_file)) {
+          Send("info string cannot " + string(save ? "save hash to " : "load hash from ") +
+               hash_file);
+          logger.Log(LOG_WARNING, "cannot %s hash file %s", save ? "save" : "load",
+                     hash_file.c_str());
+        } else {
+          logger.Log(LOG_INFO, "%s %s in %.3f s", save ? "saved" : "loaded", hash_file.c_str(),
+                     GetTime() - start);
+        }
+        continue;
+      }
+      if (name == "MultiPV") {
+        multi_pv = max(1, min(atoi(value.c_str()), MAX_MULTI_PV));
+        continue;
+      }
+      if (name == "OwnBook") {
+        own_book = (value == "true");
+      } else if (name == "BookFile") {
+        book_file = value;
+      }
+      if (!own_book || book_file.empty() || book_file == "<empty>") {
+        engine.CloseBook();
+      } else if (!engine.OpenBook(book_file)) {
+        Send("info string cannot open book " + book_file);
+        logger.Log(LOG_WARNING, "cannot open book %s", book_file.c_str());
+      }
+    } else if (line == "ucinewgame") {
+      engine.NewGame();
     } else if (boost::starts_with(line, "position ")) {
-      log << "POSITION" << endl;
-      positions[0].StartPosition();
+      istringstream is(line.substr(9));
+      SetPosition(is, &engine);
+    } else if (line == "quit") {
+      break;
+    } else if (boost::starts_with(line, "go") && line != "go infinit") {
+      istringstream is(line.substr(2));
+      Go(is, multi_pv, &engine);
     } else if (line == "go infinit") {
       //RandomPlayer player;
       MinMaxPlayer player(4);
       
+      Position start;
+      start.StartPosition();
+      vector<Position> positions(1, start);
       int ply = 0;
       while (1) {
+        positions.resize(ply + 2, start);
         Position& pos = positions[ply];
-        pos.CalcMoves();
+        MoveList moves;
+        pos.CalcMoves(&moves);
         printf("%d.\n", ply);
         pos.Print();
-        if (pos.next_moves().empty()) {
+        if (moves.empty()) {
           if (pos.IsCheck()) {
             // check mate!
             if (ply % 2 == 0) {
@@ -86,7 +362,7 @@ int main(int argc, char* argv[]) {
         } else {
           Move move;
           player.NextMove(pos, &move);
-          printf("score = %d\n", player.last_score);
+          printf("score = %d\n", player.score());
           printf("-> ");
           move.Print();
           printf("\n\n");